@@ -0,0 +1,440 @@
+// aicr_bench: generates a synthetic corpus, times each pipeline stage on it
+// and optionally compares the results against a stored baseline.
+
+#include "CorpusGenerator.hpp"
+
+#include "ai/AiBatcher.hpp"
+#include "ai/AiEngine.hpp"
+#include "analyzers/Analyzer.hpp"
+#include "analyzers/IssueStore.hpp"
+#include "compiledb/CompileDb.hpp"
+#include "discovery/FileDiscovery.hpp"
+#include "profile/Profiler.hpp"
+#include "refactor/RefactorEngine.hpp"
+#include "report/Reporter.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fcntl.h>
+#include <iterator>
+#include <unistd.h>
+
+using namespace aicr;
+using namespace aicr::bench;
+
+static llvm::cl::OptionCategory BenchCat("aicr_bench options");
+
+static llvm::cl::opt<unsigned> TUs(
+  "tus", llvm::cl::desc("Translation units in the generated corpus"),
+  llvm::cl::init(200), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> FnsPerTU(
+  "functions", llvm::cl::desc("Functions per TU"),
+  llvm::cl::init(8), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> FnLines(
+  "fn-lines", llvm::cl::desc("Statements per function body"),
+  llvm::cl::init(40), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> IncludeDepth(
+  "include-depth", llvm::cl::desc("Length of the project header chain every TU includes"),
+  llvm::cl::init(4), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<double> TemplateDensity(
+  "template-density", llvm::cl::desc("Fraction of functions that are templates (0..1)"),
+  llvm::cl::init(0.25), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> Vars(
+  "vars", llvm::cl::desc("Local variables per function"),
+  llvm::cl::init(6), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<uint64_t> Seed(
+  "seed", llvm::cl::desc("Generator seed"),
+  llvm::cl::init(1), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<std::string> CorpusDir(
+  "corpus-dir", llvm::cl::desc("Where to generate the corpus (default: a fresh temp dir, removed at exit). "
+                               "The apply-fixes stage rewrites it."),
+  llvm::cl::init(""), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> Jobs(
+  "jobs", llvm::cl::desc("Parallelism for stages that have it (0 = all cores)"),
+  llvm::cl::init(0), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<unsigned> ReportIssues(
+  "report-issues", llvm::cl::desc("Issues pushed through each reporter"),
+  llvm::cl::init(200000), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<std::string> JsonOut(
+  "json", llvm::cl::desc("Write results as JSON to this file (default: stdout)"),
+  llvm::cl::init(""), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<std::string> BaselineJson(
+  "baseline", llvm::cl::desc("Compare against results previously written with --json"),
+  llvm::cl::init(""), llvm::cl::cat(BenchCat));
+
+static llvm::cl::opt<double> Threshold(
+  "threshold", llvm::cl::desc("Allowed relative regression against --baseline"),
+  llvm::cl::init(0.10), llvm::cl::cat(BenchCat));
+
+namespace {
+
+// Each stage's own peak RSS needs the high-water mark reset before it, which
+// only Linux offers. Elsewhere getrusage() keeps the peak of the whole run,
+// which says nothing about the stages after the largest one, so stages
+// report no RSS there.
+bool resetPeakRss() {
+#ifdef __linux__
+  int fd = ::open("/proc/self/clear_refs", O_WRONLY);
+  if (fd < 0) return false;
+  bool ok = ::write(fd, "5", 1) == 1;
+  ::close(fd);
+  return ok;
+#else
+  return false;
+#endif
+}
+
+// Peak RSS since the last resetPeakRss(), from /proc/self/status
+double peakRssMb() {
+  auto buf = llvm::MemoryBuffer::getFileAsStream("/proc/self/status");
+  if (!buf) return 0;
+  llvm::StringRef text = (*buf)->getBuffer();
+  size_t at = text.find("VmHWM:");
+  if (at == llvm::StringRef::npos) return 0;
+  uint64_t kb = 0;
+  llvm::StringRef v = text.drop_front(at + 6).ltrim();
+  v = v.take_while([](char c) { return c >= '0' && c <= '9'; });
+  return v.getAsInteger(10, kb) ? 0 : kb / 1024.0;
+}
+
+struct StageResult {
+  std::string name;
+  double seconds = 0;
+  uint64_t files = 0;
+  uint64_t issues = 0;
+  uint64_t items = 0;    // anything else the stage processes (entries, queries, edits)
+  double peakRssMb = 0;  // high-water mark during the stage; 0 where unmeasured
+};
+
+class Bench {
+  std::vector<StageResult> results_;
+
+public:
+  // Times `fn`, which fills in the counts of what it processed
+  StageResult& run(const std::string& name, const std::function<void(StageResult&)>& fn) {
+    StageResult r;
+    r.name = name;
+    bool measured = resetPeakRss();
+    auto t0 = std::chrono::steady_clock::now();
+    fn(r);
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (measured) r.peakRssMb = peakRssMb();
+    results_.push_back(r);
+    llvm::errs() << llvm::format("%-24s %9.3f s", name.c_str(), r.seconds);
+    auto rate = [&](uint64_t n, const char* what) {
+      if (n && r.seconds > 0) llvm::errs() << llvm::format("  %12.0f %s/s", n / r.seconds, what);
+    };
+    rate(r.files, "files");
+    rate(r.issues, "issues");
+    rate(r.items, "items");
+    if (r.peakRssMb > 0) llvm::errs() << llvm::format("  rss %7.1f MB", r.peakRssMb);
+    llvm::errs() << "\n";
+    return results_.back();
+  }
+
+  // Adds a stage measured elsewhere (e.g. by the profiler)
+  void add(StageResult r) { results_.push_back(std::move(r)); }
+
+  llvm::json::Object stagesJson() const {
+    llvm::json::Object stages;
+    for (const auto& r : results_) {
+      llvm::json::Object o{{"seconds", r.seconds}};
+      if (r.peakRssMb > 0) o["peak_rss_mb"] = r.peakRssMb;
+      auto rate = [&](uint64_t n, const char* count, const char* perSec) {
+        if (!n) return;
+        o[count] = (int64_t)n;
+        if (r.seconds > 0) o[perSec] = n / r.seconds;
+      };
+      rate(r.files, "files", "files_per_sec");
+      rate(r.issues, "issues", "issues_per_sec");
+      rate(r.items, "items", "items_per_sec");
+      stages[r.name] = std::move(o);
+    }
+    return stages;
+  }
+};
+
+// Throughputs may not drop, and peak RSS may not grow, by more than the
+// threshold. Stages missing on either side are skipped.
+bool compareToBaseline(const llvm::json::Object& current, const std::string& path,
+                       double threshold) {
+  auto buf = llvm::MemoryBuffer::getFile(path);
+  if (!buf) {
+    llvm::errs() << "Cannot read baseline " << path << "\n";
+    return false;
+  }
+  auto parsed = llvm::json::parse((*buf)->getBuffer());
+  if (!parsed) {
+    llvm::errs() << "Baseline " << path << ": " << llvm::toString(parsed.takeError()) << "\n";
+    return false;
+  }
+  const auto* base = parsed->getAsObject() ? parsed->getAsObject()->getObject("stages") : nullptr;
+  const auto* cur = current.getObject("stages");
+  if (!base || !cur) {
+    llvm::errs() << "Baseline " << path << " has no stages\n";
+    return false;
+  }
+
+  bool ok = true;
+  llvm::errs() << "\nAgainst baseline " << path << " (threshold "
+               << llvm::format("%.0f%%", threshold * 100) << "):\n";
+  for (const auto& [name, v] : *cur) {
+    const auto* b = base->getObject(name);
+    const auto* c = v.getAsObject();
+    if (!b || !c) continue;
+    for (const char* metric : {"files_per_sec", "issues_per_sec", "items_per_sec", "peak_rss_mb"}) {
+      auto bv = b->getNumber(metric), cv = c->getNumber(metric);
+      if (!bv || !cv || *bv <= 0) continue;
+      bool lowerIsBetter = llvm::StringRef(metric) == "peak_rss_mb";
+      double change = (*cv - *bv) / *bv;
+      bool regressed = lowerIsBetter ? change > threshold : change < -threshold;
+      ok &= !regressed;
+      llvm::errs() << llvm::format("  %-24s %-15s %12.1f -> %12.1f  %+6.1f%%%s\n",
+                                   name.str().c_str(), metric, *bv, *cv, change * 100,
+                                   regressed ? "  REGRESSION" : "");
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, const char** argv) {
+  llvm::cl::HideUnrelatedOptions(BenchCat);
+  llvm::cl::ParseCommandLineOptions(argc, argv, "aicr benchmark suite\n");
+
+  CorpusSpec spec;
+  spec.tus = TUs;
+  spec.functionsPerTU = FnsPerTU;
+  spec.functionLines = FnLines;
+  spec.includeDepth = IncludeDepth;
+  spec.templateDensity = TemplateDensity;
+  spec.varsPerFunction = Vars;
+  spec.seed = Seed;
+
+  // A corpus generated into a temp directory goes with the bench, however
+  // it exits
+  struct RemoveOnExit {
+    std::string dir;
+    ~RemoveOnExit() {
+      if (!dir.empty()) llvm::sys::fs::remove_directories(dir);
+    }
+  } temp;
+  std::string dir = CorpusDir;
+  if (dir.empty()) {
+    llvm::SmallString<256> tmp;
+    if (llvm::sys::fs::createUniqueDirectory("aicr-bench", tmp)) {
+      llvm::errs() << "Cannot create a temp directory\n";
+      return 1;
+    }
+    dir = std::string(tmp.str());
+    temp.dir = dir;
+  }
+
+  Bench bench;
+  std::string err;
+  Corpus corpus;
+  bench.run("generate", [&](StageResult& r) {
+    if (!generateCorpus(spec, dir, corpus, &err)) return;
+    r.files = corpus.sources.size() + corpus.headers.size();
+  });
+  if (!err.empty()) {
+    llvm::errs() << err << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> files;
+  bench.run("discovery", [&](StageResult& r) {
+    DiscoverOptions d;
+    d.jobs = Jobs;
+    if (!discoverFiles({corpus.root}, d, files, &err)) return;
+    r.files = files.size();
+  });
+
+  std::string indexDir = corpus.root + "/.index";
+  for (const char* name : {"compile-db", "compile-db-indexed"}) {
+    // The first load scans the JSON and writes the index the second reuses
+    bench.run(name, [&](StageResult& r) {
+      auto db = IndexedCompilationDatabase::loadFromFile(corpus.compileDb, indexDir, err);
+      if (db) r.items = db->getAllFiles().size();
+    });
+  }
+
+  // Parse and match, with the profiler splitting the time per rule
+  std::unique_ptr<AiEngine> ai(makeHeuristicAi());
+  std::vector<Issue> issues;
+  Profiler::enable();
+  auto& analyze = bench.run("analyze", [&](StageResult& r) {
+    AnalyzeOptions opts;
+    opts.jobs = Jobs;
+    opts.compileDb = corpus.compileDb;
+    if (!makeCppAnalyzer()->analyzePaths(files, opts, ai.get(), issues))
+      llvm::errs() << "analysis reported failures\n";
+    r.files = files.size();
+    r.issues = issues.size();
+  });
+  if (auto* p = Profiler::active()) {
+    StageResult parse;
+    parse.name = "parse";
+    parse.files = analyze.files;
+    double cpuMs = 0;
+    for (const auto& tu : p->tuProfiles()) cpuMs += tu.totalMs - tu.matchMs;
+    // Per-TU times add up across workers; scale to the stage's wall clock
+    double totalMs = 0;
+    for (const auto& tu : p->tuProfiles()) totalMs += tu.totalMs;
+    parse.seconds = totalMs > 0 ? analyze.seconds * cpuMs / totalMs : 0;
+    bench.add(parse);
+    for (const auto& [id, t] : p->ruleTotals()) {
+      StageResult rule;
+      rule.name = "match:" + id;
+      rule.seconds = t.wallMs / 1e3;
+      rule.items = t.calls;
+      rule.issues = t.issues;
+      bench.add(rule);
+    }
+    Profiler::disable();
+  }
+
+  // LONG_FUNC without a parse must agree with the parsed rule. A low
+  // threshold makes every generated function count; DUPLICATE_CODE only
+  // forces the full parse and is left out of the comparison.
+  bool rawAgrees = true;
+  bench.run("long-func-raw", [&](StageResult& r) {
+    auto longFuncs = [&](std::vector<std::string> rules) {
+      AnalyzeOptions opts;
+      opts.jobs = Jobs;
+      opts.compileDb = corpus.compileDb;
+      opts.longFunctionLineThreshold = std::max(1u, FnLines / 2);
+      opts.rules = std::move(rules);
+      std::vector<Issue> found;
+      if (!makeCppAnalyzer()->analyzePaths(files, opts, nullptr, found))
+        llvm::errs() << "analysis reported failures\n";
+      std::vector<std::string> out;
+      for (const auto& i : found)
+        if (i.id == "LONG_FUNC")
+          out.push_back(i.file + ":" + std::to_string(i.line) + ":" + std::to_string(i.column) +
+                        ": " + i.message);
+      std::sort(out.begin(), out.end());
+      return out;
+    };
+    auto raw = longFuncs({"LONG_FUNC"});
+    auto parsed = longFuncs({"LONG_FUNC", "DUPLICATE_CODE"});
+    r.files = files.size();
+    r.issues = raw.size();
+    std::vector<std::string> onlyRaw, onlyParsed;
+    std::set_difference(raw.begin(), raw.end(), parsed.begin(), parsed.end(),
+                        std::back_inserter(onlyRaw));
+    std::set_difference(parsed.begin(), parsed.end(), raw.begin(), raw.end(),
+                        std::back_inserter(onlyParsed));
+    rawAgrees = onlyRaw.empty() && onlyParsed.empty() && !parsed.empty();
+    if (parsed.empty()) llvm::errs() << "LONG_FUNC reported nothing to compare\n";
+    for (size_t k = 0; k < onlyRaw.size() && k < 10; ++k)
+      llvm::errs() << "  raw only:    " << onlyRaw[k] << "\n";
+    for (size_t k = 0; k < onlyParsed.size() && k < 10; ++k)
+      llvm::errs() << "  parsed only: " << onlyParsed[k] << "\n";
+  });
+
+  // AI: the engine called directly, then through the batcher the analyzer uses
+  std::vector<IdentifierQuery> queries;
+  for (unsigned i = 0; i < 20000; ++i)
+    queries.push_back({i % 3 ? "tmp" : "x" + std::to_string(i % 50),
+                       i % 2 ? "int" : "std::vector<int>", ""});
+  bench.run("ai-direct", [&](StageResult& r) {
+    auto answers = ai->suggestIdentifiers(queries);
+    r.items = answers.size();
+  });
+  bench.run("ai-batched", [&](StageResult& r) {
+    AiBatcher batcher(*ai);
+    std::vector<std::shared_future<AiAnswer>> futures;
+    for (const auto& q : queries) futures.push_back(batcher.suggestIdentifier(q));
+    batcher.flush();
+    for (auto& f : futures) f.wait();
+    r.items = futures.size();
+  });
+
+  // Reporting: the analysis output repeated up to the requested volume
+  IssueStore store;
+  if (!issues.empty())
+    while (store.size() < ReportIssues) store.add(issues);
+  for (const char* format : {"text", "jsonl", "sarif"}) {
+    bench.run(std::string("report-") + format, [&](StageResult& r) {
+      llvm::raw_null_ostream null;
+      auto rep = llvm::StringRef(format) == "text"    ? makeTextReporter(null)
+                 : llvm::StringRef(format) == "jsonl" ? makeJsonlReporter(null)
+                                                      : makeSarifReporter(null);
+      rep->begin();
+      rep->report(store);
+      rep->end();
+      r.issues = store.size();
+    });
+  }
+
+  // Last, since it rewrites the corpus
+  bench.run("apply-fixes", [&](StageResult& r) {
+    std::vector<FixIt> fixes;
+    for (const auto& i : issues)
+      for (const auto& f : i.fixes) fixes.push_back(f);
+    ApplyOptions ao;
+    ao.backup = false;
+    ao.jobs = Jobs;
+    ApplyStats st;
+    if (!RefactorEngine::applyFixes(fixes, ao, &err, &st)) llvm::errs() << err << "\n";
+    r.files = st.files;
+    r.items = st.applied;
+  });
+
+  llvm::json::Object out{
+    {"version", 1},
+    {"corpus", llvm::json::Object{
+      {"tus", (int64_t)spec.tus},
+      {"functions", (int64_t)spec.functionsPerTU},
+      {"fn_lines", (int64_t)spec.functionLines},
+      {"include_depth", (int64_t)spec.includeDepth},
+      {"template_density", spec.templateDensity},
+      {"vars", (int64_t)spec.varsPerFunction},
+      {"seed", (int64_t)spec.seed},
+      {"bytes", (int64_t)corpus.bytes},
+    }},
+    {"stages", bench.stagesJson()},
+  };
+
+  bool ok = (BaselineJson.empty() || compareToBaseline(out, BaselineJson, Threshold)) && rawAgrees;
+  if (!rawAgrees) llvm::errs() << "\nRaw LONG_FUNC results differ from the parsed rule's\n";
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  os << llvm::formatv("{0:2}", llvm::json::Value(std::move(out))) << "\n";
+  os.flush();
+  if (JsonOut.empty()) {
+    llvm::outs() << text;
+  } else {
+    std::error_code ec;
+    llvm::raw_fd_ostream f(JsonOut, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+      llvm::errs() << "Cannot write " << JsonOut << ": " << ec.message() << "\n";
+      return 1;
+    }
+    f << text;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include "CorpusGenerator.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+namespace aicr::bench {
+
+namespace {
+
+// splitmix64: tiny, and unlike <random> distributions, identical everywhere
+class Rng {
+  uint64_t s_;
+public:
+  explicit Rng(uint64_t seed) : s_(seed) {}
+  uint64_t next() {
+    uint64_t z = (s_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  unsigned below(unsigned n) { return n ? (unsigned)(next() % n) : 0; }
+  bool chance(double p) { return (double)(next() >> 11) / (double)(1ull << 53) < p; }
+};
+
+// Names the WEAK_NAME rule flags, and a stem it accepts
+const char* const kWeak[] = {"tmp", "foo", "bar", "data", "x", "y", "z", "a",
+                             "b", "c", "d", "p", "q", "v", "w", "n"};
+constexpr unsigned kNumWeak = sizeof(kWeak) / sizeof(kWeak[0]);
+
+bool writeFile(const std::string& path, const std::string& text, Corpus& out,
+               std::string* error) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    if (error) *error = "Cannot write " + path + ": " + ec.message();
+    return false;
+  }
+  os << text;
+  out.bytes += text.size();
+  return true;
+}
+
+std::string header(unsigned level, unsigned depth) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  os << "#pragma once\n";
+  if (level + 1 < depth) os << "#include \"chain_" << level + 1 << ".hpp\"\n";
+  os << "#include <vector>\n\n"
+     << "namespace chain" << level << " {\n\n"
+     << "struct Node" << level << " {\n"
+     << "  int id = " << level << ";\n"
+     << "  std::vector<int> items;\n"
+     << "};\n\n"
+     << "template <typename T>\n"
+     << "inline T scale" << level << "(T v) {\n"
+     << "  T k = v;\n"
+     << "  return k * " << level + 2 << ";\n"
+     << "}\n\n"
+     << "} // namespace chain" << level << "\n";
+  return os.str();
+}
+
+void function(llvm::raw_ostream& os, Rng& rng, const CorpusSpec& spec,
+              unsigned tu, unsigned fn) {
+  bool tmpl = rng.chance(spec.templateDensity);
+  std::string type = tmpl ? "T" : "int";
+  if (tmpl) os << "template <typename T>\n";
+  os << type << " work_" << tu << "_" << fn << "(" << type << " input) {\n";
+
+  std::vector<std::string> vars;
+  unsigned weakUsed = rng.below(kNumWeak); // rotating start keeps names unique
+  for (unsigned v = 0; v < spec.varsPerFunction; ++v) {
+    std::string name = rng.chance(0.4) && v < kNumWeak
+                         ? kWeak[(weakUsed + v) % kNumWeak]
+                         : "accumulated_" + std::to_string(v);
+    os << "  " << type << " " << name << " = input + " << v << ";\n";
+    vars.push_back(name);
+  }
+  if (vars.empty()) vars.push_back("input");
+
+  for (unsigned l = 0; l < spec.functionLines; ++l) {
+    const auto& a = vars[rng.below((unsigned)vars.size())];
+    const auto& b = vars[rng.below((unsigned)vars.size())];
+    switch (rng.below(4)) {
+    case 0: os << "  " << a << " = " << a << " + " << b << ";\n"; break;
+    case 1: os << "  if (" << a << " > " << b << ") " << a << " = " << b << ";\n"; break;
+    case 2: os << "  " << a << " = chain0::scale0(" << b << ");\n"; break;
+    default: os << "  " << a << " -= " << rng.below(100) << ";\n"; break;
+    }
+  }
+  os << "  return " << vars.front() << ";\n}\n\n";
+
+  // Instantiate templates so the AST has specializations to match
+  if (tmpl) {
+    os << "int use_" << tu << "_" << fn << "() { return work_" << tu << "_" << fn
+       << "<int>(" << fn << ") + (int)work_" << tu << "_" << fn << "<long>(" << fn
+       << "); }\n\n";
+  }
+}
+
+} // namespace
+
+bool generateCorpus(const CorpusSpec& spec, const std::string& root, Corpus& out,
+                    std::string* error) {
+  out = Corpus();
+  llvm::SmallString<256> abs(root);
+  llvm::sys::fs::make_absolute(abs);
+  out.root = std::string(abs.str());
+
+  std::string srcDir = out.root + "/src", incDir = out.root + "/include";
+  for (const auto& d : {srcDir, incDir}) {
+    if (auto ec = llvm::sys::fs::create_directories(d)) {
+      if (error) *error = "Cannot create " + d + ": " + ec.message();
+      return false;
+    }
+  }
+
+  unsigned depth = std::max(1u, spec.includeDepth);
+  for (unsigned l = 0; l < depth; ++l) {
+    std::string path = incDir + "/chain_" + std::to_string(l) + ".hpp";
+    if (!writeFile(path, header(l, depth), out, error)) return false;
+    out.headers.push_back(path);
+  }
+
+  Rng rng(spec.seed);
+  llvm::json::Array db;
+  for (unsigned t = 0; t < spec.tus; ++t) {
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    os << "#include \"chain_0.hpp\"\n#include <vector>\n\n";
+    for (unsigned f = 0; f < spec.functionsPerTU; ++f) function(os, rng, spec, t, f);
+    os.flush();
+
+    std::string path = srcDir + "/tu_" + std::to_string(t) + ".cpp";
+    if (!writeFile(path, text, out, error)) return false;
+    out.sources.push_back(path);
+    db.push_back(llvm::json::Object{
+      {"directory", out.root},
+      {"file", path},
+      {"arguments", llvm::json::Array{"clang++", "-std=c++17", "-I" + incDir, "-c", path,
+                                      "-o", path + ".o"}},
+    });
+  }
+
+  out.compileDb = out.root + "/compile_commands.json";
+  std::string json;
+  llvm::raw_string_ostream js(json);
+  js << llvm::formatv("{0:2}", llvm::json::Value(std::move(db)));
+  js.flush();
+  return writeFile(out.compileDb, json, out, error);
+}
+
+} // namespace aicr::bench
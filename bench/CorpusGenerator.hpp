@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace aicr::bench {
+
+struct CorpusSpec {
+  unsigned tus = 200;            // source files
+  unsigned functionsPerTU = 8;
+  unsigned functionLines = 40;   // statements per function body
+  unsigned includeDepth = 4;     // length of the project header chain each TU includes
+  double   templateDensity = 0.25; // fraction of functions that are templates
+  unsigned varsPerFunction = 6;  // locals per function, some with weak names
+  uint64_t seed = 1;
+};
+
+struct Corpus {
+  std::string root;
+  std::string compileDb;         // root/compile_commands.json
+  std::vector<std::string> sources;
+  std::vector<std::string> headers;
+  uint64_t bytes = 0;
+};
+
+// Writes a synthetic project under `root`: sources in src/, a header chain
+// in include/ and a compile_commands.json. Output depends only on the spec
+// (including the seed), never on the platform or standard library, so
+// numbers from different machines describe the same input.
+bool generateCorpus(const CorpusSpec& spec, const std::string& root, Corpus& out,
+                    std::string* error);
+
+} // namespace aicr::bench
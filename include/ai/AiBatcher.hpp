@@ -0,0 +1,59 @@
+#pragma once
+#include "ai/AiEngine.hpp"
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace aicr {
+
+using AiAnswer = std::optional<std::string>;
+
+// Front for an AiEngine that the analyzer threads share. Identical requests
+// are answered from a memo table. Distinct ones are queued and resolved in
+// batches on resolver threads, so AST traversal never waits on inference.
+// One resolver thread is used unless the engine is thread-safe.
+class AiBatcher {
+public:
+  explicit AiBatcher(AiEngine& engine, size_t batchSize = 64);
+  ~AiBatcher();
+
+  AiBatcher(const AiBatcher&) = delete;
+  AiBatcher& operator=(const AiBatcher&) = delete;
+
+  AiEngine& engine() { return engine_; }
+
+  std::shared_future<AiAnswer> suggestIdentifier(const IdentifierQuery& q);
+  std::shared_future<AiAnswer> docForSignature(const std::string& signature);
+
+  // Resolve whatever is queued now instead of waiting for a full batch
+  void flush();
+
+private:
+  template <class Q>
+  struct Pending {
+    Q query;
+    std::promise<AiAnswer> promise;
+  };
+
+  void loop();
+
+  AiEngine& engine_;
+  size_t batchSize_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  bool flush_ = false;
+  std::unordered_map<std::string, std::shared_future<AiAnswer>> memo_;
+  std::vector<Pending<IdentifierQuery>> names_;
+  std::vector<Pending<std::string>> docs_;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace aicr
@@ -1,9 +1,16 @@
 #pragma once
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace aicr {
 
+struct IdentifierQuery {
+  std::string current;
+  std::string typeHint;
+  std::string usageHint;
+};
+
 // Very small interface: ask for a better identifier name or doc stub
 class AiEngine {
 public:
@@ -18,6 +25,24 @@ public:
   // Produce a docstring snippet (eg. Doxygen) for a function signature
   virtual std::optional<std::string>
   docForSignature(const std::string& signature) = 0;
+
+  // Batch forms of the two calls above, one answer per query in order.
+  // The defaults loop; model-backed engines should run one inference per batch.
+  virtual std::vector<std::optional<std::string>>
+  suggestIdentifiers(const std::vector<IdentifierQuery>& queries);
+  virtual std::vector<std::optional<std::string>>
+  docsForSignatures(const std::vector<std::string>& signatures);
+
+  // Cheap prefilter: false means suggestIdentifier would certainly return
+  // nothing for this name, so the request is never queued
+  virtual bool mayRename(const std::string& current) const { (void)current; return true; }
+
+  // True if the calls above may run concurrently from several threads.
+  // Engines that keep mutable state return false and get serialized.
+  virtual bool isThreadSafe() const { return false; }
+
+  // Stable name for the engine and its model; part of the result cache key
+  virtual std::string identity() const = 0;
 };
 
 // Factory for a heuristic no-ML engine — always available
@@ -1,19 +1,47 @@
 #pragma once
 #include "analyzers/Issue.hpp"
+#include "report/Reporter.hpp"
+#include <cstdint>
+#include <map>
 #include <string>
 #include <vector>
 #include <memory>
 
 namespace aicr {
 
+// Per-TU inputs of project-wide rules (see ProjectIndex), by rule id
+using RuleFacts = std::map<std::string, std::vector<std::string>>;
+
+class Baseline;
+class CostHistory;
+class Overlay;
+struct ChangedLines;
+
 struct AnalyzeOptions {
   int longFunctionLineThreshold = 80;
+  unsigned duplicateMinNodes = 50; // smallest body or block DUPLICATE_CODE compares, in AST nodes
   bool suggestDocs = true;
   bool suggestBetterVarNames = true;
   bool fix = false;           // apply edits
   bool backup = true;         // keep .bak copies before writing
+  bool verifyFixes = false;   // reparse TUs reading edited files; drop fixes that break them
   bool parseAllComments = true;
+  unsigned jobs = 1;          // TUs analyzed in parallel (0 = all cores)
+  std::string cacheDir;       // per-TU result cache; empty disables it
+  uint64_t cacheMaxBytes = 512ull << 20; // evict LRU entries beyond this
+  std::string pchDir;         // precompile shared include blocks; empty disables
+  std::string compileDb;      // compile_commands.json or its directory; empty searches upward
+  std::string resourceDir;    // Clang resource dir; empty detects it
+  std::vector<std::string> rules; // rule ids to run; empty runs them all
   std::vector<std::string> extraArgs; // extra compiler args for ClangTool
+  CostHistory* costs = nullptr;       // receives each analyzed file's wall time
+  std::vector<FixIt>* deferredFixes = nullptr; // with fix: receives the fixes instead of applying them
+  RuleFacts* deferredFacts = nullptr; // receives project-wide rule inputs instead of reporting on them
+  const ChangedLines* changed = nullptr; // only TUs these affect, and issues on these lines
+  const Overlay* overlay = nullptr;      // unsaved buffers read in place of the files on disk
+  uint64_t maxMemoryBytes = 0;          // TU admission budget (0 = none); see --max-memory
+  unsigned memoryReport = 0;             // print this many of the largest TUs once done
+  const Baseline* baseline = nullptr;    // known issues: their rules aren't even run on the node
 };
 
 class AiEngine; // fwd-decl
@@ -21,13 +49,26 @@ class AiEngine; // fwd-decl
 class Analyzer {
 public:
   virtual ~Analyzer() = default;
+  // Issues are handed to `sink` as each TU finishes, in input order. The
+  // caller brackets the run with sink.begin()/end().
   virtual bool analyzePaths(const std::vector<std::string>& paths,
                             const AnalyzeOptions& opts,
                             AiEngine* ai,
-                            std::vector<Issue>& out) = 0;
+                            Reporter& sink) = 0;
+
+  bool analyzePaths(const std::vector<std::string>& paths,
+                    const AnalyzeOptions& opts,
+                    AiEngine* ai,
+                    std::vector<Issue>& out) {
+    CollectingReporter sink(out);
+    return analyzePaths(paths, opts, ai, sink);
+  }
 };
 
 std::unique_ptr<Analyzer> makeCppAnalyzer();
 
+// Project-wide issues from facts gathered under deferredFacts, eg. by shards
+void finishRuleFacts(const RuleFacts& facts, std::vector<Issue>& out);
+
 } // namespace aicr
 
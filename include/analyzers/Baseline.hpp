@@ -0,0 +1,49 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// Issue fingerprints for --baseline. An issue is identified by its rule and
+// its site: the file (relative to the working directory), the function the
+// node is or is declared in, the text of the node's first line with
+// whitespace removed and, for variables, their name: a line may declare
+// several. Line numbers are left out, so edits elsewhere in the file keep a
+// known issue known.
+std::string baselinePath(llvm::StringRef realPath);
+// The directory paths are relative to: the real working directory
+const std::string& baselineRoot();
+uint64_t siteHash(llvm::StringRef path, llvm::StringRef scope, llvm::StringRef lineText,
+                  llvm::StringRef name = {});
+uint64_t issueFingerprint(llvm::StringRef ruleId, uint64_t site);
+
+// The text of the line holding `offset`, without its newline
+llvm::StringRef lineAround(llvm::StringRef text, size_t offset);
+
+// Fingerprints of accepted issues, as a sorted array: 8 bytes each and
+// looked up by binary search, so even a legacy tree's worth costs little
+// to load and probe from every thread. Stored as text, one hex fingerprint
+// per line, to diff well under version control.
+class Baseline {
+public:
+  bool contains(uint64_t fp) const;
+  size_t size() const { return Fps.size(); }
+  // Hash of the contents, for cache keys: what a rule skips depends on it
+  uint64_t identity() const { return Identity; }
+
+  // Recording; call finalize() before contains(), identity() or write()
+  void add(uint64_t fp) { if (fp) Fps.push_back(fp); }
+  void finalize();
+
+  bool load(const std::string& path, std::string* error);
+  bool write(const std::string& path, std::string* error) const;
+
+private:
+  std::vector<uint64_t> Fps;
+  uint64_t Identity = 0; // hashed by finalize(); every TU's cache key reads it
+};
+
+} // namespace aicr
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <optional>
@@ -13,6 +14,7 @@ struct FixIt {
   unsigned    length = 0;     // bytes to replace
   std::string replacement;    // replacement text
   std::string note;           // human-friendly description
+  std::string symbol;         // USR of the declaration a rename applies to, else empty
 };
 
 struct Issue {
@@ -23,6 +25,7 @@ struct Issue {
   unsigned    line = 0;
   unsigned    column = 0;
   std::vector<FixIt> fixes;   // zero or more automated fixes
+  uint64_t    fingerprint = 0; // stable across unrelated edits, for --baseline
 };
 
 } // namespace aicr
@@ -0,0 +1,86 @@
+#pragma once
+#include "analyzers/Issue.hpp"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace aicr {
+
+// Process-wide handle for strings that repeat across issues: file paths,
+// rule ids and fix notes. Handles are stable for the life of the process
+// and safe to create and resolve from any thread.
+using Symbol = uint32_t;
+Symbol intern(llvm::StringRef s);
+llvm::StringRef symbolName(Symbol s);
+
+// Compact storage for large numbers of issues. Repeated strings become
+// Symbols, free text (messages, replacements) is copied once into an arena,
+// and fixes sit in one flat array referenced by index. `Issue` remains the
+// type rules produce; convert with add() and read back with issue().
+class IssueStore {
+public:
+  struct Fix {
+    Symbol file = 0;
+    unsigned offset = 0;
+    unsigned length = 0;
+    llvm::StringRef replacement; // arena-owned
+    Symbol note = 0;
+    Symbol symbol = 0;           // USR for renames
+  };
+
+  struct Entry {
+    Symbol id = 0;
+    Symbol file = 0;
+    unsigned line = 0;
+    unsigned column = 0;
+    Severity severity = Severity::Warning;
+    llvm::StringRef message;     // arena-owned
+    uint64_t fingerprint = 0;
+    uint32_t firstFix = 0;
+    uint32_t numFixes = 0;
+  };
+
+  IssueStore();
+  IssueStore(IssueStore&&) = default;
+  IssueStore& operator=(IssueStore&&) = default;
+
+  void add(const Issue& i);
+  void add(const std::vector<Issue>& v);
+  // Moves `other`'s entries over; its text arenas are adopted, not copied
+  void append(IssueStore&& other);
+
+  size_t size() const { return Entries.size(); }
+  bool empty() const { return Entries.empty(); }
+  llvm::ArrayRef<Entry> entries() const { return Entries; }
+  llvm::ArrayRef<Fix> fixesOf(const Entry& e) const {
+    return llvm::ArrayRef<Fix>(Fixes).slice(e.firstFix, e.numFixes);
+  }
+
+  // Materialized copies, for callers of the std::string based API
+  Issue issue(size_t i) const;
+  FixIt fixIt(const Fix& f) const;
+
+  // Orders by (file, line, column, id) by name, so the result does not
+  // depend on the order symbols happened to be interned in.
+  void sortByLocation();
+  // Keeps the first issue per (file, line, column, id)
+  void dedupe();
+  // Drops the issues `pred` holds for
+  void removeIf(llvm::function_ref<bool(const Entry&)> pred);
+
+private:
+  llvm::StringRef save(llvm::StringRef s);
+
+  std::vector<Entry> Entries;
+  std::vector<Fix> Fixes;
+  // Arenas.front() receives new text; the rest were adopted by append()
+  std::vector<std::unique_ptr<llvm::BumpPtrAllocator>> Arenas;
+};
+
+} // namespace aicr
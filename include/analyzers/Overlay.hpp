@@ -0,0 +1,39 @@
+#pragma once
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm::vfs { class FileSystem; }
+
+namespace aicr {
+
+// Unsaved buffers that stand in for files on disk, eg. an editor's open
+// documents. Files are keyed by real path (absolute path for ones that don't
+// exist yet), so any spelling of a path finds its buffer.
+class Overlay {
+public:
+  void set(llvm::StringRef path, std::string contents);
+  const std::string* find(llvm::StringRef path) const;
+  bool empty() const { return Files.empty(); }
+  size_t size() const { return Files.size(); }
+  std::vector<std::string> paths() const; // as given
+
+  // A JSON object mapping paths to contents; relative paths are taken from
+  // the current directory
+  bool parse(llvm::StringRef json, std::string* error);
+
+  // The real file system with the buffers layered over it. Buffers are
+  // referenced, not copied, so the overlay must outlive it.
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem() const;
+
+private:
+  struct Entry {
+    std::string spelled;  // absolute path as given, if it differs from the key
+    std::string contents;
+  };
+  std::map<std::string, Entry> Files;
+};
+
+} // namespace aicr
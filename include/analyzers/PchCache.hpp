@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace clang::tooling { class CompilationDatabase; }
+
+namespace aicr {
+
+// Opt-in precompiled headers for the leading `#include <...>` block that most
+// TUs share. TUs with the same compile command and the same block form a
+// group; each group of two or more gets one PCH, kept on disk and rebuilt
+// only when one of its inputs changes.
+class PchCache {
+public:
+  explicit PchCache(std::string dir);
+
+  // Group the sources and make sure every group has an up-to-date PCH.
+  // toolArgs are the extra driver flags every TU is parsed with.
+  void prepare(const clang::tooling::CompilationDatabase& DB,
+               const std::vector<std::string>& sources,
+               const std::vector<std::string>& toolArgs,
+               unsigned jobs);
+
+  // PCH to force-include when parsing this source, or "" for none
+  std::string pchFor(const std::string& source) const;
+
+private:
+  std::string dir_;
+  std::unordered_map<std::string, std::string> pchBySource_;
+};
+
+} // namespace aicr
@@ -0,0 +1,25 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// A function definition found in raw source text
+struct RawFunction {
+  std::string name;      // unqualified, as Clang prints it
+  unsigned line = 0;     // where the declaration starts, 1-based
+  unsigned column = 0;
+  unsigned endLine = 0;  // line of the closing brace
+};
+
+// Finds function definitions in `text` by brace matching, without
+// preprocessing or parsing. Comments, literals and preprocessor lines are
+// skipped; definitions at namespace, class and extern "C" scope are found,
+// nothing inside a function body is. This is a heuristic: macros that
+// expand to braces or declarations, or braces unbalanced across #if
+// branches, can mislead it.
+std::vector<RawFunction> scanFunctions(llvm::StringRef text);
+
+} // namespace aicr
@@ -0,0 +1,169 @@
+#pragma once
+#include "analyzers/Analyzer.hpp"
+#include "analyzers/Baseline.hpp"
+#include "analyzers/Issue.hpp"
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceManager.h"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+struct IdentifierQuery;
+
+// Called once an AI answer is in, with the issue slot reserved at request
+// time. Leaving slot.id empty drops the issue.
+using AiDone = std::function<void(const std::optional<std::string>& answer, Issue& slot)>;
+
+// How rules reach the AI engine. Requests are queued, not answered inline:
+// the issue keeps its place in the output, and `done` fills it in after the
+// TU has been traversed.
+class AiRequests {
+public:
+  virtual ~AiRequests() = default;
+  // Cheap engine-side prefilter; check before building a query
+  virtual bool mayRename(const std::string& current) const = 0;
+  virtual void suggestIdentifier(std::vector<Issue>& out, Issue slot,
+                                 const IdentifierQuery& query, AiDone done) = 0;
+  virtual void docForSignature(std::vector<Issue>& out, Issue slot,
+                               const std::string& signature, AiDone done) = 0;
+};
+
+// AST node kinds the analyzer dispatches on. The traversal matches each kind
+// once per node and hands it to every rule that asked for it, so adding a
+// rule adds no matching work.
+enum class NodeKind : unsigned {
+  FunctionDefinition, // function with a compound body, outside system headers
+  Variable,           // non-parameter variable, outside system headers
+};
+constexpr unsigned kNodeKindCount = 2;
+
+constexpr unsigned kindBit(NodeKind k) { return 1u << (unsigned)k; }
+
+// What a rule needs from the parse. The analyzer parses TUs as cheaply as
+// the enabled rules allow: function bodies are skipped unless one needs
+// them, and if every rule can work from raw text, nothing is parsed.
+enum RuleNeeds : unsigned {
+  NeedsBodies   = 1u << 0, // function bodies, and what's declared in them
+  NeedsComments = 1u << 1, // every comment attached, not only doc comments
+  NeedsSymbols  = 1u << 2, // its fixes are renames, widened by the symbol index
+};
+
+// Everything a rule may look at for one node, plus where its issues go
+struct RuleContext {
+  clang::ASTContext& AST;
+  const clang::SourceManager& SM;
+  const AnalyzeOptions& opts;
+  AiRequests* ai;             // null when no engine is configured
+  std::vector<Issue>& out;
+  llvm::StringRef sitePath;   // the node's file, as fingerprints name it
+  uint64_t site = 0;          // siteHash() of the node
+
+  // Issue with file/line/column filled in from Loc, fingerprinted by the
+  // node being checked
+  Issue makeIssue(const char* id, Severity sev, std::string message,
+                  clang::SourceLocation Loc) const {
+    Issue is;
+    is.id = id;
+    is.severity = sev;
+    is.message = std::move(message);
+    auto PL = SM.getPresumedLoc(Loc);
+    is.file = PL.getFilename() ? PL.getFilename() : "";
+    is.line = PL.getLine(); is.column = PL.getColumn();
+    is.fingerprint = issueFingerprint(id, site);
+    return is;
+  }
+};
+
+// A rule's view of one file under the lexer-only mode
+struct RawContext {
+  const std::string& file;
+  llvm::StringRef text;
+  const AnalyzeOptions& opts;
+  std::vector<Issue>& out;
+  llvm::StringRef sitePath;   // `file` as fingerprints name it
+
+  // `scope` is the function the issue is about or in, as for parsed runs
+  Issue makeIssue(const char* id, Severity sev, std::string message,
+                  unsigned line, unsigned column, llvm::StringRef scope = {}) const {
+    Issue is;
+    is.id = id;
+    is.severity = sev;
+    is.message = std::move(message);
+    is.file = file;
+    is.line = line; is.column = column;
+    size_t offset = 0;
+    for (unsigned l = 1; l < line; ++l) {
+      size_t nl = text.find('\n', offset);
+      if (nl == llvm::StringRef::npos) break;
+      offset = nl + 1;
+    }
+    is.fingerprint = issueFingerprint(id, siteHash(sitePath, scope, lineAround(text, offset)));
+    return is;
+  }
+};
+
+// Project-wide state of a rule whose findings span TUs, eg. code clones.
+// One per run: every thread's rule instance hands it what each TU showed as
+// an opaque blob, and it reports once all TUs are in. Blobs are kept by the
+// result cache and shard results, so replayed and sharded TUs count too.
+class ProjectIndex {
+public:
+  virtual ~ProjectIndex() = default;
+  virtual void add(llvm::StringRef facts) = 0; // called from any thread
+  virtual void finish(std::vector<Issue>& out) = 0;
+};
+
+// One check. A fresh instance is created per analyzer thread, so rules may
+// keep per-thread state without locking.
+class Rule {
+public:
+  virtual ~Rule() = default;
+  virtual const char* id() const = 0;      // eg. "LONG_FUNC"
+  virtual unsigned kinds() const = 0;      // kindBit() mask of nodes wanted
+  virtual unsigned needs() const { return NeedsBodies; } // RuleNeeds mask
+
+  // False if the rule can't report anything under these options, so its
+  // matchers aren't even registered
+  virtual bool active(const AnalyzeOptions&, bool haveAi) const { return true; }
+
+  virtual void checkFunction(const clang::FunctionDecl&, RuleContext&) {}
+  virtual void checkVariable(const clang::VarDecl&, RuleContext&) {}
+
+  // Lexer-only fast path: rules that return true from scansRaw() can
+  // produce the same issues from a file's text, with no parse at all
+  virtual bool scansRaw() const { return false; }
+  virtual void checkRaw(RawContext&) {}
+
+  // Project-wide rules return their index here, and after each TU hand over
+  // what they gathered from it, starting afresh for the next
+  virtual std::unique_ptr<ProjectIndex> makeIndex() const { return nullptr; }
+  virtual std::string takeFacts() { return {}; }
+};
+
+struct RuleInfo {
+  std::string id;
+  std::function<std::unique_ptr<Rule>()> make;
+};
+
+// All rules linked into the binary, sorted by id so dispatch order (and thus
+// output order) does not depend on link order
+const std::vector<RuleInfo>& registeredRules();
+void registerRule(RuleInfo info);
+
+// Place one of these at namespace scope next to a rule to make it available:
+//   static RegisterRule<LongFunctionRule> X("LONG_FUNC");
+template <class R>
+struct RegisterRule {
+  explicit RegisterRule(const char* id) {
+    registerRule({id, [] { return std::unique_ptr<Rule>(new R()); }});
+  }
+};
+
+} // namespace aicr
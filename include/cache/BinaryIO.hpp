@@ -0,0 +1,110 @@
+#pragma once
+#include "analyzers/Issue.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <string>
+
+namespace aicr {
+
+// Little-endian, length-prefixed encoding shared by the on-disk caches.
+// Strings are stored inline so records decode straight out of a mapped
+// buffer.
+struct Writer {
+  std::string buf;
+  void u8(uint8_t v) { buf.push_back((char)v); }
+  void u32(uint32_t v) { for (int i = 0; i < 4; ++i) buf.push_back((char)(v >> (8 * i))); }
+  void u64(uint64_t v) { for (int i = 0; i < 8; ++i) buf.push_back((char)(v >> (8 * i))); }
+  void str(llvm::StringRef s) { u32((uint32_t)s.size()); buf.append(s.data(), s.size()); }
+};
+
+struct Reader {
+  const unsigned char* p;
+  const unsigned char* end;
+  bool ok = true;
+
+  Reader(llvm::StringRef data)
+    : p((const unsigned char*)data.begin()), end((const unsigned char*)data.end()) {}
+
+  bool need(size_t n) { if ((size_t)(end - p) < n) ok = false; return ok; }
+  uint8_t u8() { if (!need(1)) return 0; return *p++; }
+  uint32_t u32() {
+    if (!need(4)) return 0;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)*p++ << (8 * i);
+    return v;
+  }
+  uint64_t u64() {
+    if (!need(8)) return 0;
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)*p++ << (8 * i);
+    return v;
+  }
+  // View into the underlying buffer; valid as long as it is
+  llvm::StringRef ref() {
+    uint32_t n = u32();
+    if (!need(n)) return {};
+    llvm::StringRef s((const char*)p, n); p += n;
+    return s;
+  }
+  std::string str() { return ref().str(); }
+};
+
+inline void writeFix(Writer& w, const FixIt& f) {
+  w.str(f.file); w.u32(f.offset); w.u32(f.length); w.str(f.replacement); w.str(f.note);
+  w.str(f.symbol);
+}
+
+inline FixIt readFix(Reader& r) {
+  FixIt f;
+  f.file = r.str(); f.offset = r.u32(); f.length = r.u32();
+  f.replacement = r.str(); f.note = r.str(); f.symbol = r.str();
+  return f;
+}
+
+inline void writeIssue(Writer& w, const Issue& is) {
+  w.str(is.id); w.u8((uint8_t)is.severity); w.str(is.message); w.str(is.file);
+  w.u32(is.line); w.u32(is.column); w.u64(is.fingerprint);
+  w.u32((uint32_t)is.fixes.size());
+  for (const auto& f : is.fixes) writeFix(w, f);
+}
+
+inline Issue readIssue(Reader& r) {
+  Issue is;
+  is.id = r.str(); is.severity = (Severity)r.u8(); is.message = r.str(); is.file = r.str();
+  is.line = r.u32(); is.column = r.u32(); is.fingerprint = r.u64();
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) is.fixes.push_back(readFix(r));
+  return is;
+}
+
+// Writes next to the final name and renames, so readers never see a torn file
+inline bool writeFileAtomic(const std::string& path, llvm::StringRef data) {
+  int fd = -1;
+  llvm::SmallString<256> tmp;
+  llvm::SmallString<256> model(llvm::sys::path::parent_path(path));
+  llvm::sys::path::append(model, "%%%%%%%%%%%%.tmp");
+  if (llvm::sys::fs::createUniqueFile(model, fd, tmp)) return false;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tmp);
+      return false;
+    }
+  }
+  if (llvm::sys::fs::rename(tmp, path)) {
+    llvm::sys::fs::remove(tmp);
+    return false;
+  }
+  return true;
+}
+
+} // namespace aicr
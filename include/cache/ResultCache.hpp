@@ -0,0 +1,64 @@
+#pragma once
+#include "analyzers/Issue.hpp"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace aicr {
+
+// A file a TU read while it was parsed, as it looked at the time
+struct CachedDep {
+  std::string path;           // real path
+  uint64_t    size = 0;
+  uint64_t    mtime = 0;      // ns since epoch
+  uint64_t    hash = 0;       // xxHash64 of content
+  bool        candidate = false; // was a project header in the path list
+};
+
+// Everything one TU produced: its own issues plus those of the headers it owned
+struct CacheEntry {
+  std::vector<CachedDep> deps;
+  std::vector<Issue> main;
+  std::map<std::string, std::vector<Issue>> headers; // owned header → issues
+  std::map<std::string, std::string> facts;          // rule id → ProjectIndex input
+};
+
+// On-disk per-TU result cache. One small binary file per TU, read through a
+// mapped MemoryBuffer. An entry is valid when its key (command line, options,
+// rules, AI engine) matches and every recorded dependency still has the same
+// content. Safe to use from several analyzer threads.
+class ResultCache {
+public:
+  ResultCache(std::string dir, uint64_t maxBytes);
+
+  std::optional<CacheEntry> lookup(const std::string& tu, uint64_t key);
+  bool store(const std::string& tu, uint64_t key, const CacheEntry& entry);
+
+  // Fill size/mtime/hash for a dependency from the file as it is now
+  bool describe(CachedDep& dep);
+
+  // Drop least recently used entries until the cache fits in maxBytes
+  void evict();
+
+private:
+  struct FileState {
+    bool     exists = false;
+    uint64_t size = 0, mtime = 0, hash = 0;
+    bool     hashed = false;
+  };
+
+  std::string entryPath(const std::string& tu) const;
+  FileState stateOf(const std::string& path, bool needHash);
+  bool depUnchanged(const CachedDep& dep);
+
+  std::string dir_;
+  uint64_t maxBytes_;
+  std::mutex m_;
+  std::unordered_map<std::string, FileState> current_; // per-run stat/hash memo
+};
+
+} // namespace aicr
@@ -0,0 +1,61 @@
+#pragma once
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include <memory>
+#include <string>
+
+namespace clang { class FileManager; }
+
+namespace aicr {
+
+// compile_commands.json loaded with a single streaming pass that records
+// where each entry's object sits in the mapped file, indexed by absolute
+// path. Entries are decoded only when asked for. With a cache directory the
+// index itself is stored in binary form and reused while the JSON file's
+// size and mtime are unchanged, so later runs skip the scan.
+//
+// Headers have no entries of their own; one is given the command of its
+// nearest including TU, with the input swapped and the language forced to
+// a header variant.
+class IndexedCompilationDatabase : public clang::tooling::CompilationDatabase {
+public:
+  ~IndexedCompilationDatabase() override;
+
+  static std::unique_ptr<IndexedCompilationDatabase>
+  loadFromFile(const std::string& jsonPath, const std::string& cacheDir, std::string& error);
+
+  std::vector<clang::tooling::CompileCommand>
+  getCompileCommands(llvm::StringRef file) const override;
+  std::vector<std::string> getAllFiles() const override;
+  std::vector<clang::tooling::CompileCommand> getAllCompileCommands() const override;
+
+  const std::string& jsonPath() const;
+
+private:
+  struct Impl;
+  explicit IndexedCompilationDatabase(std::unique_ptr<Impl> impl);
+  std::unique_ptr<Impl> I;
+};
+
+// Where the database for `path` is: `explicitPath` when given (a JSON file
+// or the directory holding it), else compile_commands.json in the directory
+// of `path` or any parent, else in the working directory. Empty if none.
+std::string findCompileDb(const std::string& path, const std::string& explicitPath);
+
+// The database findCompileDb picks for `path`. Loaded once per process and
+// shared by every caller asking for the same file, until the file changes
+// on disk.
+std::shared_ptr<clang::tooling::CompilationDatabase>
+openCompileDb(const std::string& path, const std::string& explicitPath,
+              const std::string& cacheDir, std::string& error);
+
+// Clang's resource directory, resolved once per process:
+// CLANG_RESOURCE_DIR from the environment, then the directory of the Clang
+// this tool was built against, then the one relative to the executable.
+const std::string& clangResourceDir();
+
+// Real path of a file as the FileManager names it: relative to the compile
+// command's directory, not to ours
+std::string realPath(const clang::FileManager& FM, llvm::StringRef name);
+
+} // namespace aicr
@@ -0,0 +1,53 @@
+#pragma once
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// Which project files each TU reads, found by running only the
+// preprocessor, and answered in reverse: given changed files, which TUs are
+// affected. With a file to keep it in, a TU is rescanned only when its
+// command or one of the files it read has changed since the last scan.
+class IncludeGraph {
+public:
+  explicit IncludeGraph(std::string file); // empty: not persisted
+
+  // Brings every TU in `tus` up to date, preprocessing the stale ones on
+  // `jobs` threads with `args` added to their commands. A TU that fails to
+  // preprocess is noted on stderr rather than failing the update.
+  void update(const clang::tooling::CompilationDatabase& db, const std::vector<std::string>& tus,
+              const std::vector<std::string>& args, unsigned jobs);
+
+  // The TUs (as passed to update) that are, or read, one of `files` (real
+  // paths). A TU that failed to preprocess is always among them.
+  std::vector<std::string> affected(const std::set<std::string>& files) const;
+
+private:
+  struct Dep {
+    uint32_t path;           // into paths_
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+  };
+  struct Entry {
+    uint64_t key = 0;        // hash of the compile command and args
+    std::vector<Dep> deps;   // the TU itself first
+  };
+
+  uint32_t pathId(const std::string& path);
+  bool load();
+  void save() const;
+
+  std::string file_;
+  std::vector<std::string> paths_;
+  std::map<std::string, uint32_t> ids_;
+  std::map<std::string, Entry> tus_;  // by real path
+  std::map<std::string, std::string> names_; // real path → name passed in
+  std::set<std::string> unscanned_;          // real paths whose scan failed
+};
+
+} // namespace aicr
@@ -0,0 +1,35 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+struct DiscoverOptions {
+  // Take sources from compile_commands.json instead of walking for them.
+  // Headers are still found by walking, since the database lists none.
+  bool fromCompileDb = false;
+  bool gitignore = true;             // honor .gitignore files under and above each root
+  std::vector<std::string> excludes; // .gitignore-syntax patterns, relative to each root
+  unsigned jobs = 1;                 // directory walker threads (0 = all cores)
+  std::string compileDb;             // as AnalyzeOptions::compileDb
+  std::string cacheDir;              // where the database index may be cached
+};
+
+// Expand files and directories into the list of files to analyze. Every
+// path comes back canonical (symlinks resolved) and the list is sorted and
+// free of duplicates. Directories reached twice, e.g. through a symlink
+// cycle, are walked once. Files named explicitly are always kept.
+bool discoverFiles(const std::vector<std::string>& roots,
+                   const DiscoverOptions& opts,
+                   std::vector<std::string>& out,
+                   std::string* error);
+
+bool isSourceFile(const std::string& path);
+bool isHeaderFile(const std::string& path);
+
+// `path` with symlinks resolved, or as given if it can't be resolved
+std::string realPath(llvm::StringRef path);
+
+} // namespace aicr
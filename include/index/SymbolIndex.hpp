@@ -0,0 +1,97 @@
+#pragma once
+#include "llvm/ADT/StringMap.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace clang {
+class NamedDecl;
+class SourceManager;
+} // namespace clang
+
+namespace aicr {
+
+// Key naming D across TUs: its Clang USR. Internal-linkage and local
+// symbols get the real path of their file appended, as their USR only
+// names the file by basename. Empty if D has none.
+std::string symbolUsr(const clang::NamedDecl& D, const clang::SourceManager& SM);
+
+// Where a symbol is spelled: a declaration or a reference, as a byte range
+// of its name token
+struct SymbolOccurrence {
+  std::string file;       // real path
+  unsigned    offset = 0;
+  unsigned    length = 0;
+};
+
+// The symbols one TU declares and references, collected while its AST is
+// matched anyway
+class TUSymbols {
+public:
+  struct Ref {
+    uint32_t usr = 0;      // index into usrs
+    uint32_t file = 0;     // index into files
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  void add(llvm::StringRef usr, llvm::StringRef file, unsigned offset, unsigned length);
+  // The symbol is spelled inside a macro expansion somewhere; a textual
+  // rename could not cover that use
+  void markUnsafe(llvm::StringRef usr);
+  void clear();
+
+  std::vector<std::string> usrs;
+  std::vector<std::string> files;
+  std::vector<Ref> refs;
+  std::vector<uint32_t> unsafe;
+
+private:
+  friend class SymbolIndex;
+  uint32_t usrIndex(llvm::StringRef usr);
+  llvm::StringMap<uint32_t> usrIds_, fileIds_;
+};
+
+// USR → declaration and reference locations over every TU analyzed. Each
+// TU's record is replaced as a whole when that TU is parsed again, and with
+// a directory it is also kept on disk (one small binary file per TU), so a
+// TU replayed from the result cache contributes its symbols without being
+// parsed. Thread-safe.
+class SymbolIndex {
+public:
+  explicit SymbolIndex(std::string dir); // empty: in memory only
+
+  // `key` is the TU's result-cache key: a stored record is only used for
+  // the same inputs it was collected from
+  void update(const std::string& tu, uint64_t key, TUSymbols syms);
+  // Brings in the stored record of a TU that isn't being parsed; false if
+  // there is none for this key
+  bool load(const std::string& tu, uint64_t key);
+
+  // Every place `usr` is spelled, deduplicated and sorted; nullopt when some
+  // use can't be rewritten textually
+  std::optional<std::vector<SymbolOccurrence>> occurrences(const std::string& usr) const;
+
+private:
+  std::string recordPath(const std::string& tu) const;
+  void invalidate();
+
+  struct Located {
+    const TUSymbols* tu;
+    uint32_t ref;
+  };
+
+  std::string dir_;
+  mutable std::mutex m_;
+  std::map<std::string, TUSymbols> tus_;
+  // usr → where it occurs and whether it's unsafe; rebuilt after changes
+  mutable bool built_ = false;
+  mutable llvm::StringMap<std::vector<Located>> byUsr_;
+  mutable llvm::StringMap<bool> unsafe_;
+};
+
+} // namespace aicr
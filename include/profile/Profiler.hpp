@@ -0,0 +1,104 @@
+#pragma once
+#include "profile/Trace.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm { class raw_ostream; }
+
+namespace aicr {
+
+// Wall/CPU totals for one named thing: a rule, a matcher, a pipeline stage
+struct TimeStats {
+  uint64_t calls = 0;
+  double   wallMs = 0;
+  double   cpuMs = 0;
+  uint64_t issues = 0;
+
+  void add(const TimeStats& o) {
+    calls += o.calls; wallMs += o.wallMs; cpuMs += o.cpuMs; issues += o.issues;
+  }
+};
+
+// Log2 latency histogram; bucket i holds samples in [2^i, 2^(i+1)) µs, except
+// bucket 0, which holds [0, 2) µs
+struct LatencyHistogram {
+  std::array<std::atomic<uint64_t>, 32> buckets{};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> totalUs{0};
+
+  void add(uint64_t us);
+};
+
+struct TUProfile {
+  std::string file;
+  double totalMs = 0;   // parse + match
+  double matchMs = 0;   // as measured by the MatchFinder profiling hooks
+  bool   cached = false;
+  bool   fallback = false;   // bodies skipped to stay within --max-memory
+  // Held once parsed: AST, source buffers and SourceManager tables, preprocessor
+  uint64_t astBytes = 0, sourceBytes = 0, ppBytes = 0;
+  uint64_t issues = 0;
+};
+
+// The `limit` TUs holding the most memory once parsed, largest first
+void printMemoryTable(llvm::raw_ostream& os, std::vector<TUProfile> tus, size_t limit);
+
+// Process-wide collector behind --profile. Everything is a no-op until
+// enable() is called; hot paths check active() first. Threads accumulate
+// locally and merge here, so recording never contends per node.
+class Profiler {
+public:
+  static Profiler* active() { return instance_; }
+  static void enable();
+  // Drops everything collected; only between runs, with no timers live
+  static void disable();
+
+  void mergeRule(const std::string& id, const TimeStats& s);
+  void mergeMatcher(const std::string& id, const TimeStats& s);
+  void addStage(const std::string& stage, const TimeStats& s);
+  void addTU(TUProfile tu);
+  LatencyHistogram& aiLatency(const std::string& call);
+
+  void print(llvm::raw_ostream& os) const;
+  bool writeJson(const std::string& path, std::string* error) const;
+
+  // Snapshots, for tools that consume the numbers directly
+  std::map<std::string, TimeStats> stageTotals() const;
+  std::map<std::string, TimeStats> ruleTotals() const;
+  std::vector<TUProfile> tuProfiles() const;
+
+private:
+  static Profiler* instance_;
+  mutable std::mutex m_;
+  std::map<std::string, TimeStats> rules_, matchers_, stages_;
+  std::vector<TUProfile> tus_;
+  std::map<std::string, LatencyHistogram> ai_;
+};
+
+double threadCpuMs();
+
+// Times a block into Profiler::addStage when profiling is on, and into the
+// trace when tracing is
+class StageTimer {
+public:
+  explicit StageTimer(const char* stage);
+  ~StageTimer();
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+  const char* stage_;
+  Profiler* p_;
+  std::chrono::steady_clock::time_point wall_;
+  double cpu_ = 0;
+  TraceSpan span_;
+};
+
+} // namespace aicr
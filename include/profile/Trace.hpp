@@ -0,0 +1,76 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// Process-wide Chrome trace-event recorder behind --trace. Everything is a
+// no-op until enable() is called, so spans stay compiled in: a TraceSpan
+// with tracing off is one pointer load. Spans shorter than the granularity
+// are dropped, as Clang does for -ftime-trace.
+class Tracer {
+public:
+  static Tracer* active() { return instance_; }
+  static void enable(unsigned granularityUs);
+  // Drops everything recorded; only between runs, with no spans live
+  static void disable();
+
+  // Microseconds since enable()
+  uint64_t now() const;
+  void complete(const char* cat, llvm::StringRef name, llvm::StringRef detail,
+                uint64_t startUs, uint64_t durUs);
+
+  // Brackets a ClangTool run on the calling thread with Clang's own time
+  // trace profiler, whose events are then merged in on this thread's track
+  void beginClangTrace();
+  void endClangTrace();
+
+  bool write(const std::string& path, std::string* error) const;
+
+private:
+  struct Event {
+    const char* cat;
+    std::string name;
+    std::string detail;
+    uint64_t ts, dur;
+    uint32_t tid;
+  };
+
+  explicit Tracer(unsigned granularityUs);
+
+  static Tracer* instance_;
+  unsigned granularityUs_;
+  std::chrono::steady_clock::time_point start_;
+  mutable std::mutex m_;
+  std::vector<Event> events_;
+};
+
+// Records the enclosing block as one complete event. `name` and `detail`
+// must outlive the span.
+class TraceSpan {
+public:
+  TraceSpan(const char* cat, llvm::StringRef name, llvm::StringRef detail = {})
+    : t_(Tracer::active()) {
+    if (!t_) return;
+    cat_ = cat; name_ = name; detail_ = detail;
+    start_ = t_->now();
+  }
+  ~TraceSpan() {
+    if (t_) t_->complete(cat_, name_, detail_, start_, t_->now() - start_);
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  Tracer* t_;
+  const char* cat_ = nullptr;
+  llvm::StringRef name_, detail_;
+  uint64_t start_ = 0;
+};
+
+} // namespace aicr
@@ -0,0 +1,35 @@
+#pragma once
+#include "analyzers/Issue.hpp"
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+class Overlay;
+
+struct VerifyOptions {
+  std::vector<std::string> tus;   // sources whose parse must not get worse
+  std::vector<std::string> args;  // added to every compile command
+  std::string graphFile;          // include graph to reuse; empty: scanned afresh
+  const Overlay* overlay = nullptr; // unsaved contents the fixes apply to
+  unsigned jobs = 1;              // TUs parsed in parallel (0 = all cores)
+};
+
+struct VerifyStats {
+  size_t tus = 0;                 // TUs reparsed with the edits
+  size_t rejectedSets = 0;        // fix sets dropped for breaking a TU
+  size_t rejectedFixes = 0;       // edits those sets held
+};
+
+// Checks fixes before they are written: each TU reading an edited file is
+// reparsed with the edited contents held in memory, and fix sets that add
+// errors the TU didn't have before are removed from `fixes`. A set is every
+// edit of one rename, or a single other fix. The sets a failure is down to
+// are isolated by bisecting the ones the TU reads; the rest are kept.
+void verifyFixes(const clang::tooling::CompilationDatabase& db, std::vector<FixIt>& fixes,
+                 const VerifyOptions& opts, VerifyStats* stats = nullptr);
+
+} // namespace aicr
@@ -1,15 +1,65 @@
 #pragma once
 #include "analyzers/Issue.hpp"
+#include <cstddef>
 #include <string>
 #include <vector>
 
+namespace llvm { class raw_ostream; }
+
 namespace aicr {
 
-// Simple file-level apply that creates .bak backups if requested.
-// Offsets/lengths are byte-based in original file content.
+class Overlay;
+
+struct ApplyOptions {
+  bool     backup = true;   // keep .bak copies of every rewritten file
+  unsigned jobs = 1;        // files rewritten in parallel (0 = all cores)
+  const Overlay* overlay = nullptr; // apply to these unsaved contents instead of the disk's
+};
+
+struct ApplyStats {
+  size_t files = 0;         // files rewritten
+  size_t applied = 0;       // edits written
+  size_t merged = 0;        // exact duplicates folded into one edit
+  size_t rejected = 0;      // edits overlapping an earlier one, skipped
+};
+
+// One file's edits as they would be applied: sorted, duplicates merged and
+// overlaps rejected, with the contents they apply to
+struct FileEdits {
+  std::string file;
+  std::string original;
+  std::vector<FixIt> edits;
+
+  std::string apply() const;
+};
+
+// File-level apply. Offsets/lengths are byte-based in original file content.
+// Per file, edits are sorted once, duplicates merged and overlaps rejected,
+// then the output is spliced in one pass and swapped in via temp file +
+// rename, so a crash never leaves a half-written source behind.
 class RefactorEngine {
 public:
-  static bool applyFixes(const std::vector<FixIt>& fixes, bool backup, std::string* error);
+  static bool applyFixes(const std::vector<FixIt>& fixes, const ApplyOptions& opts,
+                         std::string* error, ApplyStats* stats = nullptr);
+
+  static bool applyFixes(const std::vector<FixIt>& fixes, bool backup, std::string* error) {
+    ApplyOptions opts;
+    opts.backup = backup;
+    return applyFixes(fixes, opts, error);
+  }
+
+  // The same edits applyFixes would write, kept in memory instead. Files
+  // come back in path order; those left without edits are omitted.
+  static bool planFixes(const std::vector<FixIt>& fixes, const Overlay* overlay,
+                        std::vector<FileEdits>& out, std::string* error,
+                        ApplyStats* stats = nullptr);
+
+  // Planned edits as a unified diff, or as JSON lines of one edit each with
+  // 1-based line/column ranges. The diff is for `patch -p1` / `git apply`
+  // from the directory writeDiff returns: the current one unless some file
+  // lies outside it.
+  static std::string writeDiff(const std::vector<FileEdits>& files, llvm::raw_ostream& os);
+  static void writeEdits(const std::vector<FileEdits>& files, llvm::raw_ostream& os);
 };
 
 } // namespace aicr
@@ -0,0 +1,51 @@
+#pragma once
+#include "analyzers/IssueStore.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm { class raw_ostream; }
+
+namespace aicr {
+
+// Receives issues while analysis is still running, one finished TU at a
+// time and in input order. Writers flush after every batch so consumers
+// can tail the output; nothing is retained between batches. Strings are
+// resolved from the store only as they are written.
+class Reporter {
+public:
+  virtual ~Reporter() = default;
+  virtual void begin() {}
+  virtual void report(const IssueStore& issues) = 0;
+  virtual void end() {}
+};
+
+// Keeps everything; backs the vector-returning Analyzer::analyzePaths
+class CollectingReporter final : public Reporter {
+  std::vector<Issue>& Out;
+public:
+  explicit CollectingReporter(std::vector<Issue>& out) : Out(out) {}
+  void report(const IssueStore& issues) override {
+    Out.reserve(Out.size() + issues.size());
+    for (size_t i = 0; i < issues.size(); ++i) Out.push_back(issues.issue(i));
+  }
+};
+
+// Keeps everything compactly; backs --shard-out
+class StoreReporter final : public Reporter {
+  IssueStore& Out;
+public:
+  explicit StoreReporter(IssueStore& out) : Out(out) {}
+  void report(const IssueStore& issues) override {
+    for (size_t i = 0; i < issues.size(); ++i) Out.add(issues.issue(i));
+  }
+};
+
+// file:line:col [ID] message, plus one line per fix
+std::unique_ptr<Reporter> makeTextReporter(llvm::raw_ostream& os);
+// One JSON object per issue per line
+std::unique_ptr<Reporter> makeJsonlReporter(llvm::raw_ostream& os);
+// A single SARIF 2.1.0 log whose results array is written incrementally
+std::unique_ptr<Reporter> makeSarifReporter(llvm::raw_ostream& os);
+
+} // namespace aicr
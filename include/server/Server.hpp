@@ -0,0 +1,35 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace llvm { class raw_ostream; }
+
+namespace aicr {
+
+// One client request: the command line it was started with (minus the
+// client flag), the directory it was started in and, for requests that read
+// stdin, what the client read from it.
+struct ServeRequest {
+  std::string cwd;
+  std::vector<std::string> args; // args[0] is the program name
+  bool hasInput = false;
+  std::string input;
+};
+
+// Runs a request, writing what would have gone to stdout/stderr into the
+// given streams, and returns the process exit code.
+using ServeHandler = std::function<int(const ServeRequest&, llvm::raw_ostream& out,
+                                       llvm::raw_ostream& err)>;
+
+// Accepts requests on a Unix socket until the process is killed, running
+// them one at a time so each gets every core. Output is streamed back as
+// it is produced. Returns non-zero if the socket can't be set up.
+int serve(const std::string& socketPath, const ServeHandler& handler);
+
+// Sends a request to a running server, copies its output to stdout and
+// stderr as it arrives and returns the server-side exit code. Returns -1
+// with `error` set if no server answers.
+int runClient(const std::string& socketPath, const ServeRequest& req, std::string* error);
+
+} // namespace aicr
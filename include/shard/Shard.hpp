@@ -0,0 +1,87 @@
+#pragma once
+#include "analyzers/Analyzer.hpp"
+#include "analyzers/Issue.hpp"
+#include "analyzers/IssueStore.hpp"
+
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// Which part of the work a run takes: shard `index` of `count`, 0-based
+struct ShardSpec {
+  unsigned index = 0;
+  unsigned count = 1;
+};
+
+// Parses "i/N" with 0 <= i < N
+bool parseShardSpec(llvm::StringRef text, ShardSpec& out, std::string* error);
+
+// Shard results and the cost history name files relative to this, so
+// shards and `aicr merge` may each work on a checkout at a different place:
+// the real path of the directory holding the compile database `path` uses
+// (see findCompileDb), or of the working directory if there is none.
+std::string shardRoot(const std::string& path, const std::string& explicitDb);
+
+// `file` relative to `root` when under it, else its absolute real path
+std::string rootRelative(const std::string& root, const std::string& file);
+// A path rootRelative gave, as a path here
+std::string fromRoot(const std::string& root, const std::string& file);
+
+// How long each file took to analyze, in ms. Shards record the path each
+// file was passed to the analyzer under; what is saved and merged is keyed
+// by rootRelative paths. Thread-safe.
+class CostHistory {
+public:
+  void record(const std::string& file, double ms);
+  std::optional<double> cost(const std::string& file) const;
+  // Folds in newer measurements, averaged with what was known to damp noise
+  void merge(const CostHistory& newer);
+  // Forgets files no longer found under `root`
+  void prune(const std::string& root);
+  std::map<std::string, double> snapshot() const;
+
+  // A missing file loads as an empty history
+  bool load(const std::string& path, std::string* error);
+  bool save(const std::string& path, std::string* error) const;
+
+private:
+  mutable std::mutex m_;
+  std::map<std::string, double> ms_;
+};
+
+// The files shard `spec` analyzes, in input order. Files are dealt out by
+// estimated cost, heaviest first onto the lightest shard, so every shard
+// derives the same split from the same file list and history. Files with
+// no history are estimated from their size, at the history's ms per byte.
+std::vector<std::string> selectShard(const std::vector<std::string>& files, ShardSpec spec,
+                                     const CostHistory& history, const std::string& root);
+
+// What one shard produced: written by --shard-out, combined by `aicr merge`.
+// Issue and fix paths are stored relative to the shard's root and read back
+// under the merging side's.
+struct ShardResult {
+  ShardSpec spec;
+  std::string root;           // the shard's shardRoot(); paths in facts are under it
+  IssueStore issues;
+  std::vector<FixIt> fixes;   // ready to apply; renames already cover every use
+  CostHistory costs;          // the TUs this shard parsed
+  RuleFacts facts;            // project-wide rule inputs, reported on once merged
+};
+
+bool writeShardResult(const std::string& path, const std::string& root, ShardSpec spec,
+                      const IssueStore& issues, const std::vector<FixIt>& fixes,
+                      const CostHistory& costs, const RuleFacts& facts, std::string* error);
+bool readShardResult(const std::string& path, const std::string& root, ShardResult& out,
+                     std::string* error);
+
+// Moves issues found from the facts of a shard at `from` (and their fixes)
+// under `to`
+void rebaseIssues(std::vector<Issue>& issues, const std::string& from, const std::string& to);
+
+} // namespace aicr
@@ -0,0 +1,33 @@
+#pragma once
+#include "llvm/ADT/StringRef.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace aicr {
+
+// Lines of a file touched by a change, on the new side; inclusive, 1-based
+struct LineRange {
+  unsigned first = 0;
+  unsigned last = 0;
+};
+
+// What a change touched, per file (real paths)
+struct ChangedLines {
+  std::map<std::string, std::vector<LineRange>> files;
+
+  bool changed(const std::string& file) const { return files.count(file) != 0; }
+  bool touches(const std::string& file, unsigned line) const;
+};
+
+// Reads `git diff -U0` output with the a/ and b/ prefixes. Paths are taken
+// relative to `root`. A pure deletion marks the line it happened after.
+void parseUnifiedDiff(llvm::StringRef diff, llvm::StringRef root, ChangedLines& out);
+
+// Lines changed in the working tree since the merge base of `rev` and HEAD
+// (or `rev` itself if there is none), in the repository around the
+// working directory. Untracked files aren't part of the diff.
+bool gitChangedLines(const std::string& rev, ChangedLines& out, std::string* error);
+
+} // namespace aicr
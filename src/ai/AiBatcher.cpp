@@ -0,0 +1,120 @@
+#include "ai/AiBatcher.hpp"
+
+#include <algorithm>
+
+namespace aicr {
+
+AiBatcher::AiBatcher(AiEngine& engine, size_t batchSize)
+  : engine_(engine), batchSize_(std::max<size_t>(1, batchSize)) {
+  unsigned n = engine_.isThreadSafe() ? std::clamp(std::thread::hardware_concurrency() / 4, 1u, 4u) : 1;
+  for (unsigned i = 0; i < n; ++i) threads_.emplace_back([this] { loop(); });
+}
+
+AiBatcher::~AiBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : threads_) t.join();
+}
+
+std::shared_future<AiAnswer> AiBatcher::suggestIdentifier(const IdentifierQuery& q) {
+  std::string key = "n:" + q.current + '\0' + q.typeHint + '\0' + q.usageHint;
+  std::unique_lock<std::mutex> lock(m_);
+  auto it = memo_.find(key);
+  if (it != memo_.end()) return it->second;
+
+  Pending<IdentifierQuery> p{q, {}};
+  auto f = p.promise.get_future().share();
+  memo_.emplace(std::move(key), f);
+  names_.push_back(std::move(p));
+  bool full = names_.size() >= batchSize_;
+  lock.unlock();
+  if (full) cv_.notify_one();
+  return f;
+}
+
+std::shared_future<AiAnswer> AiBatcher::docForSignature(const std::string& signature) {
+  std::string key = "d:" + signature;
+  std::unique_lock<std::mutex> lock(m_);
+  auto it = memo_.find(key);
+  if (it != memo_.end()) return it->second;
+
+  Pending<std::string> p{signature, {}};
+  auto f = p.promise.get_future().share();
+  memo_.emplace(std::move(key), f);
+  docs_.push_back(std::move(p));
+  bool full = docs_.size() >= batchSize_;
+  lock.unlock();
+  if (full) cv_.notify_one();
+  return f;
+}
+
+void AiBatcher::flush() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    flush_ = true;
+  }
+  cv_.notify_one();
+}
+
+// Answers every promise of a batch, so no waiter is left hanging even if
+// the engine throws or returns the wrong number of answers
+template <class Q, class Fn>
+static void resolve(std::vector<Q>& batch, Fn&& run) {
+  if (batch.empty()) return;
+  std::vector<AiAnswer> answers;
+  try {
+    answers = run();
+  } catch (...) {
+    answers.clear();
+  }
+  for (size_t i = 0; i < batch.size(); ++i)
+    batch[i].promise.set_value(i < answers.size() ? std::move(answers[i]) : std::nullopt);
+}
+
+void AiBatcher::loop() {
+  std::unique_lock<std::mutex> lock(m_);
+  for (;;) {
+    cv_.wait(lock, [&] {
+      return stop_ || flush_ || names_.size() >= batchSize_ || docs_.size() >= batchSize_;
+    });
+    if (names_.empty() && docs_.empty()) {
+      flush_ = false;
+      if (stop_) return;
+      continue;
+    }
+
+    // Take at most one batch of each kind; leftovers go to the next round
+    // (or another resolver thread)
+    std::vector<Pending<IdentifierQuery>> names;
+    std::vector<Pending<std::string>> docs;
+    size_t nn = std::min(names_.size(), batchSize_);
+    size_t nd = std::min(docs_.size(), batchSize_);
+    std::move(names_.begin(), names_.begin() + nn, std::back_inserter(names));
+    names_.erase(names_.begin(), names_.begin() + nn);
+    std::move(docs_.begin(), docs_.begin() + nd, std::back_inserter(docs));
+    docs_.erase(docs_.begin(), docs_.begin() + nd);
+    if (names_.empty() && docs_.empty()) flush_ = false;
+    else cv_.notify_one();
+    lock.unlock();
+
+    resolve(names, [&] {
+      std::vector<IdentifierQuery> qs;
+      qs.reserve(names.size());
+      for (const auto& p : names) qs.push_back(p.query);
+      return engine_.suggestIdentifiers(qs);
+    });
+    resolve(docs, [&] {
+      std::vector<std::string> qs;
+      qs.reserve(docs.size());
+      for (const auto& p : docs) qs.push_back(p.query);
+      return engine_.docsForSignatures(qs);
+    });
+
+    lock.lock();
+  }
+}
+
+} // namespace aicr
@@ -13,6 +13,11 @@ static std::string toLower(std::string s) {
   return s;
 }
 
+static bool isWeakName(const std::string& current) {
+  auto cur = toLower(current);
+  return cur=="tmp" || cur=="data" || cur=="foo" || cur=="bar" || current.size()<=2;
+}
+
 class HeuristicAi final : public AiEngine {
 public:
   // Human-friendly identifier suggestions (no numbers)
@@ -21,11 +26,7 @@ public:
                     const std::string& typeHint,
                     const std::string& usageHint) override
   {
-    auto cur = toLower(current);
-    auto isBad = [&]{
-      return cur=="tmp" || cur=="data" || cur=="foo" || cur=="bar" || current.size()<=2;
-    };
-    if (!isBad()) return std::nullopt;
+    if (!isWeakName(current)) return std::nullopt;
 
     const std::string t = toLower(typeHint);
     if (t.find("bool")   != std::string::npos) return std::string("flag");
@@ -63,10 +64,34 @@ public:
     out += " */\n";
     return out;
   }
+
+  bool mayRename(const std::string& current) const override { return isWeakName(current); }
+
+  // Stateless: every call only looks at its arguments
+  bool isThreadSafe() const override { return true; }
+
+  // Bump when the heuristics above change
+  std::string identity() const override { return "heuristic/1"; }
 };
 
 } // namespace
 
+std::vector<std::optional<std::string>>
+AiEngine::suggestIdentifiers(const std::vector<IdentifierQuery>& queries) {
+  std::vector<std::optional<std::string>> out;
+  out.reserve(queries.size());
+  for (const auto& q : queries) out.push_back(suggestIdentifier(q.current, q.typeHint, q.usageHint));
+  return out;
+}
+
+std::vector<std::optional<std::string>>
+AiEngine::docsForSignatures(const std::vector<std::string>& signatures) {
+  std::vector<std::optional<std::string>> out;
+  out.reserve(signatures.size());
+  for (const auto& s : signatures) out.push_back(docForSignature(s));
+  return out;
+}
+
 AiEngine* makeHeuristicAi() { return new HeuristicAi(); }
 
 // If ONNX isn’t enabled, provide a fallback factory here
@@ -11,9 +11,10 @@ class OnnxAi final : public AiEngine {
   Ort::Env env{ORT_LOGGING_LEVEL_WARNING, "aicr"};
   Ort::Session session{nullptr};
   Ort::SessionOptions opts;
+  std::string model;
 
 public:
-  explicit OnnxAi(const std::string& modelPath) {
+  explicit OnnxAi(const std::string& modelPath) : model(modelPath) {
     opts.SetIntraOpNumThreads(1);
     session = Ort::Session(env, modelPath.c_str(), opts);
   }
@@ -35,6 +36,10 @@ public:
     // Stub: model would generate summary text; emulate it here
     return std::optional<std::string>{"/** @brief " + sig + " — auto-doc (replace with model output) */\n"};
   }
+
+  bool mayRename(const std::string& current) const override { return current.size() <= 3; }
+
+  std::string identity() const override { return "onnx:" + model; }
 };
 } // namespace
 
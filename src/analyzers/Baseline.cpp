@@ -0,0 +1,125 @@
+#include "analyzers/Baseline.hpp"
+#include "cache/BinaryIO.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace aicr {
+
+namespace {
+
+constexpr llvm::StringLiteral kHeader = "# aicr baseline v1";
+
+} // namespace
+
+// Resolved again only when it changes, as it does between server requests
+const std::string& baselineRoot() {
+  thread_local std::string last, real;
+  llvm::SmallString<256> cwd;
+  if (llvm::sys::fs::current_path(cwd)) cwd.clear();
+  if (cwd.str() != last) {
+    last = std::string(cwd.str());
+    llvm::SmallString<256> buf;
+    real = cwd.empty() || llvm::sys::fs::real_path(cwd, buf) ? last : std::string(buf.str());
+  }
+  return real;
+}
+
+std::string baselinePath(llvm::StringRef realPath) {
+  const std::string& cwd = baselineRoot();
+  if (!cwd.empty() && realPath.starts_with(cwd) && realPath.size() > cwd.size() &&
+      llvm::sys::path::is_separator(realPath[cwd.size()]))
+    return realPath.drop_front(cwd.size() + 1).str();
+  return realPath.str();
+}
+
+uint64_t siteHash(llvm::StringRef path, llvm::StringRef scope, llvm::StringRef lineText,
+                  llvm::StringRef name) {
+  std::string k;
+  k.reserve(path.size() + scope.size() + lineText.size() + name.size() + 3);
+  k.append(path.data(), path.size());
+  k.push_back('\0');
+  k.append(scope.data(), scope.size());
+  k.push_back('\0');
+  for (char c : lineText)
+    if (!std::isspace((unsigned char)c)) k.push_back(c);
+  if (!name.empty()) { // sites without one keep their fingerprints
+    k.push_back('\0');
+    k.append(name.data(), name.size());
+  }
+  return llvm::xxHash64(k);
+}
+
+uint64_t issueFingerprint(llvm::StringRef ruleId, uint64_t site) {
+  Writer w;
+  w.u64(site);
+  w.buf.append(ruleId.data(), ruleId.size());
+  return llvm::xxHash64(w.buf);
+}
+
+llvm::StringRef lineAround(llvm::StringRef text, size_t offset) {
+  offset = std::min(offset, text.size());
+  size_t b = text.rfind('\n', offset); // searches before offset
+  b = b == llvm::StringRef::npos ? 0 : b + 1;
+  return text.slice(b, text.find('\n', offset));
+}
+
+bool Baseline::contains(uint64_t fp) const {
+  return std::binary_search(Fps.begin(), Fps.end(), fp);
+}
+
+void Baseline::finalize() {
+  std::sort(Fps.begin(), Fps.end());
+  Fps.erase(std::unique(Fps.begin(), Fps.end()), Fps.end());
+  Writer w;
+  for (uint64_t fp : Fps) w.u64(fp);
+  Identity = llvm::xxHash64(w.buf);
+}
+
+bool Baseline::load(const std::string& path, std::string* error) {
+  auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/true);
+  if (!buf) {
+    if (error) *error = "Cannot read " + path + ": " + buf.getError().message();
+    return false;
+  }
+  llvm::StringRef text = (*buf)->getBuffer();
+  unsigned lineNo = 0;
+  while (!text.empty()) {
+    auto [line, rest] = text.split('\n');
+    text = rest;
+    ++lineNo;
+    line = line.trim();
+    if (line.empty() || line.starts_with("#")) continue;
+    uint64_t fp;
+    if (line.getAsInteger(16, fp)) {
+      if (error) *error = path + ":" + std::to_string(lineNo) + ": not a fingerprint";
+      return false;
+    }
+    add(fp);
+  }
+  finalize();
+  return true;
+}
+
+bool Baseline::write(const std::string& path, std::string* error) const {
+  std::string out;
+  out.reserve(kHeader.size() + 1 + Fps.size() * 17);
+  out += kHeader;
+  out += '\n';
+  for (uint64_t fp : Fps) {
+    out += llvm::utohexstr(fp, /*LowerCase=*/true, /*Width=*/16);
+    out += '\n';
+  }
+  if (writeFileAtomic(path, out)) return true;
+  if (error) *error = "Cannot write " + path;
+  return false;
+}
+
+} // namespace aicr
@@ -1,20 +1,64 @@
 #include "clang/Tooling/ArgumentsAdjusters.h"
 #include "analyzers/Analyzer.hpp"
+#include "analyzers/Baseline.hpp"
+#include "analyzers/IssueStore.hpp"
+#include "analyzers/Overlay.hpp"
+#include "analyzers/PchCache.hpp"
+#include "analyzers/RawScanner.hpp"
+#include "analyzers/Rule.hpp"
+#include "ai/AiBatcher.hpp"
 #include "ai/AiEngine.hpp"
+#include "cache/ResultCache.hpp"
+#include "compiledb/CompileDb.hpp"
+#include "compiledb/IncludeGraph.hpp"
+#include "discovery/FileDiscovery.hpp"
+#include "index/SymbolIndex.hpp"
+#include "profile/Profiler.hpp"
+#include "profile/Trace.hpp"
+#include "refactor/FixVerifier.hpp"
 #include "refactor/RefactorEngine.hpp"
+#include "shard/Shard.hpp"
+#include "vcs/GitDiff.hpp"
 
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include "clang/Tooling/CompilationDatabase.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/AST/ASTContext.h"
-#include "clang/AST/RawCommentList.h"
 #include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/MultiplexConsumer.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Lex/Lexer.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <fstream>
 
 using namespace clang;
@@ -23,209 +67,1352 @@ using namespace clang::ast_matchers;
 
 namespace aicr {
 
-static unsigned locSpan(const SourceManager& SM, SourceRange SR) {
-  auto b = SM.getSpellingLineNumber(SR.getBegin());
-  auto e = SM.getSpellingLineNumber(SR.getEnd());
-  if (e < b) return 0;
-  return (unsigned)(e - b + 1);
-}
+// Project headers are analyzed inside the TUs that include them rather than
+// parsed on their own. The first TU to reach a header claims it; every other
+// TU skips the nodes that header contributes.
+struct HeaderOwnership {
+  std::unordered_set<std::string> headers; // real paths of candidate headers
+  std::unordered_map<std::string, size_t> owner;
+  std::mutex M;
+
+  bool claim(const std::string& header, size_t tu) {
+    std::lock_guard<std::mutex> lock(M);
+    return owner.emplace(header, tu).first->second == tu;
+  }
+  bool claimed(const std::string& header) {
+    std::lock_guard<std::mutex> lock(M);
+    return owner.count(header) != 0;
+  }
+};
+
+// What one TU produced: its own issues, and those of each header it owns
+struct TUResult {
+  std::vector<Issue> main;
+  std::map<std::string, std::vector<Issue>> headers;
+  std::map<std::string, std::string> facts; // project-wide rules' inputs, by rule id
+  uint64_t footprint = 0; // bytes the parse held at its peak; 0 when replayed
+};
+
+// Forwards finished TUs to the reporter in input order. Whichever worker
+// completes the next expected TU drains every consecutive finished one, so
+// output starts as soon as the first TU is done and results are dropped
+// right after they're written. Owned-header issues are held back: which TU
+// claims a header depends on scheduling, so they're sorted and written last.
+// Anything held is kept compact in IssueStores rather than as Issue vectors.
+class OrderedSink {
+  Reporter& R;
+  bool KeepFixes;
+  std::mutex M;
+  size_t Next = 0;
+  std::map<size_t, IssueStore> Pending;
+  IssueStore Owned;
+  IssueStore Kept; // written issues carrying fixes, for --fix
+
+  void write(IssueStore& s) {
+    if (s.empty()) return;
+    R.report(s);
+    if (KeepFixes) Kept.append(std::move(s));
+  }
+
+public:
+  OrderedSink(Reporter& r, bool keepFixes) : R(r), KeepFixes(keepFixes) {}
+
+  void done(size_t tu, TUResult& r) {
+    // Repeats of the same (location, rule) come from a file listed with
+    // several compile commands in the database.
+    IssueStore main;
+    main.add(r.main);
+    main.dedupe();
+    IssueStore owned;
+    for (auto& [h, v] : r.headers) owned.add(v);
+    r = TUResult();
+
+    std::lock_guard<std::mutex> L(M);
+    Owned.append(std::move(owned));
+    Pending.emplace(tu, std::move(main));
+    for (auto it = Pending.begin(); it != Pending.end() && it->first == Next;
+         it = Pending.erase(it), ++Next)
+      write(it->second);
+  }
+
+  void finish() {
+    std::lock_guard<std::mutex> L(M);
+    for (auto& [tu, s] : Pending) write(s); // only gaps left by skipped TUs
+    Pending.clear();
+    Owned.sortByLocation();
+    Owned.dedupe();
+    write(Owned);
+  }
+
+  std::vector<FixIt> takeFixes() {
+    std::vector<FixIt> all;
+    for (const auto& e : Kept.entries())
+      for (const auto& f : Kept.fixesOf(e)) all.push_back(Kept.fixIt(f));
+    Kept = IssueStore();
+    return all;
+  }
+};
 
 struct Context {
   const AnalyzeOptions* opts = nullptr;
-  AiEngine* ai = nullptr;
-  std::vector<Issue>* out = nullptr;
+  AiRequests* ai = nullptr;
+  TUResult* out = nullptr;                  // current TU
+  HeaderOwnership* headers = nullptr;
+  size_t tu = 0;
+  llvm::StringMap<std::vector<Issue>*> owned; // per-TU cache, keyed by file name
+  llvm::DenseMap<FileID, std::string> sitePaths; // per TU, see Baseline.hpp
+
+  void beginTU(size_t index, TUResult* result) {
+    tu = index; out = result;
+    owned.clear();
+    sitePaths.clear();
+  }
+
+  // Fingerprint site of the node at Loc, inside function `scope`; `name`
+  // tells apart variables declared on one line
+  void setSite(RuleContext& RC, SourceLocation Loc, llvm::StringRef scope,
+               llvm::StringRef name = {}) {
+    const SourceManager& SM = RC.SM;
+    SourceLocation EL = SM.getExpansionLoc(Loc);
+    FileID FID = SM.getFileID(EL);
+    auto it = sitePaths.find(FID);
+    if (it == sitePaths.end()) {
+      std::string path;
+      if (auto FE = SM.getFileEntryRefForID(FID))
+        path = baselinePath(realPath(SM.getFileManager(), FE->getName()));
+      it = sitePaths.insert({FID, std::move(path)}).first;
+    }
+    RC.sitePath = it->second;
+    RC.site = siteHash(it->second, scope, lineAround(SM.getBufferData(FID), SM.getFileOffset(EL)),
+                       name);
+  }
+
+  // Where an issue at Loc should go, or nullptr if this TU doesn't report it
+  std::vector<Issue>* sinkFor(const SourceManager& SM, SourceLocation Loc) {
+    SourceLocation EL = SM.getExpansionLoc(Loc);
+    if (SM.isInMainFile(EL)) return &out->main;
+    if (!headers || SM.isInSystemHeader(EL)) return nullptr;
+    llvm::StringRef name = SM.getFilename(EL);
+    if (name.empty()) return nullptr;
+    auto it = owned.find(name);
+    if (it == owned.end()) {
+      std::string real = realPath(SM.getFileManager(), name);
+      std::vector<Issue>* sink = nullptr;
+      if (headers->headers.count(real) && headers->claim(real, tu))
+        sink = &out->headers[real];
+      it = owned.insert({name, sink}).first;
+    }
+    return it->second;
+  }
 };
 
-class LongFunctionCB : public MatchFinder::MatchCallback {
+// The single match callback per node kind. It resolves where the node's
+// issues go once, then runs every rule that asked for this kind.
+class KindDispatchCB : public MatchFinder::MatchCallback {
+  struct Slot { Rule* rule; TimeStats* stats; bool skipKnown; };
   Context& Ctx;
+  NodeKind Kind;
+  std::vector<Slot> Slots;
+  bool Profiling = Profiler::active() != nullptr;
+  bool Tracing = Tracer::active() != nullptr;
+
+  // Rules whose issue on this node is in the baseline aren't run at all:
+  // no AI request, fix or report is made for it. Project-wide rules still
+  // need the node's facts, as a new issue elsewhere may involve it; theirs
+  // are dropped after the index is finished.
+  bool known(const RuleContext& RC, const Slot& s) const {
+    const Baseline* b = Ctx.opts->baseline;
+    return b && s.skipKnown && b->contains(issueFingerprint(s.rule->id(), RC.site));
+  }
+
+  template <class Fn>
+  void each(RuleContext& RC, Fn&& check) {
+    if (!Profiling && !Tracing) {
+      for (auto& s : Slots)
+        if (!known(RC, s)) check(*s.rule);
+      return;
+    }
+    for (auto& s : Slots) {
+      if (known(RC, s)) continue;
+      TraceSpan span("rule", s.rule->id());
+      if (!Profiling) {
+        check(*s.rule);
+        continue;
+      }
+      size_t before = RC.out.size();
+      auto wall = std::chrono::steady_clock::now();
+      double cpu = threadCpuMs();
+      check(*s.rule);
+      s.stats->calls++;
+      s.stats->wallMs += std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - wall).count();
+      s.stats->cpuMs += threadCpuMs() - cpu;
+      s.stats->issues += RC.out.size() - before;
+    }
+  }
+
 public:
-  explicit LongFunctionCB(Context& c) : Ctx(c) {}
+  KindDispatchCB(Context& c, NodeKind k) : Ctx(c), Kind(k) {}
+  void add(Rule* r, TimeStats* stats) { Slots.push_back({r, stats, !r->makeIndex()}); }
+  bool empty() const { return Slots.empty(); }
+
+  // Bucket name under Clang's matcher profiling
+  llvm::StringRef getID() const override {
+    return Kind == NodeKind::FunctionDefinition ? "kind:function-definition" : "kind:variable";
+  }
+
   void run(const MatchFinder::MatchResult& Result) override {
-    const auto* FD = Result.Nodes.getNodeAs<FunctionDecl>("func");
-    if (!FD || !FD->hasBody()) return;
     const auto& SM = *Result.SourceManager;
-    unsigned lines = locSpan(SM, FD->getSourceRange());
-    if ((int)lines >= Ctx.opts->longFunctionLineThreshold) {
-      Issue is;
-      is.id = "LONG_FUNC";
-      is.severity = Severity::Warning;
-      is.message = "Function '" + FD->getNameAsString() + "' is " + std::to_string(lines) +
-                   " lines (threshold " + std::to_string(Ctx.opts->longFunctionLineThreshold) + ")";
-      auto PL = SM.getPresumedLoc(FD->getBeginLoc());
-      is.file = PL.getFilename() ? PL.getFilename() : "";
-      is.line = PL.getLine(); is.column = PL.getColumn();
-      Ctx.out->push_back(std::move(is));
+    switch (Kind) {
+    case NodeKind::FunctionDefinition: {
+      const auto* FD = Result.Nodes.getNodeAs<FunctionDecl>("node");
+      if (!FD || (!FD->hasBody() && !FD->hasSkippedBody())) return;
+      auto* sink = Ctx.sinkFor(SM, FD->getBeginLoc());
+      if (!sink) return;
+      RuleContext RC{*Result.Context, SM, *Ctx.opts, Ctx.ai, *sink};
+      Ctx.setSite(RC, FD->getBeginLoc(), FD->getNameAsString());
+      each(RC, [&](Rule& r) { r.checkFunction(*FD, RC); });
+      break;
+    }
+    case NodeKind::Variable: {
+      const auto* VD = Result.Nodes.getNodeAs<VarDecl>("node");
+      if (!VD) return;
+      auto* sink = Ctx.sinkFor(SM, VD->getLocation());
+      if (!sink) return;
+      RuleContext RC{*Result.Context, SM, *Ctx.opts, Ctx.ai, *sink};
+      const auto* F = dyn_cast_or_null<FunctionDecl>(VD->getParentFunctionOrMethod());
+      Ctx.setSite(RC, VD->getLocation(), F ? F->getNameAsString() : std::string(),
+                  VD->getDeclName().getAsString());
+      each(RC, [&](Rule& r) { r.checkVariable(*VD, RC); });
+      break;
+    }
     }
   }
 };
 
-class MissingDocCB : public MatchFinder::MatchCallback {
-  Context& Ctx;
+// Records per-call and per-batch latency of the wrapped engine for
+// --profile, and each call as a span for --trace
+class ProfiledAi final : public AiEngine {
+  AiEngine& Inner;
+  LatencyHistogram* Names = nullptr;
+  LatencyHistogram* Docs = nullptr;
+  LatencyHistogram* NameBatches = nullptr;
+  LatencyHistogram* DocBatches = nullptr;
+
+  // A batch counts once in `h`, and once per query in `each`: every query
+  // in it waited as long as the whole batch took
+  template <class Fn>
+  static auto timed(LatencyHistogram* h, const char* call, Fn&& fn,
+                    LatencyHistogram* each = nullptr, size_t queries = 0) {
+    TraceSpan span("ai", call);
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = fn();
+    auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+    if (h) h->add(us);
+    if (each)
+      for (size_t i = 0; i < queries; ++i) each->add(us);
+    return r;
+  }
+
 public:
-  explicit MissingDocCB(Context& c) : Ctx(c) {}
-  void run(const MatchFinder::MatchResult& Result) override {
-    const auto* FD = Result.Nodes.getNodeAs<FunctionDecl>("func2");
-    if (!FD || !FD->hasBody()) return;
+  ProfiledAi(AiEngine& inner, Profiler* p) : Inner(inner) {
+    if (!p) return;
+    Names = &p->aiLatency("suggestIdentifier");
+    Docs = &p->aiLatency("docForSignature");
+    NameBatches = &p->aiLatency("suggestIdentifiers (batch)");
+    DocBatches = &p->aiLatency("docsForSignatures (batch)");
+  }
+  std::optional<std::string>
+  suggestIdentifier(const std::string& current,
+                    const std::string& typeHint,
+                    const std::string& usageHint) override {
+    return timed(Names, "suggestIdentifier",
+                 [&] { return Inner.suggestIdentifier(current, typeHint, usageHint); });
+  }
+  std::optional<std::string> docForSignature(const std::string& sig) override {
+    return timed(Docs, "docForSignature", [&] { return Inner.docForSignature(sig); });
+  }
+  std::vector<std::optional<std::string>>
+  suggestIdentifiers(const std::vector<IdentifierQuery>& qs) override {
+    return timed(NameBatches, "suggestIdentifiers (batch)",
+                 [&] { return Inner.suggestIdentifiers(qs); }, Names, qs.size());
+  }
+  std::vector<std::optional<std::string>>
+  docsForSignatures(const std::vector<std::string>& sigs) override {
+    return timed(DocBatches, "docsForSignatures (batch)",
+                 [&] { return Inner.docsForSignatures(sigs); }, Docs, sigs.size());
+  }
+  bool mayRename(const std::string& current) const override { return Inner.mayRename(current); }
+  bool isThreadSafe() const override { return Inner.isThreadSafe(); }
+  std::string identity() const override { return Inner.identity(); }
+};
 
-    // Clang 18+ use ASTContext to check raw comments
-    const RawComment* RC = Result.Context->getRawCommentForDeclNoCache(FD);
-    if (RC) return; // already documented
+// One worker's AI requests for the TU it is running. Slots are reserved in
+// the issue lists during traversal; take() hands them over once the TU is
+// parsed and resolve() fills them in later, after the worker has moved on
+// to its next TU. The shared AiBatcher behind it dedups and batches across
+// all workers.
+class PendingAi final : public AiRequests {
+public:
+  struct Item {
+    std::vector<Issue>* out;
+    size_t index;
+    std::shared_future<AiAnswer> answer;
+    AiDone done;
+  };
+  using Batch = std::vector<Item>;
 
-    const auto& SM = *Result.SourceManager;
-    auto PL = SM.getPresumedLoc(FD->getBeginLoc());
+private:
+  AiBatcher& B;
+  Batch Items;
 
-    Issue is;
-    is.id = "MISSING_DOC";
-    is.severity = Severity::Info;
-    is.message = "Missing API docs for function '" + FD->getNameAsString() + "'";
-    is.file = PL.getFilename() ? PL.getFilename() : "";
-    is.line = PL.getLine(); is.column = PL.getColumn();
+  void queue(std::vector<Issue>& out, Issue slot, std::shared_future<AiAnswer> f, AiDone done) {
+    Items.push_back({&out, out.size(), std::move(f), std::move(done)});
+    out.push_back(std::move(slot));
+  }
 
-    if (Ctx.opts->suggestDocs && Ctx.ai) {
-      std::string sig = FD->getReturnType().getAsString() + std::string(" ") + FD->getNameAsString() + "(";
-      for (unsigned i = 0; i < FD->getNumParams(); ++i) {
-        if (i) sig += ", ";
-        sig += FD->getParamDecl(i)->getType().getAsString();
-      }
-      sig += ")";
-      if (auto doc = Ctx.ai->docForSignature(sig)) {
-        // Insert doc immediately before function
-        auto Off = SM.getFileOffset(FD->getSourceRange().getBegin());
-        FixIt fx;
-        fx.file = is.file;
-        fx.offset = Off;
-        fx.length = 0;
-        fx.replacement = *doc;
-        fx.note = "Insert Doxygen stub";
-        is.fixes.push_back(std::move(fx));
+public:
+  explicit PendingAi(AiBatcher& b) : B(b) {}
+
+  bool mayRename(const std::string& current) const override {
+    return B.engine().mayRename(current);
+  }
+  void suggestIdentifier(std::vector<Issue>& out, Issue slot,
+                         const IdentifierQuery& query, AiDone done) override {
+    queue(out, std::move(slot), B.suggestIdentifier(query), std::move(done));
+  }
+  void docForSignature(std::vector<Issue>& out, Issue slot,
+                       const std::string& signature, AiDone done) override {
+    queue(out, std::move(slot), B.docForSignature(signature), std::move(done));
+  }
+
+  // The finished TU's requests; the issue lists they point into must stay
+  // put until resolve()
+  Batch take() { return std::exchange(Items, {}); }
+
+  // Wait for a TU's answers, finish the reserved issues in place and drop
+  // the ones their rule decided against. A partial batch is only forced out
+  // if something is still missing, so requests from other workers keep
+  // piling into it meanwhile.
+  void resolve(Batch& items) {
+    if (items.empty()) return;
+    for (const auto& it : items)
+      if (it.answer.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        B.flush();
+        break;
       }
+    std::vector<std::vector<Issue>*> touched;
+    for (auto& it : items) {
+      it.done(it.answer.get(), (*it.out)[it.index]);
+      if (touched.empty() || touched.back() != it.out) touched.push_back(it.out);
     }
-    Ctx.out->push_back(std::move(is));
+    items.clear();
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (auto* v : touched)
+      v->erase(std::remove_if(v->begin(), v->end(), [](const Issue& i) { return i.id.empty(); }),
+               v->end());
   }
 };
 
-class WeakVarNameCB : public MatchFinder::MatchCallback {
+// Feeds the symbol index under --fix: where each variable a rename could
+// target is declared and referenced in this TU. Only names the engine may
+// rename are recorded; a use spelled through a macro makes the symbol
+// unsafe, since a textual rename can't reach it.
+class SymbolCollectorCB : public MatchFinder::MatchCallback {
   Context& Ctx;
+  TUSymbols& Out;
+  llvm::DenseMap<const Decl*, std::string> Usrs;  // per TU, empty = ignored
+  llvm::DenseMap<FileID, std::string> Files;      // per TU, real paths
+
 public:
-  explicit WeakVarNameCB(Context& c) : Ctx(c) {}
+  SymbolCollectorCB(Context& c, TUSymbols& out) : Ctx(c), Out(out) {}
+
+  void beginTU() { Usrs.clear(); Files.clear(); }
+
+  llvm::StringRef getID() const override { return "symbol-index"; }
+
   void run(const MatchFinder::MatchResult& Result) override {
-    const auto* VD = Result.Nodes.getNodeAs<VarDecl>("var");
-    if (!VD || !VD->isLocalVarDeclOrParm()) return;
     const auto& SM = *Result.SourceManager;
-    auto name = VD->getNameAsString();
-    if (name == "i" || name == "j" || name == "k") return;
+    const VarDecl* VD = nullptr;
+    SourceLocation Loc;
+    if (const auto* Ref = Result.Nodes.getNodeAs<DeclRefExpr>("ref")) {
+      VD = dyn_cast<VarDecl>(Ref->getDecl());
+      Loc = Ref->getLocation();
+    } else if ((VD = Result.Nodes.getNodeAs<VarDecl>("decl"))) {
+      Loc = VD->getLocation();
+    }
+    if (!VD || !VD->getIdentifier() || Loc.isInvalid()) return;
 
-    std::string typeHint = VD->getType().getAsString();
-    std::string usageHint = VD->isConstexpr() ? "const" : (VD->getType().isConstQualified() ? "const" : "");
-    auto suggestion = Ctx.ai ? Ctx.ai->suggestIdentifier(name, typeHint, usageHint) : std::nullopt;
-    if (!suggestion) return;
+    auto it = Usrs.find(VD->getCanonicalDecl());
+    if (it == Usrs.end()) {
+      std::string usr;
+      if (Ctx.ai->mayRename(VD->getName().str())) usr = symbolUsr(*VD, SM);
+      it = Usrs.insert({VD->getCanonicalDecl(), std::move(usr)}).first;
+    }
+    const std::string& usr = it->second;
+    if (usr.empty()) return;
 
-    Issue is;
-    is.id = "WEAK_NAME";
-    is.severity = Severity::Info;
-    is.message = "Variable '" + name + "' could be clearer, e.g. '" + *suggestion + "'";
-    auto PL = SM.getPresumedLoc(VD->getLocation());
-    is.file = PL.getFilename() ? PL.getFilename() : "";
-    is.line = PL.getLine(); is.column = PL.getColumn();
+    if (Loc.isMacroID()) { Out.markUnsafe(usr); return; }
+    FileID FID = SM.getFileID(Loc);
+    auto fit = Files.find(FID);
+    if (fit == Files.end()) {
+      std::string file;
+      if (auto FE = SM.getFileEntryRefForID(FID)) file = realPath(SM.getFileManager(), FE->getName());
+      fit = Files.insert({FID, std::move(file)}).first;
+    }
+    unsigned len = Lexer::MeasureTokenLength(Loc, SM, Result.Context->getLangOpts());
+    if (fit->second.empty() ||
+        llvm::StringRef(SM.getCharacterData(Loc), len) != VD->getName()) {
+      Out.markUnsafe(usr);
+      return;
+    }
+    Out.add(usr, fit->second, SM.getFileOffset(Loc), len);
+  }
+};
 
-    // Rename at declaration token (safe MVP)
-    SourceLocation NameLoc = VD->getLocation();
-    auto TokRange = CharSourceRange::getTokenRange(NameLoc, NameLoc);
-    auto BegOff = SM.getFileOffset(TokRange.getBegin());
-    auto Len = Lexer::MeasureTokenLength(NameLoc, SM, Result.Context->getLangOpts());
+// Definitions whose body the parser skipped still count as definitions
+AST_MATCHER(FunctionDecl, hasSkippedBody) { return Node.hasSkippedBody(); }
 
-    FixIt fx; fx.file = is.file; fx.offset = BegOff; fx.length = Len; fx.replacement = *suggestion;
-    fx.note = "Rename at declaration (MVP)";
-    is.fixes.push_back(std::move(fx));
+// A declaration that is, or sits inside, an instantiation of a template.
+// Its source bytes are the template's own, which is matched as well, so
+// rules would only report the same issue again for every set of arguments
+// (and find no doc comment on it). Walks the DeclContext chain rather than
+// the parent map Clang's isInstantiated() builds on first use.
+AST_MATCHER(Decl, inInstantiation) {
+  for (const Decl* D = &Node; D && !isa<TranslationUnitDecl>(D);
+       D = cast<Decl>(D->getDeclContext())) {
+    TemplateSpecializationKind K = TSK_Undeclared;
+    if (const auto* FD = dyn_cast<FunctionDecl>(D)) K = FD->getTemplateSpecializationKind();
+    else if (const auto* RD = dyn_cast<CXXRecordDecl>(D)) K = RD->getTemplateSpecializationKind();
+    else if (const auto* VD = dyn_cast<VarDecl>(D)) K = VD->getTemplateSpecializationKind();
+    if (clang::isTemplateInstantiation(K)) return true;
+  }
+  return false;
+}
+
+static MatchFinder::MatchFinderOptions
+finderOptions(llvm::StringMap<llvm::TimeRecord>& records) {
+  MatchFinder::MatchFinderOptions o;
+  if (Profiler::active()) o.CheckProfiling.emplace(records);
+  return o;
+}
 
-    Ctx.out->push_back(std::move(is));
+// One matcher pipeline per thread, with its own rule instances. Ctx.out is
+// re-pointed at the result of whichever TU the worker is currently running.
+struct Worker {
+  Context Ctx;
+  std::unique_ptr<PendingAi> Ai;
+  std::vector<std::unique_ptr<Rule>> Rules;
+  std::vector<TimeStats> RuleStats;                 // parallel to Rules
+  std::vector<std::unique_ptr<KindDispatchCB>> Dispatch;
+  llvm::StringMap<llvm::TimeRecord> MatchTimes;     // last TU, filled by Clang
+  std::map<std::string, TimeStats> MatchTotals;
+  MatchFinder Finder{finderOptions(MatchTimes)};
+  TUSymbols Syms;                                   // current TU, under --fix
+  std::unique_ptr<SymbolCollectorCB> Symbols;
+  bool SkipBodies;
+
+  Worker(const AnalyzeOptions& opts, const std::vector<const RuleInfo*>& rules,
+         bool skipBodies, AiBatcher* ai, HeaderOwnership* headers)
+    : SkipBodies(skipBodies) {
+    if (ai) Ai = std::make_unique<PendingAi>(*ai);
+    Ctx.opts = &opts; Ctx.ai = Ai.get(); Ctx.headers = headers;
+
+    unsigned needs = 0;
+    for (const auto* info : rules) {
+      Rules.push_back(info->make());
+      needs |= Rules.back()->needs();
+    }
+    RuleStats.resize(Rules.size());
+    for (unsigned k = 0; k < kNodeKindCount; ++k)
+      Dispatch.push_back(std::make_unique<KindDispatchCB>(Ctx, (NodeKind)k));
+    for (size_t r = 0; r < Rules.size(); ++r)
+      for (unsigned k = 0; k < kNodeKindCount; ++k)
+        if (Rules[r]->kinds() & kindBit((NodeKind)k)) Dispatch[k]->add(Rules[r].get(), &RuleStats[r]);
+
+    // Header nodes are matched too; Context::sinkFor drops those owned by
+    // another TU before any rule runs. Templates are matched once, as
+    // written: their instantiations never reach a rule or the AI.
+    auto FunctionDefMatcher =
+      skipBodies
+        ? functionDecl(isDefinition(), anyOf(hasBody(compoundStmt()), hasSkippedBody()),
+                       unless(isExpansionInSystemHeader()), unless(inInstantiation())).bind("node")
+        : functionDecl(isDefinition(), hasBody(compoundStmt()),
+                       unless(isExpansionInSystemHeader()), unless(inInstantiation())).bind("node");
+
+    auto VariableMatcher =
+      varDecl(unless(isExpansionInSystemHeader()), unless(parmVarDecl()),
+              unless(inInstantiation())).bind("node");
+
+    auto& fn = *Dispatch[(unsigned)NodeKind::FunctionDefinition];
+    auto& var = *Dispatch[(unsigned)NodeKind::Variable];
+    if (!fn.empty()) Finder.addMatcher(FunctionDefMatcher, &fn);
+    if (!var.empty()) Finder.addMatcher(VariableMatcher, &var);
+
+    if (opts.fix && (needs & NeedsSymbols) && Ai) {
+      Symbols = std::make_unique<SymbolCollectorCB>(Ctx, Syms);
+      // Renames only ever target a template's own variables
+      auto Target = varDecl(unless(parmVarDecl()), unless(inInstantiation()));
+      Finder.addMatcher(
+        declRefExpr(to(Target), unless(isExpansionInSystemHeader())).bind("ref"), Symbols.get());
+      Finder.addMatcher(
+        varDecl(unless(parmVarDecl()), unless(isExpansionInSystemHeader()),
+                unless(inInstantiation())).bind("decl"),
+        Symbols.get());
+    }
+  }
+
+  void beginTU(size_t tu, TUResult* r) {
+    Ctx.beginTU(tu, r);
+    if (Symbols) { Symbols->beginTU(); Syms.clear(); }
+  }
+
+  // Clang replaces MatchTimes with the numbers of each finished TU; fold
+  // them into the worker's totals and return the TU's matcher wall time.
+  double takeMatchTimes() {
+    double wallMs = 0;
+    for (const auto& e : MatchTimes) {
+      auto& t = MatchTotals[e.getKey().str()];
+      t.calls++;
+      t.wallMs += e.getValue().getWallTime() * 1e3;
+      t.cpuMs += e.getValue().getProcessTime() * 1e3;
+      wallMs += e.getValue().getWallTime() * 1e3;
+    }
+    MatchTimes.clear();
+    return wallMs;
+  }
+
+  ~Worker() {
+    auto* p = Profiler::active();
+    if (!p) return;
+    for (size_t r = 0; r < Rules.size(); ++r) p->mergeRule(Rules[r]->id(), RuleStats[r]);
+    for (const auto& [id, t] : MatchTotals) p->mergeMatcher(id, t);
   }
 };
 
+// Widens each rename fix from the declaration alone to every place the
+// symbol is spelled, per the index. The first proposal for a symbol wins
+// (headers are seen by several TUs); symbols some use of which can't be
+// rewritten lose their rename. Other fixes get real paths too, so a file
+// reached under two spellings is still edited once.
+static std::vector<FixIt> expandRenames(std::vector<FixIt> fixes, const SymbolIndex& index,
+                                        unsigned* dropped) {
+  std::vector<FixIt> out;
+  std::unordered_set<std::string> seen;
+  llvm::StringMap<std::string> reals;
+  auto real = [&](const std::string& f) -> const std::string& {
+    auto it = reals.find(f);
+    if (it == reals.end()) it = reals.insert({f, realPath(f)}).first;
+    return it->second;
+  };
+  for (auto& fx : fixes) {
+    if (fx.symbol.empty()) {
+      fx.file = real(fx.file);
+      out.push_back(std::move(fx));
+      continue;
+    }
+    if (!seen.insert(fx.symbol).second) continue;
+    auto occ = index.occurrences(fx.symbol);
+    if (!occ) { ++*dropped; continue; }
+    if (occ->empty()) { // not indexed; the declaration is all we know of
+      fx.file = real(fx.file);
+      out.push_back(std::move(fx));
+      continue;
+    }
+    for (const auto& o : *occ) {
+      FixIt r;
+      r.file = o.file; r.offset = o.offset; r.length = o.length;
+      r.replacement = fx.replacement; r.note = fx.note; r.symbol = fx.symbol;
+      out.push_back(std::move(r));
+    }
+  }
+  return out;
+}
+
+// Keeps only issues on changed lines, for --since. Issues name files as the
+// compiler saw them; each name is resolved once per worker.
+class ChangeFilter {
+  const ChangedLines& Changed;
+  llvm::StringMap<std::string> Reals;
+
+  bool keep(const Issue& is) {
+    auto it = Reals.find(is.file);
+    if (it == Reals.end()) it = Reals.insert({is.file, realPath(is.file)}).first;
+    return Changed.touches(it->second, is.line);
+  }
+  void filter(std::vector<Issue>& v) {
+    v.erase(std::remove_if(v.begin(), v.end(), [&](const Issue& is) { return !keep(is); }),
+            v.end());
+  }
+
+public:
+  explicit ChangeFilter(const ChangedLines& c) : Changed(c) {}
+
+  void apply(TUResult& r) {
+    filter(r.main);
+    for (auto& [h, v] : r.headers) filter(v);
+  }
+};
+
+// --max-memory: TUs are admitted by expected footprint, as last measured
+// or, for one never measured, the mean of those measured so far this run.
+// A worker whose TU doesn't fit next to the ones running waits for room.
+// A TU always runs when nothing else does.
+class MemoryBudget {
+  uint64_t Limit;
+  const CostHistory& Known;
+  std::mutex M;
+  std::condition_variable Freed;
+  uint64_t Reserved = 0;
+  unsigned Running = 0;
+  uint64_t MeasuredBytes = 0;
+  unsigned Measured = 0;
+
+public:
+  MemoryBudget(uint64_t limit, const CostHistory& known) : Limit(limit), Known(known) {}
+
+  bool fits(uint64_t bytes) const { return bytes <= Limit; }
+
+  uint64_t estimate(const std::string& file) {
+    if (auto b = Known.cost(file)) return (uint64_t)*b;
+    std::lock_guard<std::mutex> lock(M);
+    return Measured ? MeasuredBytes / Measured : 0;
+  }
+
+  // Blocks until `bytes` more fit next to what is running
+  void reserve(uint64_t bytes) {
+    std::unique_lock<std::mutex> lock(M);
+    Freed.wait(lock, [&] { return !Running || Reserved + bytes <= Limit; });
+    Reserved += bytes;
+    ++Running;
+  }
+
+  void release(uint64_t reserved, uint64_t measured) {
+    {
+      std::lock_guard<std::mutex> lock(M);
+      Reserved -= reserved;
+      --Running;
+      if (measured) {
+        MeasuredBytes += measured;
+        ++Measured;
+      }
+    }
+    Freed.notify_all();
+  }
+};
+
+static bool isHeader(llvm::StringRef path) {
+  auto ext = llvm::sys::path::extension(path);
+  return ext == ".h" || ext == ".hh" || ext == ".hpp" || ext == ".hxx";
+}
+
+// Collects every file the preprocessor enters, system headers included, so
+// a cached result can be checked against all of them.
+class AllDepsCollector : public DependencyCollector {
+  bool needSystemDependencies() override { return true; }
+};
+
+// Runs a callback when the TU has been parsed, for marking phases in the
+// trace around the matchers' own consumer
+class PhaseMarker : public ASTConsumer {
+  std::function<void()> F;
+public:
+  explicit PhaseMarker(std::function<void()> f) : F(std::move(f)) {}
+  void HandleTranslationUnit(ASTContext&) override { F(); }
+};
+
+// What one TU held once parsed, when it is at its largest
+struct TUMemory {
+  uint64_t astBytes = 0;    // AST nodes and side tables
+  uint64_t sourceBytes = 0; // file buffers, malloc'd or mapped, and SourceManager tables
+  uint64_t ppBytes = 0;     // preprocessor: macros, identifiers, include state
+  uint64_t total() const { return astBytes + sourceBytes + ppBytes; }
+};
+
+// Measures the TU after the matchers have run on it
+class MemoryProbe : public ASTConsumer {
+  CompilerInstance& CI;
+  TUMemory& Out;
+public:
+  MemoryProbe(CompilerInstance& ci, TUMemory& out) : CI(ci), Out(out) {}
+  void HandleTranslationUnit(ASTContext& Ctx) override {
+    Out.astBytes = Ctx.getASTAllocatedMemory() + Ctx.getSideTableAllocatedMemory();
+    const SourceManager& SM = Ctx.getSourceManager();
+    auto buffers = SM.getMemoryBufferSizes();
+    Out.sourceBytes = buffers.malloc_bytes + buffers.mmap_bytes + SM.getContentCacheSize() +
+                      SM.getDataStructureSizes();
+    Out.ppBytes = CI.hasPreprocessor() ? CI.getPreprocessor().getTotalMemory() : 0;
+  }
+};
+
+// Runs the worker's matchers and, when a dependency list is requested,
+// records the real path of every file the TU read.
+class AnalyzeAction : public ASTFrontendAction {
+  MatchFinder& Finder;
+  std::vector<std::string>* Deps;
+  bool SkipBodies;
+  TUMemory& Memory;
+  std::shared_ptr<AllDepsCollector> Collector;
+  std::string File;
+  uint64_t ParseStart = 0, MatchStart = 0;
+public:
+  AnalyzeAction(MatchFinder& F, std::vector<std::string>* deps, bool skipBodies, TUMemory& mem)
+    : Finder(F), Deps(deps), SkipBodies(skipBodies), Memory(mem) {}
+
+  bool BeginInvocation(CompilerInstance& CI) override {
+    if (SkipBodies) CI.getFrontendOpts().SkipFunctionBodies = true;
+    if (Deps) {
+      Collector = std::make_shared<AllDepsCollector>();
+      CI.addDependencyCollector(Collector);
+    }
+    return true;
+  }
+
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& CI, llvm::StringRef file) override {
+    std::vector<std::unique_ptr<ASTConsumer>> consumers;
+    Tracer* T = Tracer::active();
+    if (T) {
+      // Clang preprocesses on demand while it parses, so the two are one
+      // phase; Clang's own "Source" events break it down by header
+      File = file.str();
+      ParseStart = T->now();
+      consumers.push_back(std::make_unique<PhaseMarker>([this, T] {
+        MatchStart = T->now();
+        T->complete("phase", "parse", File, ParseStart, MatchStart - ParseStart);
+      }));
+    }
+    consumers.push_back(Finder.newASTConsumer());
+    if (T)
+      consumers.push_back(std::make_unique<PhaseMarker>([this, T] {
+        T->complete("phase", "match", File, MatchStart, T->now() - MatchStart);
+      }));
+    consumers.push_back(std::make_unique<MemoryProbe>(CI, Memory));
+    return std::make_unique<MultiplexConsumer>(std::move(consumers));
+  }
+
+  void EndSourceFileAction() override {
+    if (!Deps || !Collector) return;
+    const auto& FM = getCompilerInstance().getFileManager();
+    Deps->push_back(realPath(FM, getCurrentFile()));
+    for (const auto& d : Collector->getDependencies())
+      Deps->push_back(realPath(FM, d));
+  }
+};
+
+class AnalyzeActionFactory : public FrontendActionFactory {
+  MatchFinder& Finder;
+  std::vector<std::string>* Deps;
+  bool SkipBodies;
+  TUMemory& Memory;
+public:
+  AnalyzeActionFactory(MatchFinder& F, std::vector<std::string>* deps, bool skipBodies,
+                       TUMemory& mem)
+    : Finder(F), Deps(deps), SkipBodies(skipBodies), Memory(mem) {}
+  std::unique_ptr<FrontendAction> create() override {
+    return std::make_unique<AnalyzeAction>(Finder, Deps, SkipBodies, Memory);
+  }
+};
+
+// Driver flags every TU (and every PCH built for them) is parsed with
+static std::vector<std::string> toolArgs(const std::string& resDir) {
+  std::vector<std::string> args{"-resource-dir", resDir};
+  if (const char* sdk = std::getenv("SDKROOT")) {
+    args.push_back("-isysroot");
+    args.push_back(sdk);
+  }
+  return args;
+}
+
+// Run a single TU. Each call gets its own physical VFS so that concurrent
+// tools don't fight over the process working directory; unsaved buffers, if
+// any, are layered over it.
+static int runTU(const CompilationDatabase& DB, const std::string& file,
+                 const std::vector<std::string>& args, const std::string& pch,
+                 bool skipBodies, const Overlay* overlay, MatchFinder& Finder,
+                 std::vector<std::string>* deps, TUMemory& mem) {
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS =
+    overlay ? overlay->fileSystem() : llvm::vfs::createPhysicalFileSystem();
+  ClangTool Tool(DB, {file}, std::make_shared<PCHContainerOperations>(), FS);
+
+  using tooling::ArgumentInsertPosition;
+  using tooling::getInsertArgumentAdjuster;
+
+  Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(args, ArgumentInsertPosition::BEGIN));
+  if (!pch.empty()) {
+    Tool.appendArgumentsAdjuster(
+      getInsertArgumentAdjuster({"-include-pch", pch}, ArgumentInsertPosition::END));
+  }
+
+  AnalyzeActionFactory Factory(Finder, deps, skipBodies, mem);
+  Tracer* T = Tracer::active();
+  if (T) T->beginClangTrace();
+  int rc = Tool.run(&Factory);
+  if (T) T->endClangTrace();
+  return rc;
+}
+
+// Bump whenever a rule's logic or message format changes, so stale cache
+// entries are not replayed
+static constexpr unsigned kRulesVersion = 3;
+
+// The include graph --since and --verify-fixes reuse: next to the cache,
+// or without one in the user's cache directory, one per build directory
+static std::string includeGraphFile(const AnalyzeOptions& opts, const CompilationDatabase& DB,
+                                    const std::vector<std::string>& tus) {
+  if (!opts.cacheDir.empty()) return opts.cacheDir + "/includes.idx";
+  llvm::SmallString<256> dir;
+  if (!llvm::sys::path::cache_directory(dir)) return {};
+  llvm::sys::path::append(dir, "aicr");
+  if (llvm::sys::fs::create_directories(dir)) return {};
+  std::string build;
+  if (!tus.empty())
+    for (const auto& cmd : DB.getCompileCommands(tus.front())) {
+      build = cmd.Directory;
+      break;
+    }
+  llvm::sys::path::append(dir, "includes-" + llvm::utohexstr(llvm::xxHash64(build)) + ".idx");
+  return std::string(dir.str());
+}
+
+// Everything besides file contents that decides what a TU produces
+static uint64_t cacheKey(const CompilationDatabase& DB, const std::string& file,
+                         const AnalyzeOptions& opts, const std::vector<const RuleInfo*>& rules,
+                         const AiEngine* ai, const std::string& resDir) {
+  std::string k;
+  llvm::raw_string_ostream os(k);
+  os << "rules=" << kRulesVersion;
+  for (const auto* r : rules) os << ',' << r->id;
+  os << ";long=" << opts.longFunctionLineThreshold
+     << ";dup=" << opts.duplicateMinNodes
+     << ";docs=" << opts.suggestDocs
+     << ";names=" << opts.suggestBetterVarNames
+     << ";comments=" << opts.parseAllComments
+     << ";ai=" << (ai ? ai->identity() : std::string("none"))
+     // Rules skip known issues before they run, so an entry holds only what
+     // this baseline left; any change to it reanalyzes every TU
+     << ";baseline=" << (opts.baseline ? opts.baseline->identity() : 0)
+     << ";sites=" << baselineRoot() // fingerprints are relative to it
+     << ";res=" << resDir;
+  if (const char* sdk = std::getenv("SDKROOT")) os << ";sdk=" << sdk;
+  for (const auto& a : opts.extraArgs) os << ";x=" << a;
+  for (const auto& cmd : DB.getCompileCommands(file)) {
+    os << ";dir=" << cmd.Directory;
+    for (const auto& a : cmd.CommandLine) os << '\0' << a;
+  }
+  return llvm::xxHash64(os.str());
+}
+
+// The rules this run uses: the ones --rules names (all by default), minus
+// those that can't report anything under these options
+static bool selectRules(const AnalyzeOptions& opts, bool haveAi,
+                        std::vector<const RuleInfo*>& out, std::string* error) {
+  const auto& all = registeredRules();
+  for (const auto& id : opts.rules) {
+    auto it = std::find_if(all.begin(), all.end(), [&](const RuleInfo& r) { return r.id == id; });
+    if (it != all.end()) continue;
+    std::string known;
+    for (const auto& r : all) known += (known.empty() ? "" : ", ") + r.id;
+    if (error) *error = "Unknown rule '" + id + "' (available: " + known + ")";
+    return false;
+  }
+  for (const auto& r : all) {
+    bool named = std::find(opts.rules.begin(), opts.rules.end(), r.id) != opts.rules.end();
+    if (!opts.rules.empty() && !named) continue;
+    if (!r.make()->active(opts, haveAi)) {
+      if (named) llvm::errs() << "Rule " << r.id << " has nothing to report with these options\n";
+      continue;
+    }
+    out.push_back(&r);
+  }
+  return true;
+}
+
+// How much of each TU gets parsed, from what the enabled rules need
+enum class ParseMode {
+  Full,       // everything
+  SkipBodies, // declarations only; function bodies skipped
+  Raw,        // no parse: rules scan file text
+};
+
 class CppAnalyzerImpl : public Analyzer {
 public:
+  using Analyzer::analyzePaths;
+
   bool analyzePaths(const std::vector<std::string>& paths,
                     const AnalyzeOptions& opts,
                     AiEngine* ai,
-                    std::vector<Issue>& out) override
+                    Reporter& sink) override
   {
     if (paths.empty()) return false;
 
     std::string err;
-    // Prefer source autodetect; fall back to current dir
-    auto Compilations = CompilationDatabase::autoDetectFromSource(paths.front(), err);
-    if (!Compilations) {
-      auto Fallback = CompilationDatabase::autoDetectFromDirectory(".", err);
-      if (Fallback) Compilations = std::move(Fallback);
-    }
-    if (!Compilations) {
-      llvm::errs() << "Compilation DB not found (" << err << "). "
-                   << "Generate compile_commands.json for the project.\n";
+    std::vector<const RuleInfo*> rules;
+    if (!selectRules(opts, ai != nullptr, rules, &err)) {
+      llvm::errs() << err << "\n";
       return false;
     }
+    if (rules.empty()) return true;
+
+    // Rules reporting across TUs get one index for the run, unless their
+    // inputs are wanted as they are (shards)
+    unsigned needs = 0;
+    bool raw = true;
+    std::vector<std::unique_ptr<ProjectIndex>> indexes;
+    for (const auto* info : rules) {
+      auto r = info->make();
+      needs |= r->needs();
+      raw = raw && r->scansRaw();
+      indexes.push_back(r->makeIndex());
+    }
+    std::mutex factsM;
+    auto addFacts = [&](const std::map<std::string, std::string>& facts) {
+      for (size_t i = 0; i < rules.size(); ++i) {
+        auto it = facts.find(rules[i]->id);
+        if (!indexes[i] || it == facts.end()) continue;
+        if (!opts.deferredFacts) {
+          indexes[i]->add(it->second);
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(factsM);
+        (*opts.deferredFacts)[rules[i]->id].push_back(it->second);
+      }
+    };
+    const ParseMode mode = raw ? ParseMode::Raw
+                         : (needs & NeedsBodies) ? ParseMode::Full : ParseMode::SkipBodies;
+
+    std::shared_ptr<CompilationDatabase> Compilations;
+    if (mode != ParseMode::Raw) {
+      StageTimer T("compile-db");
+      Compilations = openCompileDb(paths.front(), opts.compileDb, opts.cacheDir, err);
+      if (!Compilations) {
+        llvm::errs() << "Compilation DB not found (" << err << "). "
+                     << "Generate compile_commands.json for the project.\n";
+        return false;
+      }
+    }
+
+    const std::string resDir = opts.resourceDir.empty() ? clangResourceDir() : opts.resourceDir;
+    std::vector<std::string> tuArgs = toolArgs(resDir);
 
     // Extra compiler args
-    std::vector<std::string> args = opts.extraArgs;
-    if (opts.parseAllComments) args.push_back("-fparse-all-comments");
+    tuArgs.insert(tuArgs.end(), opts.extraArgs.begin(), opts.extraArgs.end());
+    if (opts.parseAllComments && (needs & NeedsComments)) tuArgs.push_back("-fparse-all-comments");
 
-    ClangTool Tool(*Compilations, paths);
+    // Headers are not TUs of their own: they get analyzed inside whichever
+    // source includes them first. Only headers nobody includes are parsed
+    // standalone afterwards. Raw scans take every file as it is.
+    std::vector<std::string> sources;
+    std::vector<std::string> headerPaths;
+    HeaderOwnership headers;
+    for (const auto& p : paths) {
+      if (mode != ParseMode::Raw && isHeader(p)) {
+        headerPaths.push_back(p);
+        headers.headers.insert(realPath(p));
+      } else {
+        sources.push_back(p);
+      }
+    }
 
-std::string resDir;
-if (const char* rd = std::getenv("CLANG_RESOURCE_DIR")) {
-  resDir = rd;
-} else {
+    unsigned jobs = opts.jobs ? opts.jobs : std::thread::hardware_concurrency();
+    jobs = std::max(1u, std::min<unsigned>(jobs, paths.size()));
 
-  resDir = "/opt/homebrew/opt/llvm@18/lib/clang/18";
-}
+    // --since: only changed files, and the TUs that read one. Which TU reads
+    // what comes from a preprocessor-only scan, kept next to the cache.
+    if (opts.changed) {
+      StageTimer T("change-scope");
+      std::set<std::string> changed;
+      for (const auto& [f, lines] : opts.changed->files) changed.insert(f);
+      auto isChanged = [&](const std::string& p) { return changed.count(realPath(p)) != 0; };
 
-using tooling::ArgumentInsertPosition;
-using tooling::getInsertArgumentAdjuster;
+      if (mode == ParseMode::Raw) {
+        sources.erase(std::remove_if(sources.begin(), sources.end(),
+                                     [&](const std::string& p) { return !isChanged(p); }),
+                      sources.end());
+      } else {
+        IncludeGraph graph(includeGraphFile(opts, *Compilations, sources));
+        graph.update(*Compilations, sources, tuArgs, jobs);
+        auto hit = graph.affected(changed);
+        std::unordered_set<std::string> keep(hit.begin(), hit.end());
+        sources.erase(std::remove_if(sources.begin(), sources.end(),
+                                     [&](const std::string& p) { return !keep.count(p); }),
+                      sources.end());
+        headerPaths.erase(std::remove_if(headerPaths.begin(), headerPaths.end(),
+                                         [&](const std::string& p) { return !isChanged(p); }),
+                          headerPaths.end());
+        headers.headers.clear();
+        for (const auto& h : headerPaths) headers.headers.insert(realPath(h));
+      }
+    }
 
-Tool.appendArgumentsAdjuster(
-  getInsertArgumentAdjuster({"-resource-dir", resDir}, ArgumentInsertPosition::BEGIN));
+    std::unique_ptr<ProfiledAi> profiled;
+    if (ai && (Profiler::active() || Tracer::active())) {
+      profiled = std::make_unique<ProfiledAi>(*ai, Profiler::active());
+      ai = profiled.get();
+    }
 
-if (const char* sdk = std::getenv("SDKROOT")) {
-  Tool.appendArgumentsAdjuster(
-    getInsertArgumentAdjuster({"-isysroot", sdk}, ArgumentInsertPosition::BEGIN));
-}
+    // All engine calls go through one batcher: rules only queue requests,
+    // and the batcher's own threads talk to the engine.
+    std::unique_ptr<AiBatcher> batcher;
+    if (ai) batcher = std::make_unique<AiBatcher>(*ai);
+
+    std::unique_ptr<ResultCache> cache;
+    if (!opts.cacheDir.empty() && mode != ParseMode::Raw)
+      cache = std::make_unique<ResultCache>(opts.cacheDir, opts.cacheMaxBytes);
+
+    // Each TU's measured footprint is kept next to the cache, so a budget
+    // knows the big ones before they are parsed again
+    CostHistory footprints;
+    const std::string footprintFile =
+      opts.cacheDir.empty() || mode == ParseMode::Raw ? std::string()
+                                                      : opts.cacheDir + "/footprints";
+    if (!footprintFile.empty() && !footprints.load(footprintFile, &err))
+      llvm::errs() << err << "\n";
+    std::unique_ptr<MemoryBudget> budget;
+    if (opts.maxMemoryBytes && mode != ParseMode::Raw)
+      budget = std::make_unique<MemoryBudget>(opts.maxMemoryBytes, footprints);
+    std::atomic<unsigned> fallbackTUs{0};
+    std::mutex memoryM;
+    std::vector<TUProfile> memory; // under --memory-report
+
+    // Shared <...> include blocks are precompiled once per group. Issues are
+    // unaffected: the same declarations are read back from the PCH.
+    // Not with unsaved buffers: a PCH built from disk would fail validation
+    // against any of them it covers.
+    const Overlay* overlay = opts.overlay && !opts.overlay->empty() ? opts.overlay : nullptr;
+    std::unique_ptr<PchCache> pchs;
+    if (!opts.pchDir.empty() && mode != ParseMode::Raw && !overlay) {
+      pchs = std::make_unique<PchCache>(opts.pchDir);
+      StageTimer T("pch");
+      pchs->prepare(*Compilations, sources, tuArgs, jobs);
+    }
+
+    // Where renamed symbols are spelled, built by the same traversal. Kept
+    // next to the result cache so replayed TUs still contribute theirs; not
+    // when buffers are unsaved, as records are keyed without file contents.
+    std::unique_ptr<SymbolIndex> symbols;
+    if (opts.fix && (needs & NeedsSymbols) && batcher)
+      symbols = std::make_unique<SymbolIndex>(
+        opts.cacheDir.empty() || overlay ? std::string() : opts.cacheDir + "/symbols");
+
+    OrderedSink ordered(sink, opts.fix);
+    std::atomic<bool> failed{false};
+
+    // For issues made without a node to skip rules on
+    auto dropKnown = [&](std::vector<Issue>& v) {
+      if (!opts.baseline) return;
+      v.erase(std::remove_if(v.begin(), v.end(),
+                             [&](const Issue& is) { return opts.baseline->contains(is.fingerprint); }),
+              v.end());
+    };
+
+    // Replay a cached TU. Its headers are claimed as if it had been parsed;
+    // any already taken by another TU are left to that TU. Entries describe
+    // files on disk, so none that read an unsaved buffer apply.
+    auto replay = [&](size_t tu, CacheEntry& e, TUResult& r) {
+      for (const auto& d : e.deps) {
+        if ((headers.headers.count(d.path) != 0) != d.candidate) return false;
+        if (overlay && overlay->find(d.path)) return false;
+      }
+      r.main = std::move(e.main);
+      for (auto& [h, v] : e.headers)
+        if (headers.claim(h, tu)) r.headers[h] = std::move(v);
+      r.facts = std::move(e.facts);
+      return true;
+    };
+
+    // Lexer-only mode: each rule reads the file's text
+    auto scanOne = [&](Worker& W, const std::string& file, TUResult& r) {
+      auto t0 = std::chrono::steady_clock::now();
+      llvm::StringRef text;
+      std::unique_ptr<llvm::MemoryBuffer> buf;
+      if (const std::string* s = overlay ? overlay->find(file) : nullptr) {
+        text = *s;
+      } else if (auto b = llvm::MemoryBuffer::getFile(file, /*IsText=*/false,
+                                                      /*RequiresNullTerminator=*/false)) {
+        buf = std::move(*b);
+        text = buf->getBuffer();
+      } else {
+        llvm::errs() << "Failed to read " << file << "\n";
+        failed = true;
+        return;
+      }
+      llvm::SmallString<256> abs(file);
+      llvm::sys::fs::make_absolute(abs);
+      std::string name(abs.str());
+      std::string sitePath = baselinePath(realPath(file));
+      RawContext RC{name, text, opts, r.main, sitePath};
+      for (auto& rule : W.Rules) rule->checkRaw(RC);
+      dropKnown(r.main);
+      double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+      if (opts.costs) opts.costs->record(file, ms);
+      if (auto* p = Profiler::active()) {
+        TUProfile tp;
+        tp.file = file;
+        tp.totalMs = ms;
+        p->addTU(std::move(tp));
+      }
+    };
 
+    // Parses one TU into r. What it returns is left for once r's AI answers
+    // are in: until then the issue counts are not final and nothing may be
+    // cached.
+    using Finish = std::function<void(const TUResult&)>;
+    auto runOne = [&](Worker& W, size_t tu, const std::string& file, TUResult& r) -> Finish {
+      TraceSpan span("tu", file);
+      if (mode == ParseMode::Raw) {
+        scanOne(W, file, r);
+        return {};
+      }
+      uint64_t key = 0;
+      std::string real;
+      if (cache) {
+        real = realPath(file);
+        key = cacheKey(*Compilations, file, opts, rules, ai, resDir);
+        if (auto e = cache->lookup(real, key)) {
+          if ((!symbols || symbols->load(real, key)) && replay(tu, *e, r)) {
+            if (auto* p = Profiler::active()) {
+              TUProfile tp; tp.file = file; tp.cached = true;
+              p->addTU(std::move(tp));
+            }
+            return {};
+          }
+        }
+      }
 
-    Context Ctx;
-    Ctx.opts = &opts; Ctx.ai = ai; Ctx.out = &out;
+      // A body-less parse standing in for a full one is neither cached nor
+      // indexed, and its footprint says nothing of the full parse's
+      const bool fallback = W.SkipBodies && mode == ParseMode::Full;
+      std::vector<std::string> deps;
+      W.beginTU(tu, &r);
+      std::string pch = pchs ? pchs->pchFor(file) : std::string();
+      TUMemory mem;
+      auto t0 = std::chrono::steady_clock::now();
+      int rc = runTU(*Compilations, file, tuArgs, pch, W.SkipBodies, overlay,
+                     W.Finder, cache ? &deps : nullptr, mem);
+      double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+      if (opts.costs) opts.costs->record(file, ms);
+      if (!fallback) {
+        r.footprint = mem.total();
+        if (!footprintFile.empty() && r.footprint) footprints.record(file, (double)r.footprint);
+      }
+      std::optional<TUProfile> tp;
+      if (Profiler::active() || opts.memoryReport) {
+        tp.emplace();
+        tp->file = file;
+        tp->totalMs = ms;
+        tp->matchMs = Profiler::active() ? W.takeMatchTimes() : 0;
+        tp->astBytes = mem.astBytes;
+        tp->sourceBytes = mem.sourceBytes;
+        tp->ppBytes = mem.ppBytes;
+        tp->fallback = fallback;
+      }
+      for (size_t i = 0; i < W.Rules.size(); ++i)
+        if (indexes[i]) r.facts[rules[i]->id] = W.Rules[i]->takeFacts();
 
-    MatchFinder Finder;
+      std::optional<CacheEntry> e;
+      if (rc != 0) {
+        failed = true; // never cache a failed parse
+      } else if (!fallback) {
+        if (symbols) symbols->update(cache ? real : realPath(file), key, std::move(W.Syms));
+        if (cache) {
+          e.emplace();
+          std::sort(deps.begin(), deps.end());
+          deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+          for (auto& d : deps) {
+            CachedDep cd;
+            cd.path = std::move(d);
+            cd.candidate = headers.headers.count(cd.path) != 0;
+            // Not what is on disk, or vanished mid-run; don't cache
+            if ((overlay && overlay->find(cd.path)) || !cache->describe(cd)) {
+              e.reset();
+              break;
+            }
+            e->deps.push_back(std::move(cd));
+          }
+        }
+      }
+      if (!tp && !e) return {};
+      return [&, tp = std::move(tp), e = std::move(e), real = std::move(real), key](
+               const TUResult& done) mutable {
+        if (tp) {
+          tp->issues = done.main.size();
+          for (const auto& [h, v] : done.headers) tp->issues += v.size();
+          if (opts.memoryReport) {
+            std::lock_guard<std::mutex> lock(memoryM);
+            memory.push_back(*tp);
+          }
+          if (auto* p = Profiler::active()) p->addTU(std::move(*tp));
+        }
+        if (!e) return;
+        e->main = done.main;
+        e->headers = done.headers;
+        e->facts = done.facts;
+        cache->store(real, key, *e);
+      };
+    };
 
-    LongFunctionCB longCB(Ctx);
-    MissingDocCB  docCB(Ctx);
-    WeakVarNameCB nameCB(Ctx);
+    auto runAll = [&](const std::vector<std::string>& files, size_t tuBase) {
+      if (files.empty()) return;
+      std::atomic<size_t> next{0};
+      std::mutex deferM;
+      std::vector<size_t> deferred;
 
-    auto LongFuncMatcher =
-      functionDecl(isDefinition(), hasBody(compoundStmt()), isExpansionInMainFile())
-        .bind("func");
+      // Each worker holds on to its last TU while it parses the next one, so
+      // the AI batch that TU is waiting on fills and resolves in the
+      // meantime instead of stalling the worker
+      struct Held {
+        size_t i;
+        std::unique_ptr<TUResult> r;
+        PendingAi::Batch ai;
+        Finish finish;
+      };
+      auto settle = [&](Worker& W, std::optional<ChangeFilter>& scope, std::optional<Held>& h) {
+        if (!h) return;
+        if (W.Ai) W.Ai->resolve(h->ai);
+        if (h->finish) h->finish(*h->r);
+        if (scope) scope->apply(*h->r);
+        ordered.done(tuBase + h->i, *h->r);
+        h.reset();
+      };
+      auto runIn = [&](Worker& W, std::optional<ChangeFilter>& scope, std::optional<Held>& held,
+                       size_t i, bool alone) {
+        auto r = std::make_unique<TUResult>();
+        uint64_t expected = budget ? budget->estimate(files[i]) : 0;
+        if (budget && !alone && mode == ParseMode::Full && !budget->fits(expected)) {
+          std::lock_guard<std::mutex> lock(deferM);
+          deferred.push_back(i);
+          return;
+        }
+        if (budget) budget->reserve(expected);
+        Finish finish = runOne(W, tuBase + i, files[i], *r);
+        if (budget) budget->release(expected, r->footprint);
+        if (!r->facts.empty()) addFacts(r->facts);
+        settle(W, scope, held);
+        held.emplace();
+        held->i = i;
+        held->r = std::move(r);
+        if (W.Ai) held->ai = W.Ai->take();
+        held->finish = std::move(finish);
+      };
+      auto work = [&] {
+        Worker W(opts, rules, mode == ParseMode::SkipBodies, batcher.get(), &headers);
+        std::optional<ChangeFilter> scope;
+        if (opts.changed) scope.emplace(*opts.changed);
+        std::optional<Held> held;
+        for (size_t i = next++; i < files.size(); i = next++) runIn(W, scope, held, i, false);
+        settle(W, scope, held);
+      };
+      unsigned n = std::max(1u, std::min<unsigned>(jobs, files.size()));
+      if (n == 1) {
+        work();
+      } else {
+        std::vector<std::thread> pool;
+        pool.reserve(n);
+        for (unsigned t = 0; t < n; ++t) pool.emplace_back(work);
+        for (auto& th : pool) th.join();
+      }
+      if (deferred.empty()) return;
 
-    auto MissingDocMatcher =
-      functionDecl(isDefinition(), hasBody(compoundStmt()), isExpansionInMainFile())
-        .bind("func2");
+      // TUs expected to overrun the budget even alone come last, one at a
+      // time and in input order, parsed with function bodies skipped
+      std::vector<size_t> late = std::move(deferred);
+      deferred.clear();
+      std::sort(late.begin(), late.end());
+      Worker W(opts, rules, true, batcher.get(), &headers);
+      std::optional<ChangeFilter> scope;
+      if (opts.changed) scope.emplace(*opts.changed);
+      std::optional<Held> held;
+      for (size_t i : late) {
+        llvm::errs() << files[i] << ": expected to hold " << (budget->estimate(files[i]) >> 20)
+                     << " MiB, over --max-memory; analyzing it with function bodies skipped\n";
+        ++fallbackTUs;
+        runIn(W, scope, held, i, true);
+      }
+      settle(W, scope, held);
+    };
+
+    {
+      StageTimer T("analyze");
+      runAll(sources, 0);
 
-    auto WeakVarMatcher =
-      varDecl(isExpansionInMainFile(), unless(parmVarDecl())).bind("var");
+      std::vector<std::string> orphans;
+      for (const auto& h : headerPaths)
+        if (!headers.claimed(realPath(h))) orphans.push_back(h);
+      runAll(orphans, sources.size());
 
-    Finder.addMatcher(LongFuncMatcher, &longCB);
-    Finder.addMatcher(MissingDocMatcher, &docCB);
-    Finder.addMatcher(WeakVarMatcher, &nameCB);
+      // Project-wide findings come last, once every TU has had its say
+      TUResult project;
+      if (!opts.deferredFacts)
+        for (auto& index : indexes)
+          if (index) index->finish(project.main);
+      dropKnown(project.main);
+      if (opts.changed) ChangeFilter(*opts.changed).apply(project);
+      ordered.done(sources.size() + orphans.size(), project);
+    }
+    ordered.finish();
+    if (cache) cache->evict();
+    if (!footprintFile.empty() && !footprints.save(footprintFile, &err))
+      llvm::errs() << err << "\n";
+    if (fallbackTUs)
+      llvm::errs() << "Analyzed " << fallbackTUs.load()
+                   << " TU(s) over --max-memory with function bodies skipped\n";
+    if (opts.memoryReport && !memory.empty())
+      printMemoryTable(llvm::errs(), std::move(memory), opts.memoryReport);
 
-    auto res = Tool.run(newFrontendActionFactory(&Finder).get());
-    if (res != 0) return false;
+    if (failed) return false;
 
     // Apply fixes if requested
     if (opts.fix) {
-      std::vector<FixIt> all;
-      for (auto& i : out) for (auto& f : i.fixes) all.push_back(std::move(f));
+      std::vector<FixIt> all = ordered.takeFixes();
       std::string e;
-      if (!RefactorEngine::applyFixes(all, opts.backup, &e)) {
+      StageTimer T("apply-fixes");
+      if (symbols) {
+        unsigned dropped = 0;
+        all = expandRenames(std::move(all), *symbols, &dropped);
+        if (dropped)
+          llvm::errs() << "Skipped " << dropped << " rename(s) of symbols spelled through macros\n";
+      }
+      if (opts.verifyFixes && !all.empty()) {
+        StageTimer V("verify-fixes");
+        if (!Compilations) {
+          Compilations = openCompileDb(paths.front(), opts.compileDb, opts.cacheDir, err);
+          if (!Compilations) {
+            llvm::errs() << "Cannot verify fixes without a compilation DB (" << err << ")\n";
+            return false;
+          }
+        }
+        VerifyOptions vo;
+        for (const auto& p : paths)
+          if (!isHeader(p)) vo.tus.push_back(p);
+        vo.args = tuArgs;
+        vo.graphFile = includeGraphFile(opts, *Compilations, vo.tus);
+        vo.overlay = overlay;
+        vo.jobs = jobs;
+        VerifyStats vs;
+        verifyFixes(*Compilations, all, vo, &vs);
+        if (vs.rejectedSets)
+          llvm::errs() << "Verification rejected " << vs.rejectedSets << " fix set(s) ("
+                       << vs.rejectedFixes << " edit(s)) after reparsing " << vs.tus << " TU(s)\n";
+      }
+      if (opts.deferredFixes) {
+        *opts.deferredFixes = std::move(all);
+        return true;
+      }
+      ApplyOptions ao;
+      ao.backup = opts.backup;
+      ao.jobs = jobs;
+      ao.overlay = overlay;
+      ApplyStats st;
+      if (!RefactorEngine::applyFixes(all, ao, &e, &st)) {
         llvm::errs() << "Apply failed: " << e << "\n";
         return false;
       }
+      if (st.rejected)
+        llvm::errs() << "Skipped " << st.rejected << " fix(es) overlapping an earlier edit\n";
     }
     return true;
   }
@@ -0,0 +1,157 @@
+#include "analyzers/IssueStore.hpp"
+
+#include "llvm/ADT/StringMap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <tuple>
+
+namespace aicr {
+
+namespace {
+
+class SymbolTable {
+  std::shared_mutex M;
+  llvm::StringMap<Symbol> Map;        // owns the bytes
+  std::vector<llvm::StringRef> Names; // indexed by Symbol, points into Map
+
+public:
+  SymbolTable() { Names.push_back(Map.try_emplace("", 0).first->getKey()); }
+
+  Symbol intern(llvm::StringRef s) {
+    {
+      std::shared_lock<std::shared_mutex> L(M);
+      auto it = Map.find(s);
+      if (it != Map.end()) return it->second;
+    }
+    std::unique_lock<std::shared_mutex> L(M);
+    auto [it, inserted] = Map.try_emplace(s, (Symbol)Names.size());
+    if (inserted) Names.push_back(it->getKey());
+    return it->second;
+  }
+
+  llvm::StringRef name(Symbol s) {
+    std::shared_lock<std::shared_mutex> L(M);
+    return s < Names.size() ? Names[s] : llvm::StringRef();
+  }
+};
+
+SymbolTable& symbols() {
+  static SymbolTable T;
+  return T;
+}
+
+} // namespace
+
+Symbol intern(llvm::StringRef s) { return symbols().intern(s); }
+llvm::StringRef symbolName(Symbol s) { return symbols().name(s); }
+
+IssueStore::IssueStore() {
+  Arenas.push_back(std::make_unique<llvm::BumpPtrAllocator>());
+}
+
+llvm::StringRef IssueStore::save(llvm::StringRef s) {
+  if (s.empty()) return {};
+  char* p = Arenas.front()->Allocate<char>(s.size());
+  std::memcpy(p, s.data(), s.size());
+  return llvm::StringRef(p, s.size());
+}
+
+void IssueStore::add(const Issue& i) {
+  Entry e;
+  e.id = intern(i.id);
+  e.file = intern(i.file);
+  e.line = i.line;
+  e.column = i.column;
+  e.severity = i.severity;
+  e.message = save(i.message);
+  e.fingerprint = i.fingerprint;
+  e.firstFix = (uint32_t)Fixes.size();
+  e.numFixes = (uint32_t)i.fixes.size();
+  for (const auto& f : i.fixes) {
+    Fix x;
+    x.file = f.file == i.file ? e.file : intern(f.file);
+    x.offset = f.offset;
+    x.length = f.length;
+    x.replacement = save(f.replacement);
+    x.note = intern(f.note);
+    x.symbol = intern(f.symbol);
+    Fixes.push_back(x);
+  }
+  Entries.push_back(e);
+}
+
+void IssueStore::add(const std::vector<Issue>& v) {
+  Entries.reserve(Entries.size() + v.size());
+  for (const auto& i : v) add(i);
+}
+
+void IssueStore::append(IssueStore&& other) {
+  uint32_t base = (uint32_t)Fixes.size();
+  Fixes.insert(Fixes.end(), other.Fixes.begin(), other.Fixes.end());
+  Entries.reserve(Entries.size() + other.Entries.size());
+  for (Entry e : other.Entries) {
+    e.firstFix += base;
+    Entries.push_back(e);
+  }
+  for (auto& a : other.Arenas) Arenas.push_back(std::move(a));
+  other.Entries.clear();
+  other.Fixes.clear();
+  other.Arenas.clear();
+  other.Arenas.push_back(std::make_unique<llvm::BumpPtrAllocator>());
+}
+
+FixIt IssueStore::fixIt(const Fix& f) const {
+  FixIt x;
+  x.file = symbolName(f.file).str();
+  x.offset = f.offset;
+  x.length = f.length;
+  x.replacement = f.replacement.str();
+  x.note = symbolName(f.note).str();
+  x.symbol = symbolName(f.symbol).str();
+  return x;
+}
+
+Issue IssueStore::issue(size_t n) const {
+  const Entry& e = Entries[n];
+  Issue i;
+  i.id = symbolName(e.id).str();
+  i.severity = e.severity;
+  i.message = e.message.str();
+  i.file = symbolName(e.file).str();
+  i.line = e.line;
+  i.column = e.column;
+  i.fingerprint = e.fingerprint;
+  for (const auto& f : fixesOf(e)) i.fixes.push_back(fixIt(f));
+  return i;
+}
+
+void IssueStore::sortByLocation() {
+  std::stable_sort(Entries.begin(), Entries.end(), [](const Entry& a, const Entry& b) {
+    llvm::StringRef af = symbolName(a.file), bf = symbolName(b.file);
+    if (a.file != b.file && af != bf) return af < bf;
+    if (a.line != b.line) return a.line < b.line;
+    if (a.column != b.column) return a.column < b.column;
+    return a.id != b.id && symbolName(a.id) < symbolName(b.id);
+  });
+}
+
+void IssueStore::dedupe() {
+  // Fixes of dropped entries stay in the flat array but are unreachable
+  std::set<std::tuple<Symbol, unsigned, unsigned, Symbol>> seen;
+  size_t n = 0;
+  for (const Entry& e : Entries)
+    if (seen.emplace(e.file, e.line, e.column, e.id).second) Entries[n++] = e;
+  Entries.resize(n);
+}
+
+void IssueStore::removeIf(llvm::function_ref<bool(const Entry&)> pred) {
+  Entries.erase(std::remove_if(Entries.begin(), Entries.end(),
+                               [&](const Entry& e) { return pred(e); }),
+                Entries.end());
+}
+
+} // namespace aicr
@@ -0,0 +1,91 @@
+#include "analyzers/Overlay.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace aicr {
+
+namespace {
+
+std::string absolute(llvm::StringRef p) {
+  llvm::SmallString<256> abs(p);
+  llvm::sys::fs::make_absolute(abs);
+  llvm::sys::path::remove_dots(abs, /*remove_dot_dot=*/true);
+  return std::string(abs.str());
+}
+
+std::string keyOf(const std::string& abs) {
+  llvm::SmallString<256> real;
+  if (llvm::sys::fs::real_path(abs, real)) return abs;
+  return std::string(real.str());
+}
+
+} // namespace
+
+void Overlay::set(llvm::StringRef path, std::string contents) {
+  std::string abs = absolute(path);
+  std::string key = keyOf(abs);
+  Entry& e = Files[key];
+  e.spelled = abs == key ? std::string() : std::move(abs);
+  e.contents = std::move(contents);
+}
+
+const std::string* Overlay::find(llvm::StringRef path) const {
+  if (Files.empty()) return nullptr;
+  auto it = Files.find(keyOf(absolute(path)));
+  return it == Files.end() ? nullptr : &it->second.contents;
+}
+
+std::vector<std::string> Overlay::paths() const {
+  std::vector<std::string> out;
+  out.reserve(Files.size());
+  for (const auto& [key, e] : Files) out.push_back(e.spelled.empty() ? key : e.spelled);
+  return out;
+}
+
+bool Overlay::parse(llvm::StringRef json, std::string* error) {
+  auto v = llvm::json::parse(json);
+  if (!v) {
+    if (error) *error = "Bad overlay: " + llvm::toString(v.takeError());
+    return false;
+  }
+  const auto* obj = v->getAsObject();
+  if (!obj) {
+    if (error) *error = "Bad overlay: expected an object of path: contents";
+    return false;
+  }
+  for (const auto& [path, contents] : *obj) {
+    auto s = contents.getAsString();
+    if (!s) {
+      if (error) *error = "Bad overlay: contents of " + path.str() + " is not a string";
+      return false;
+    }
+    set(path, s->str());
+  }
+  return true;
+}
+
+llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Overlay::fileSystem() const {
+  auto FS = llvm::makeIntrusiveRefCnt<llvm::vfs::OverlayFileSystem>(
+    llvm::vfs::createPhysicalFileSystem());
+  if (Files.empty()) return FS;
+
+  auto Mem = llvm::makeIntrusiveRefCnt<llvm::vfs::InMemoryFileSystem>();
+  for (const auto& [key, e] : Files) {
+    auto add = [&](const std::string& path) {
+      Mem->addFile(path, /*ModificationTime=*/0,
+                   llvm::MemoryBuffer::getMemBuffer(e.contents, path,
+                                                    /*RequiresNullTerminator=*/false));
+    };
+    add(key);
+    if (!e.spelled.empty()) add(e.spelled);
+  }
+  FS->pushOverlay(Mem);
+  return FS;
+}
+
+} // namespace aicr
@@ -0,0 +1,241 @@
+#include "analyzers/PchCache.hpp"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+using namespace clang;
+using namespace clang::tooling;
+
+namespace aicr {
+
+namespace {
+
+// The leading block of `#include <...>` lines, skipping comments and blank
+// lines. A quoted include ends the block: those are project headers that
+// must stay visible to the analyzer rather than vanish into a PCH.
+std::string systemIncludePrefix(llvm::StringRef buf) {
+  std::string out;
+  while (!buf.empty()) {
+    buf = buf.ltrim();
+    if (buf.starts_with("//")) {
+      buf = buf.drop_until([](char c) { return c == '\n'; });
+      continue;
+    }
+    if (buf.starts_with("/*")) {
+      auto e = buf.find("*/");
+      if (e == llvm::StringRef::npos) break;
+      buf = buf.drop_front(e + 2);
+      continue;
+    }
+    if (!buf.starts_with("#")) break;
+    llvm::StringRef line = buf.take_until([](char c) { return c == '\n'; });
+    llvm::StringRef d = line.drop_front().ltrim();
+    if (!d.consume_front("include")) break;
+    if (!d.ltrim().starts_with("<")) break;
+    out += line.rtrim().str();
+    out += '\n';
+    buf = buf.drop_front(line.size());
+  }
+  return out;
+}
+
+// The command line minus everything naming this particular TU's input and
+// outputs, so TUs built the same way compare equal
+std::vector<std::string> sharedArgs(const CompileCommand& cmd) {
+  std::vector<std::string> out;
+  const auto& args = cmd.CommandLine;
+  for (size_t i = 1; i < args.size(); ++i) {
+    llvm::StringRef a = args[i];
+    if (a == cmd.Filename || a == "-c" || a == "-fsyntax-only" ||
+        a == "-MD" || a == "-MMD")
+      continue;
+    if (a == "-o" || a == "-MF" || a == "-MT" || a == "-MQ" || a == "-MJ") { ++i; continue; }
+    if (a.starts_with("-o") || a.starts_with("-MF") || a.starts_with("-MT") ||
+        a.starts_with("-MQ") || a.starts_with("-MJ"))
+      continue;
+    out.push_back(a.str());
+  }
+  return out;
+}
+
+uint64_t mtimeNs(const llvm::sys::fs::file_status& st) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           st.getLastModificationTime().time_since_epoch()).count();
+}
+
+// A PCH on disk is reused only while every file it was built from still has
+// the size and mtime recorded next to it. Clang would otherwise reject it
+// mid-parse with a hard error.
+bool depsUpToDate(const std::string& pch, const std::string& depsFile) {
+  if (!llvm::sys::fs::exists(pch)) return false;
+  std::ifstream in(depsFile);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string path; uint64_t size = 0, mtime = 0;
+    if (!std::getline(ls, path, '\t') || !(ls >> size >> mtime)) return false;
+    llvm::sys::fs::file_status st;
+    if (llvm::sys::fs::status(path, st) || st.getSize() != size || mtimeNs(st) != mtime)
+      return false;
+  }
+  return true;
+}
+
+class AllDepsCollector : public DependencyCollector {
+  bool needSystemDependencies() override { return true; }
+};
+
+class BuildPchAction : public GeneratePCHAction {
+  std::shared_ptr<AllDepsCollector> Collector;
+public:
+  explicit BuildPchAction(std::shared_ptr<AllDepsCollector> c) : Collector(std::move(c)) {}
+  bool BeginInvocation(CompilerInstance& CI) override {
+    CI.addDependencyCollector(Collector);
+    return GeneratePCHAction::BeginInvocation(CI);
+  }
+};
+
+struct Group {
+  CompileCommand cmd;          // representative command
+  std::string prefix;          // include block
+  std::string base;            // path stem inside the cache dir
+  bool c = false;              // C rather than C++
+  std::vector<std::string> members;
+};
+
+bool buildPch(const Group& g, const std::vector<std::string>& toolArgs) {
+  std::string header = g.base + (g.c ? ".h" : ".hpp");
+  std::string pch = g.base + ".pch";
+  std::string depsFile = g.base + ".deps";
+  {
+    std::ofstream ofs(header, std::ios::binary | std::ios::trunc);
+    if (!ofs) return false;
+    ofs << g.prefix;
+  }
+
+  // Same flags the TUs are parsed with, so Clang accepts the PCH for them
+  std::vector<std::string> argv{g.cmd.CommandLine.front()};
+  argv.insert(argv.end(), toolArgs.begin(), toolArgs.end());
+  auto shared = sharedArgs(g.cmd);
+  argv.insert(argv.end(), shared.begin(), shared.end());
+  argv.insert(argv.end(), {"-x", g.c ? "c-header" : "c++-header", header, "-o", pch});
+
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS = llvm::vfs::createPhysicalFileSystem();
+  FS->setCurrentWorkingDirectory(g.cmd.Directory);
+  IntrusiveRefCntPtr<FileManager> Files(new FileManager(FileSystemOptions(), FS));
+
+  auto collector = std::make_shared<AllDepsCollector>();
+  ToolInvocation Inv(argv, std::make_unique<BuildPchAction>(collector), Files.get(),
+                     std::make_shared<PCHContainerOperations>());
+  if (!Inv.run()) {
+    llvm::sys::fs::remove(pch);
+    return false;
+  }
+
+  std::ofstream deps(depsFile, std::ios::trunc);
+  for (const auto& d : collector->getDependencies()) {
+    llvm::SmallString<256> abs(d);
+    Files->makeAbsolutePath(abs);
+    llvm::sys::fs::file_status st;
+    if (llvm::sys::fs::status(abs, st)) continue;
+    deps << abs.str().str() << '\t' << st.getSize() << ' ' << mtimeNs(st) << '\n';
+  }
+  return true;
+}
+
+} // namespace
+
+PchCache::PchCache(std::string dir) : dir_(std::move(dir)) {
+  llvm::sys::fs::create_directories(dir_);
+}
+
+void PchCache::prepare(const CompilationDatabase& DB,
+                       const std::vector<std::string>& sources,
+                       const std::vector<std::string>& toolArgs,
+                       unsigned jobs) {
+  std::map<uint64_t, Group> groups; // ordered so builds are deterministic
+  for (const auto& src : sources) {
+    auto cmds = DB.getCompileCommands(src);
+    if (cmds.size() != 1) continue; // ambiguous which flags to precompile with
+
+    auto buf = llvm::MemoryBuffer::getFile(src, /*IsText=*/true);
+    if (!buf) continue;
+    std::string prefix = systemIncludePrefix((*buf)->getBuffer());
+    if (prefix.empty()) continue;
+
+    bool isC = llvm::sys::path::extension(src) == ".c";
+    std::string k;
+    llvm::raw_string_ostream os(k);
+    os << cmds.front().Directory << '\0' << isC << '\0' << prefix;
+    for (const auto& a : toolArgs) os << '\0' << a;
+    for (const auto& a : sharedArgs(cmds.front())) os << '\0' << a;
+    uint64_t key = llvm::xxHash64(os.str());
+
+    auto& g = groups[key];
+    if (g.members.empty()) {
+      g.cmd = cmds.front();
+      g.prefix = std::move(prefix);
+      g.c = isC;
+      llvm::SmallString<256> base(dir_);
+      llvm::sys::path::append(base, llvm::utohexstr(key, /*LowerCase=*/true));
+      llvm::sys::fs::make_absolute(base);
+      g.base = std::string(base.str());
+    }
+    g.members.push_back(src);
+  }
+
+  // A lone TU gains nothing from a PCH it would build and use once
+  std::vector<Group*> todo;
+  for (auto& [k, g] : groups)
+    if (g.members.size() >= 2) todo.push_back(&g);
+
+  std::vector<char> ok(todo.size(), 0);
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i = next++; i < todo.size(); i = next++) {
+      const Group& g = *todo[i];
+      ok[i] = depsUpToDate(g.base + ".pch", g.base + ".deps") || buildPch(g, toolArgs);
+    }
+  };
+  unsigned n = std::max(1u, std::min<unsigned>(jobs, todo.size()));
+  if (n == 1) {
+    work();
+  } else {
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < n; ++t) pool.emplace_back(work);
+    for (auto& th : pool) th.join();
+  }
+
+  for (size_t i = 0; i < todo.size(); ++i) {
+    if (!ok[i]) continue; // those TUs just parse their includes as usual
+    for (const auto& m : todo[i]->members) pchBySource_[m] = todo[i]->base + ".pch";
+  }
+}
+
+std::string PchCache::pchFor(const std::string& source) const {
+  auto it = pchBySource_.find(source);
+  return it == pchBySource_.end() ? std::string() : it->second;
+}
+
+} // namespace aicr
@@ -0,0 +1,369 @@
+#include "analyzers/RawScanner.hpp"
+
+#include "llvm/ADT/bit.h"
+#include "llvm/ADT/StringSwitch.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace aicr {
+
+namespace {
+
+bool isIdent(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '_' || c == '$';
+}
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+
+// Bytes the structural pass stops at; everything else is skipped in bulk
+bool isSpecial(char c) {
+  switch (c) {
+  case '{': case '}': case ';': case '"': case '\'': case '/': case '#': return true;
+  default: return false;
+  }
+}
+
+// Offset of the next special byte at or after i, or n. Function bodies are
+// most of the text and need nothing else, so this is the hot loop.
+size_t nextSpecial(const char* p, size_t i, size_t n) {
+#if defined(__SSE2__)
+  const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}'),
+                semi = _mm_set1_epi8(';'), dq = _mm_set1_epi8('"'),
+                sq = _mm_set1_epi8('\''), slash = _mm_set1_epi8('/'),
+                hash = _mm_set1_epi8('#');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close)),
+                   _mm_or_si128(_mm_cmpeq_epi8(v, semi), _mm_cmpeq_epi8(v, dq))),
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, slash)),
+                   _mm_cmpeq_epi8(v, hash)));
+    if (unsigned mask = (unsigned)_mm_movemask_epi8(m)) return i + llvm::countr_zero(mask);
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t open = vdupq_n_u8('{'), close = vdupq_n_u8('}'), semi = vdupq_n_u8(';'),
+                   dq = vdupq_n_u8('"'), sq = vdupq_n_u8('\''), slash = vdupq_n_u8('/'),
+                   hash = vdupq_n_u8('#');
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p + i));
+    uint8x16_t m = vorrq_u8(
+      vorrq_u8(vorrq_u8(vceqq_u8(v, open), vceqq_u8(v, close)),
+               vorrq_u8(vceqq_u8(v, semi), vceqq_u8(v, dq))),
+      vorrq_u8(vorrq_u8(vceqq_u8(v, sq), vceqq_u8(v, slash)), vceqq_u8(v, hash)));
+    // NEON has no movemask: narrowing each 16-bit lane by 4 bits leaves a
+    // nibble per byte, so the first match is the lowest set nibble
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (mask) return i + llvm::countr_zero(mask) / 4;
+  }
+#endif
+  for (; i < n; ++i)
+    if (isSpecial(p[i])) return i;
+  return n;
+}
+
+class Scanner {
+  llvm::StringRef T;
+  size_t N;
+  std::vector<size_t> Lines; // offset of each line start
+
+public:
+  explicit Scanner(llvm::StringRef text) : T(text), N(text.size()) {
+    Lines.push_back(0);
+    for (const char* p = T.data(); (p = (const char*)std::memchr(p, '\n', T.end() - p)); ++p)
+      Lines.push_back(p - T.data() + 1);
+  }
+
+  unsigned lineOf(size_t off) const {
+    return (unsigned)(std::upper_bound(Lines.begin(), Lines.end(), off) - Lines.begin());
+  }
+  unsigned columnOf(size_t off) const {
+    return (unsigned)(off - Lines[lineOf(off) - 1] + 1);
+  }
+
+  bool atLineStart(size_t i) const {
+    while (i > 0 && (T[i - 1] == ' ' || T[i - 1] == '\t')) --i;
+    return i == 0 || T[i - 1] == '\n';
+  }
+
+  size_t lineEnd(size_t i, bool continued) const {
+    while (i < N && T[i] != '\n') {
+      if (continued && T[i] == '\\' && i + 1 < N && T[i + 1] == '\n') ++i;
+      ++i;
+    }
+    return i;
+  }
+
+  // If i starts a comment, literal or preprocessor line, the offset just
+  // past it; otherwise i itself
+  size_t skipOpaque(size_t i) const {
+    char c = T[i];
+    if (c == '/' && i + 1 < N && T[i + 1] == '/') return lineEnd(i, false);
+    if (c == '/' && i + 1 < N && T[i + 1] == '*') {
+      size_t e = T.find("*/", i + 2);
+      return e == llvm::StringRef::npos ? N : e + 2;
+    }
+    if (c == '#' && atLineStart(i)) return lineEnd(i, true);
+    if (c == '"') {
+      if (i > 0 && T[i - 1] == 'R') {
+        size_t paren = T.find('(', i + 1);
+        if (paren != llvm::StringRef::npos && paren - i <= 17) {
+          std::string end = ")" + T.slice(i + 1, paren).str() + "\"";
+          size_t e = T.find(end, paren + 1);
+          return e == llvm::StringRef::npos ? N : e + end.size();
+        }
+      }
+      return skipQuoted(i, '"');
+    }
+    if (c == '\'') {
+      // 1'000'000: a digit separator, not a character literal
+      size_t b = i;
+      while (b > 0 && (isIdent(T[b - 1]) || T[b - 1] == '\'' || T[b - 1] == '.')) --b;
+      if (b < i && T[b] >= '0' && T[b] <= '9') return i + 1;
+      return skipQuoted(i, '\'');
+    }
+    return i;
+  }
+
+  size_t skipQuoted(size_t i, char q) const {
+    for (++i; i < N; ++i) {
+      if (T[i] == '\\') ++i;
+      else if (T[i] == q) return i + 1;
+      else if (T[i] == '\n') return i; // unterminated; resync at the newline
+    }
+    return N;
+  }
+
+  // First offset in [i, end) that isn't whitespace, a comment or a
+  // preprocessor line
+  size_t skipTrivia(size_t i, size_t end) const {
+    while (i < end) {
+      if (isSpace(T[i])) { ++i; continue; }
+      if (T[i] == '/' || T[i] == '#') {
+        size_t j = skipOpaque(i);
+        if (j != i) { i = j; continue; }
+      }
+      break;
+    }
+    return std::min(i, end);
+  }
+
+  struct Tok {
+    enum Kind { Ident, Punct, Group, Literal } kind;
+    llvm::StringRef text; // for groups, the whole bracketed range
+  };
+
+  // Rough tokens of a declaration head; bracketed groups are single tokens
+  std::vector<Tok> tokenize(size_t i, size_t end) const {
+    std::vector<Tok> out;
+    while ((i = skipTrivia(i, end)) < end) {
+      size_t b = i;
+      char c = T[i];
+      if (isIdent(c)) {
+        while (i < end && isIdent(T[i])) ++i;
+        out.push_back({Tok::Ident, T.slice(b, i)});
+      } else if (c == '"' || c == '\'') {
+        i = std::min(skipOpaque(i), end);
+        out.push_back({Tok::Literal, T.slice(b, i)});
+      } else if (c == '(' || c == '[' || c == '{') {
+        int depth = 0;
+        for (; i < end; ++i) {
+          char d = T[i];
+          if (d == '"' || d == '\'' || d == '/') {
+            size_t j = skipOpaque(i);
+            if (j != i) { i = j - 1; continue; }
+          }
+          if (d == '(' || d == '[' || d == '{') ++depth;
+          else if ((d == ')' || d == ']' || d == '}') && --depth == 0) { ++i; break; }
+        }
+        out.push_back({Tok::Group, T.slice(b, i)});
+      } else {
+        llvm::StringRef two = T.slice(i, std::min(i + 2, end));
+        size_t len = (two == "::" || two == "->" || two == "&&") ? 2 : 1;
+        i += len;
+        out.push_back({Tok::Punct, T.slice(b, i)});
+      }
+    }
+    return out;
+  }
+
+  // Name of the function whose parameter list is toks[k], or empty
+  static std::string nameBefore(const std::vector<Tok>& toks, size_t k) {
+    if (k == 0) return {};
+    const Tok& p = toks[k - 1];
+    auto isOperator = [&](size_t j) { return j < toks.size() && toks[j].kind == Tok::Ident &&
+                                             toks[j].text == "operator"; };
+    if (p.kind == Tok::Ident) {
+      bool keyword = llvm::StringSwitch<bool>(p.text)
+        .Cases("if", "while", "for", "switch", "catch", "return", "sizeof", true)
+        .Cases("decltype", "alignof", "alignas", "noexcept", "throw", "requires", true)
+        .Cases("static_assert", "__attribute__", "__declspec", "operator", true)
+        .Default(false);
+      if (keyword) return {};
+      if (k >= 2 && isOperator(k - 2)) return "operator " + p.text.str();
+      if (k >= 2 && toks[k - 2].text == "~") return "~" + p.text.str();
+      return p.text.str();
+    }
+    if (p.kind == Tok::Group && (p.text == "()" || p.text == "[]") && k >= 2 && isOperator(k - 2))
+      return "operator" + p.text.str();
+    if (p.kind == Tok::Punct) {
+      size_t j = k - 1;
+      std::string op;
+      while (toks[j].kind == Tok::Punct) {
+        op.insert(0, toks[j].text.str());
+        if (j == 0) return {};
+        --j;
+      }
+      if (isOperator(j)) return "operator" + op;
+    }
+    return {};
+  }
+
+  enum class Tail { None, Plain, Initializers };
+
+  // What may follow a definition's parameter list before its body
+  static Tail declaratorTail(const std::vector<Tok>& toks, size_t k) {
+    for (; k < toks.size(); ++k) {
+      const Tok& t = toks[k];
+      if (t.kind == Tok::Group && t.text.front() != '{') continue; // noexcept(...), [[...]]
+      if (t.kind == Tok::Punct) {
+        if (t.text == "->") return Tail::Plain; // trailing return type
+        if (t.text == ":") return Tail::Initializers;
+        if (t.text == "&" || t.text == "&&") continue;
+        return Tail::None;
+      }
+      if (t.kind != Tok::Ident) return Tail::None;
+      if (t.text == "requires") return Tail::Plain;
+      bool qualifier = llvm::StringSwitch<bool>(t.text)
+        .Cases("const", "volatile", "noexcept", "override", "final", "throw", true)
+        .Cases("mutable", "__attribute__", "__declspec", true)
+        .Default(false);
+      if (!qualifier) return Tail::None;
+    }
+    return Tail::Plain;
+  }
+
+  enum class Kind { Function, Container, Other };
+
+  // Decides what the brace at `brace` opens, given the declaration head
+  // starting at `head`
+  Kind classify(size_t head, size_t brace, RawFunction& fn) const {
+    size_t b = skipTrivia(head, brace);
+    // Access labels and template headers aren't part of a function's range
+    for (bool again = true; again;) {
+      again = false;
+      for (llvm::StringRef label : {"public", "protected", "private"}) {
+        if (!T.substr(b).starts_with(label)) continue;
+        size_t j = skipTrivia(b + label.size(), brace);
+        if (j < brace && T[j] == ':' && (j + 1 >= brace || T[j + 1] != ':')) {
+          b = skipTrivia(j + 1, brace);
+          again = true;
+        }
+      }
+      if (T.substr(b).starts_with("template")) {
+        size_t j = skipTrivia(b + 8, brace);
+        if (j < brace && T[j] == '<') {
+          int depth = 0;
+          for (; j < brace; ++j) {
+            if (T[j] == '<') ++depth;
+            else if (T[j] == '>' && --depth == 0) break;
+          }
+          b = skipTrivia(j + 1, brace);
+          again = true;
+        }
+      }
+    }
+    if (b >= brace) return Kind::Other;
+
+    auto toks = tokenize(b, brace);
+    for (size_t k = 0; k < toks.size(); ++k) {
+      if (toks[k].kind != Tok::Group || toks[k].text.front() != '(') continue;
+      std::string name = nameBefore(toks, k);
+      if (name.empty()) continue;
+      Tail tail = declaratorTail(toks, k + 1);
+      if (tail == Tail::None) continue;
+      // In `S() : a_{x}, b_(y) {`, a brace right after a member or base
+      // name is its initializer, not the body
+      if (tail == Tail::Initializers &&
+          (toks.back().kind == Tok::Ident || toks.back().text == ">"))
+        return Kind::Other;
+      fn.name = std::move(name);
+      fn.line = lineOf(b);
+      fn.column = columnOf(b);
+      return Kind::Function;
+    }
+    if (toks.empty() || toks[0].kind != Tok::Ident) return Kind::Other;
+    llvm::StringRef first = toks[0].text;
+    if (first == "namespace" || first == "class" || first == "struct" || first == "union")
+      return Kind::Container;
+    if (first == "inline" && toks.size() >= 2 && toks[1].text == "namespace")
+      return Kind::Container;
+    if (first == "extern" && toks.size() >= 2 && toks[1].kind == Tok::Literal)
+      return Kind::Container;
+    return Kind::Other;
+  }
+
+  std::vector<RawFunction> run() const {
+    struct Frame {
+      bool container;
+      size_t head;   // where the current declaration at this level starts
+      long fn = -1;  // the function whose body this is
+    };
+    std::vector<RawFunction> out;
+    std::vector<Frame> stack{{true, 0}};
+    const char* p = T.data();
+    for (size_t i = 0; (i = nextSpecial(p, i, N)) < N;) {
+      switch (p[i]) {
+      case ';':
+        stack.back().head = ++i;
+        break;
+      case '{': {
+        Frame f{false, 0};
+        if (stack.back().container) {
+          RawFunction fn;
+          Kind k = classify(stack.back().head, i, fn);
+          if (k == Kind::Function) { f.fn = (long)out.size(); out.push_back(std::move(fn)); }
+          f.container = k == Kind::Container;
+        }
+        f.head = ++i;
+        stack.push_back(f);
+        break;
+      }
+      case '}': {
+        ++i;
+        if (stack.size() == 1) { stack.back().head = i; break; } // unbalanced
+        Frame f = stack.back();
+        stack.pop_back();
+        if (f.fn >= 0) out[f.fn].endLine = lineOf(i - 1);
+        if (f.fn >= 0 || f.container) stack.back().head = i;
+        break;
+      }
+      default: {
+        size_t j = skipOpaque(i);
+        i = j == i ? i + 1 : j;
+        break;
+      }
+      }
+    }
+    // Bodies still open at the end of the file were misread
+    out.erase(std::remove_if(out.begin(), out.end(),
+                             [](const RawFunction& f) { return f.endLine == 0; }),
+              out.end());
+    return out;
+  }
+};
+
+} // namespace
+
+std::vector<RawFunction> scanFunctions(llvm::StringRef text) {
+  return Scanner(text).run();
+}
+
+} // namespace aicr
@@ -0,0 +1,31 @@
+#include "analyzers/Rule.hpp"
+#include <algorithm>
+
+namespace aicr {
+
+static std::vector<RuleInfo>& registry() {
+  static std::vector<RuleInfo> rules;
+  return rules;
+}
+
+void registerRule(RuleInfo info) {
+  auto& rules = registry();
+  auto pos = std::lower_bound(rules.begin(), rules.end(), info.id,
+                              [](const RuleInfo& r, const std::string& id) { return r.id < id; });
+  rules.insert(pos, std::move(info));
+}
+
+const std::vector<RuleInfo>& registeredRules() { return registry(); }
+
+void finishRuleFacts(const RuleFacts& facts, std::vector<Issue>& out) {
+  for (const auto& info : registry()) {
+    auto it = facts.find(info.id);
+    if (it == facts.end()) continue;
+    auto index = info.make()->makeIndex();
+    if (!index) continue;
+    for (const auto& f : it->second) index->add(f);
+    index->finish(out);
+  }
+}
+
+} // namespace aicr
@@ -0,0 +1,337 @@
+#include "analyzers/Rule.hpp"
+#include "cache/BinaryIO.hpp"
+
+#include "clang/AST/Expr.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+using namespace clang;
+
+namespace aicr {
+
+namespace {
+
+// MinHash signature of a fragment's features, compared band by band: two
+// fragments share a bucket when all rows of one band agree. With 8 bands of
+// 4 rows, pairs at 0.85 similarity meet in some bucket ~96% of the time,
+// pairs at 0.5 ~40%, and every candidate is checked on the full signature.
+constexpr unsigned kSigSize = 32;
+constexpr unsigned kBands = 8;
+constexpr unsigned kRows = kSigSize / kBands;
+constexpr unsigned kMinSimilar = 28; // of kSigSize rows, ~0.875
+
+// Hashes here end up in the cache and shard results, so they must not vary
+// between processes the way llvm::hash_combine may
+uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+uint64_t mix(uint64_t a, uint64_t b) { return mix(a ^ mix(b)); }
+
+enum class FragmentKind : uint8_t { Function, Block };
+
+// One function body or statement block, as DUPLICATE_CODE compares them
+struct Fragment {
+  std::string file;           // as issues name it
+  unsigned line = 0, column = 0;
+  unsigned begin = 0, end = 0; // byte offsets in file, for containment
+  uint32_t nodes = 0;
+  FragmentKind kind = FragmentKind::Function;
+  std::string name;           // function, or the one holding the block
+  uint64_t hash = 0;          // exact structure
+  uint64_t site = 0;          // for fingerprints, see Baseline.hpp
+  std::array<uint32_t, kSigSize> sig{};
+};
+
+void writeFragment(Writer& w, const Fragment& f) {
+  w.str(f.file); w.u32(f.line); w.u32(f.column); w.u32(f.begin); w.u32(f.end);
+  w.u32(f.nodes); w.u8((uint8_t)f.kind); w.str(f.name); w.u64(f.hash);
+  w.u64(f.site);
+  for (uint32_t v : f.sig) w.u32(v);
+}
+
+Fragment readFragment(Reader& r) {
+  Fragment f;
+  f.file = r.str(); f.line = r.u32(); f.column = r.u32(); f.begin = r.u32(); f.end = r.u32();
+  f.nodes = r.u32(); f.kind = (FragmentKind)r.u8(); f.name = r.str(); f.hash = r.u64();
+  f.site = r.u64();
+  for (auto& v : f.sig) v = r.u32();
+  return f;
+}
+
+// What a node is, without what it names: identifiers and literal values
+// don't count, operators and the kind of thing referred to do
+uint64_t nodeKind(const Stmt* S) {
+  uint64_t k = S->getStmtClass();
+  if (const auto* B = dyn_cast<BinaryOperator>(S)) k = mix(k, B->getOpcode());
+  else if (const auto* U = dyn_cast<UnaryOperator>(S)) k = mix(k, U->getOpcode());
+  else if (const auto* M = dyn_cast<MemberExpr>(S)) k = mix(k, M->isArrow());
+  else if (const auto* D = dyn_cast<DeclRefExpr>(S)) k = mix(k, D->getDecl()->getKind());
+  return k;
+}
+
+// Conversions and temporaries the source doesn't spell
+const Stmt* skipImplicit(const Stmt* S) {
+  if (const auto* E = dyn_cast_or_null<Expr>(S)) return E->IgnoreImplicit();
+  return S;
+}
+
+// Walks one function body in a single pass. Each node contributes a
+// feature, its kind and its children's, in postorder; a subtree's features
+// are then one contiguous range, so nested blocks get theirs for free.
+class Shingler {
+  const RuleContext& Ctx;
+  const SourceManager& SM;
+  unsigned MinNodes;
+  std::vector<uint64_t> Features;
+
+  struct Block { const CompoundStmt* S; size_t from, to; uint64_t hash; };
+  std::vector<Block> Blocks;
+
+  // Structural hash of S; counts its nodes into `nodes`
+  uint64_t walk(const Stmt* S, uint32_t& nodes) {
+    S = skipImplicit(S);
+    if (!S) return 0;
+    size_t from = Features.size();
+    uint64_t kind = nodeKind(S);
+    uint64_t hash = kind, shallow = kind;
+    uint32_t own = 1;
+    for (const Stmt* C : S->children()) {
+      if (!(C = skipImplicit(C))) continue;
+      hash = mix(hash, walk(C, own));
+      shallow = mix(shallow, nodeKind(C));
+    }
+    Features.push_back(shallow);
+    nodes += own;
+    if (const auto* CS = dyn_cast<CompoundStmt>(S); CS && own >= MinNodes)
+      Blocks.push_back({CS, from, Features.size(), hash});
+    return hash;
+  }
+
+public:
+  Shingler(const RuleContext& ctx, unsigned minNodes)
+    : Ctx(ctx), SM(ctx.SM), MinNodes(minNodes) {}
+
+  // The body as a whole, then every large enough block nested in it
+  void run(const FunctionDecl& FD, std::vector<Fragment>& out) {
+    Features.clear();
+    Blocks.clear();
+    uint32_t nodes = 0;
+    walk(FD.getBody(), nodes);
+    for (const auto& b : Blocks) {
+      Fragment f;
+      bool whole = b.S == FD.getBody();
+      f.kind = whole ? FragmentKind::Function : FragmentKind::Block;
+      if (!locate(whole ? FD.getSourceRange() : b.S->getSourceRange(), f)) continue;
+      f.name = FD.getNameAsString();
+      f.site = whole ? Ctx.site
+                     : siteHash(Ctx.sitePath, f.name,
+                                lineAround(SM.getBufferData(SM.getFileID(b.S->getBeginLoc())),
+                                           f.begin));
+      f.nodes = (uint32_t)(b.to - b.from);
+      f.hash = b.hash;
+      signature(b.from, b.to, f.sig);
+      out.push_back(std::move(f));
+    }
+  }
+
+private:
+  bool locate(SourceRange R, Fragment& f) const {
+    if (R.getBegin().isMacroID() || R.getEnd().isMacroID()) return false;
+    auto PL = SM.getPresumedLoc(R.getBegin());
+    if (PL.isInvalid() || SM.getFileID(R.getBegin()) != SM.getFileID(R.getEnd())) return false;
+    f.file = PL.getFilename();
+    f.line = PL.getLine();
+    f.column = PL.getColumn();
+    f.begin = SM.getFileOffset(R.getBegin());
+    f.end = SM.getFileOffset(R.getEnd());
+    return true;
+  }
+
+  // Features repeat within a fragment, so each is numbered by occurrence:
+  // a set then stands for the multiset
+  void signature(size_t from, size_t to, std::array<uint32_t, kSigSize>& sig) const {
+    sig.fill(UINT32_MAX);
+    llvm::DenseMap<uint64_t, unsigned> seen;
+    for (size_t i = from; i < to; ++i) {
+      uint64_t f = mix(Features[i], seen[Features[i]]++);
+      for (unsigned k = 0; k < kSigSize; ++k)
+        sig[k] = std::min(sig[k], (uint32_t)mix(f, k));
+    }
+  }
+};
+
+// Clone groups across the project. Fragments are kept compact, bucketed by
+// band once all are in, and joined with their bucket's first member when
+// their signatures agree; each fragment meets O(kBands) others, so the pass
+// stays linear.
+class DuplicateIndex final : public ProjectIndex {
+  std::mutex M;
+  std::vector<Fragment> Frags;
+
+public:
+  void add(llvm::StringRef facts) override {
+    Reader r(facts);
+    std::vector<Fragment> v;
+    uint32_t n = r.u32();
+    for (uint32_t i = 0; i < n && r.ok; ++i) v.push_back(readFragment(r));
+    if (!r.ok) return;
+    std::lock_guard<std::mutex> lock(M);
+    for (auto& f : v) Frags.push_back(std::move(f));
+  }
+
+  void finish(std::vector<Issue>& out) override {
+    // A file under several compile commands is seen more than once.
+    // Enclosing fragments sort before what they contain.
+    std::sort(Frags.begin(), Frags.end(), [](const Fragment& a, const Fragment& b) {
+      return std::tie(a.file, a.begin, b.end) < std::tie(b.file, b.begin, a.end);
+    });
+    Frags.erase(std::unique(Frags.begin(), Frags.end(),
+                            [](const Fragment& a, const Fragment& b) {
+                              return a.file == b.file && a.begin == b.begin && a.end == b.end;
+                            }),
+                Frags.end());
+
+    std::vector<size_t> parent(Frags.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&](size_t x) {
+      while (parent[x] != x) x = parent[x] = parent[parent[x]];
+      return x;
+    };
+
+    for (unsigned b = 0; b < kBands; ++b) {
+      std::unordered_map<uint64_t, size_t> first;
+      for (size_t i = 0; i < Frags.size(); ++i) {
+        uint64_t key = b;
+        for (unsigned k = b * kRows; k < (b + 1) * kRows; ++k) key = mix(key, Frags[i].sig[k]);
+        auto [it, inserted] = first.emplace(key, i);
+        if (inserted || !similar(Frags[it->second], Frags[i]) ||
+            contains(Frags[it->second], Frags[i]))
+          continue;
+        parent[find(i)] = find(it->second);
+      }
+    }
+
+    // A body that is mostly one block resembles it, and may be joined to it
+    // through others; only the outer one of the two is kept. Members are in
+    // file and offset order, so an enclosing one comes first.
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t i = 0; i < Frags.size(); ++i) {
+      auto& g = groups[find(i)];
+      if (g.empty() || !contains(Frags[g.back()], Frags[i])) g.push_back(i);
+    }
+    std::vector<std::vector<size_t>> clones;
+    for (auto& [root, members] : groups)
+      if (members.size() > 1) clones.push_back(std::move(members));
+
+    // Largest first; a group whose members all lie inside already reported
+    // clones (blocks of duplicated functions) adds nothing
+    auto size = [&](const std::vector<size_t>& g) {
+      uint32_t n = 0;
+      for (size_t i : g) n = std::max(n, Frags[i].nodes);
+      return n;
+    };
+    std::stable_sort(clones.begin(), clones.end(),
+                     [&](const auto& a, const auto& b) { return size(a) > size(b); });
+    llvm::StringMap<std::vector<std::pair<unsigned, unsigned>>> reported;
+    auto covered = [&](const Fragment& f) {
+      auto it = reported.find(f.file);
+      if (it == reported.end()) return false;
+      for (const auto& [b, e] : it->second)
+        if (b <= f.begin && f.end <= e) return true;
+      return false;
+    };
+    for (const auto& g : clones) {
+      if (std::all_of(g.begin(), g.end(), [&](size_t i) { return covered(Frags[i]); })) continue;
+      for (size_t i : g) reported[Frags[i].file].push_back({Frags[i].begin, Frags[i].end});
+      report(g, out);
+    }
+    Frags.clear();
+  }
+
+private:
+  static bool contains(const Fragment& outer, const Fragment& inner) {
+    return outer.file == inner.file && outer.begin <= inner.begin && inner.end <= outer.end;
+  }
+
+  static bool similar(const Fragment& a, const Fragment& b) {
+    if (a.hash == b.hash) return true;
+    unsigned same = 0;
+    for (unsigned k = 0; k < kSigSize; ++k) same += a.sig[k] == b.sig[k];
+    return same >= kMinSimilar;
+  }
+
+  void report(const std::vector<size_t>& g, std::vector<Issue>& out) const {
+    bool exact = std::all_of(g.begin(), g.end(),
+                             [&](size_t i) { return Frags[i].hash == Frags[g[0]].hash; });
+    for (size_t i : g) {
+      const Fragment& f = Frags[i];
+      std::string msg = f.kind == FragmentKind::Function
+                          ? "Function '" + f.name + "'"
+                          : "Block in '" + f.name + "' (" + std::to_string(f.nodes) + " nodes)";
+      msg += exact ? " duplicates " : " nearly duplicates ";
+      unsigned listed = 0;
+      for (size_t j : g) {
+        if (j == i) continue;
+        if (listed == 3) {
+          msg += " and " + std::to_string(g.size() - 1 - listed) + " more";
+          break;
+        }
+        if (listed++) msg += ", ";
+        msg += Frags[j].file + ":" + std::to_string(Frags[j].line);
+      }
+      Issue is;
+      is.id = "DUPLICATE_CODE";
+      is.severity = Severity::Warning;
+      is.message = std::move(msg);
+      is.file = f.file;
+      is.line = f.line; is.column = f.column;
+      is.fingerprint = issueFingerprint("DUPLICATE_CODE", f.site);
+      out.push_back(std::move(is));
+    }
+  }
+};
+
+class DuplicateCodeRule final : public Rule {
+  std::vector<Fragment> Frags; // this TU's so far
+
+public:
+  const char* id() const override { return "DUPLICATE_CODE"; }
+  unsigned kinds() const override { return kindBit(NodeKind::FunctionDefinition); }
+  unsigned needs() const override { return NeedsBodies; }
+
+  void checkFunction(const FunctionDecl& FD, RuleContext& Ctx) override {
+    if (!FD.getBody()) return;
+    Shingler(Ctx, std::max(1u, Ctx.opts.duplicateMinNodes)).run(FD, Frags);
+  }
+
+  std::unique_ptr<ProjectIndex> makeIndex() const override {
+    return std::make_unique<DuplicateIndex>();
+  }
+
+  std::string takeFacts() override {
+    Writer w;
+    w.u32((uint32_t)Frags.size());
+    for (const auto& f : Frags) writeFragment(w, f);
+    Frags.clear();
+    return std::move(w.buf);
+  }
+};
+
+RegisterRule<DuplicateCodeRule> X("DUPLICATE_CODE");
+
+} // namespace
+
+} // namespace aicr
@@ -0,0 +1,55 @@
+#include "analyzers/RawScanner.hpp"
+#include "analyzers/Rule.hpp"
+
+using namespace clang;
+
+namespace aicr {
+
+namespace {
+
+unsigned locSpan(const SourceManager& SM, SourceRange SR) {
+  auto b = SM.getSpellingLineNumber(SR.getBegin());
+  auto e = SM.getSpellingLineNumber(SR.getEnd());
+  if (e < b) return 0;
+  return (unsigned)(e - b + 1);
+}
+
+std::string message(const std::string& name, unsigned lines, int threshold) {
+  return "Function '" + name + "' is " + std::to_string(lines) +
+         " lines (threshold " + std::to_string(threshold) + ")";
+}
+
+class LongFunctionRule final : public Rule {
+public:
+  const char* id() const override { return "LONG_FUNC"; }
+  unsigned kinds() const override { return kindBit(NodeKind::FunctionDefinition); }
+  unsigned needs() const override { return NeedsBodies; }
+  bool scansRaw() const override { return true; }
+
+  void checkFunction(const FunctionDecl& FD, RuleContext& Ctx) override {
+    unsigned lines = locSpan(Ctx.SM, FD.getSourceRange());
+    if ((int)lines < Ctx.opts.longFunctionLineThreshold) return;
+    Ctx.out.push_back(Ctx.makeIssue(
+      "LONG_FUNC", Severity::Warning,
+      message(FD.getNameAsString(), lines, Ctx.opts.longFunctionLineThreshold),
+      FD.getBeginLoc()));
+  }
+
+  // Same spans from brace matching, for runs where no rule needs a parse
+  void checkRaw(RawContext& Ctx) override {
+    for (const auto& fn : scanFunctions(Ctx.text)) {
+      unsigned lines = fn.endLine - fn.line + 1;
+      if ((int)lines < Ctx.opts.longFunctionLineThreshold) continue;
+      Ctx.out.push_back(Ctx.makeIssue(
+        "LONG_FUNC", Severity::Warning,
+        message(fn.name, lines, Ctx.opts.longFunctionLineThreshold), fn.line, fn.column,
+        fn.name));
+    }
+  }
+};
+
+RegisterRule<LongFunctionRule> X("LONG_FUNC");
+
+} // namespace
+
+} // namespace aicr
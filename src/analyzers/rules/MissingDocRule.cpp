@@ -0,0 +1,58 @@
+#include "analyzers/Rule.hpp"
+#include "ai/AiEngine.hpp"
+
+#include "clang/AST/RawCommentList.h"
+
+using namespace clang;
+
+namespace aicr {
+
+namespace {
+
+class MissingDocRule final : public Rule {
+public:
+  const char* id() const override { return "MISSING_DOC"; }
+  unsigned kinds() const override { return kindBit(NodeKind::FunctionDefinition); }
+  // Only the declaration and the comment before it are looked at
+  unsigned needs() const override { return NeedsComments; }
+
+  void checkFunction(const FunctionDecl& FD, RuleContext& Ctx) override {
+    // Clang 18+ use ASTContext to check raw comments
+    const RawComment* RC = Ctx.AST.getRawCommentForDeclNoCache(&FD);
+    if (RC) return; // already documented
+
+    Issue is = Ctx.makeIssue("MISSING_DOC", Severity::Info,
+                             "Missing API docs for function '" + FD.getNameAsString() + "'",
+                             FD.getBeginLoc());
+
+    if (Ctx.opts.suggestDocs && Ctx.ai) {
+      std::string sig = FD.getReturnType().getAsString() + std::string(" ") + FD.getNameAsString() + "(";
+      for (unsigned i = 0; i < FD.getNumParams(); ++i) {
+        if (i) sig += ", ";
+        sig += FD.getParamDecl(i)->getType().getAsString();
+      }
+      sig += ")";
+      // Insert doc immediately before function
+      unsigned Off = Ctx.SM.getFileOffset(FD.getSourceRange().getBegin());
+      Ctx.ai->docForSignature(Ctx.out, std::move(is), sig,
+        [Off](const std::optional<std::string>& doc, Issue& slot) {
+          if (!doc) return;
+          FixIt fx;
+          fx.file = slot.file;
+          fx.offset = Off;
+          fx.length = 0;
+          fx.replacement = *doc;
+          fx.note = "Insert Doxygen stub";
+          slot.fixes.push_back(std::move(fx));
+        });
+      return;
+    }
+    Ctx.out.push_back(std::move(is));
+  }
+};
+
+RegisterRule<MissingDocRule> X("MISSING_DOC");
+
+} // namespace
+
+} // namespace aicr
@@ -0,0 +1,62 @@
+#include "analyzers/Rule.hpp"
+#include "ai/AiEngine.hpp"
+#include "index/SymbolIndex.hpp"
+
+#include "clang/Lex/Lexer.h"
+
+using namespace clang;
+
+namespace aicr {
+
+namespace {
+
+class WeakVarNameRule final : public Rule {
+public:
+  const char* id() const override { return "WEAK_NAME"; }
+  unsigned kinds() const override { return kindBit(NodeKind::Variable); }
+  unsigned needs() const override { return NeedsBodies | NeedsSymbols; }
+
+  // Every issue carries a suggested name, so without one there's nothing
+  bool active(const AnalyzeOptions& opts, bool haveAi) const override {
+    return haveAi && opts.suggestBetterVarNames;
+  }
+
+  void checkVariable(const VarDecl& VD, RuleContext& Ctx) override {
+    if (!VD.isLocalVarDeclOrParm()) return;
+    auto name = VD.getNameAsString();
+    if (name == "i" || name == "j" || name == "k") return;
+    if (!Ctx.ai || !Ctx.ai->mayRename(name)) return;
+
+    IdentifierQuery q;
+    q.current = name;
+    q.typeHint = VD.getType().getAsString();
+    q.usageHint = VD.isConstexpr() ? "const" : (VD.getType().isConstQualified() ? "const" : "");
+
+    // The message needs the suggestion, so only the location is known yet
+    Issue is = Ctx.makeIssue("WEAK_NAME", Severity::Info, "", VD.getLocation());
+
+    // The fix names the declaration token; under --fix the analyzer widens
+    // it to every reference the symbol index saw
+    std::string usr = Ctx.opts.fix ? symbolUsr(VD, Ctx.SM) : std::string();
+    SourceLocation NameLoc = VD.getLocation();
+    auto TokRange = CharSourceRange::getTokenRange(NameLoc, NameLoc);
+    unsigned BegOff = Ctx.SM.getFileOffset(TokRange.getBegin());
+    unsigned Len = Lexer::MeasureTokenLength(NameLoc, Ctx.SM, Ctx.AST.getLangOpts());
+
+    Ctx.ai->suggestIdentifier(Ctx.out, std::move(is), q,
+      [name, BegOff, Len, usr](const std::optional<std::string>& suggestion, Issue& slot) {
+        if (!suggestion) { slot.id.clear(); return; }
+        slot.message = "Variable '" + name + "' could be clearer, e.g. '" + *suggestion + "'";
+        FixIt fx; fx.file = slot.file; fx.offset = BegOff; fx.length = Len; fx.replacement = *suggestion;
+        fx.note = "Rename declaration and references";
+        fx.symbol = usr;
+        slot.fixes.push_back(std::move(fx));
+      });
+  }
+};
+
+RegisterRule<WeakVarNameRule> X("WEAK_NAME");
+
+} // namespace
+
+} // namespace aicr
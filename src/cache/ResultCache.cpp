@@ -0,0 +1,176 @@
+#include "cache/ResultCache.hpp"
+#include "cache/BinaryIO.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+namespace aicr {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x52434941; // "AICR"
+constexpr uint32_t kVersion = 4;
+
+void writeIssues(Writer& w, const std::vector<Issue>& v) {
+  w.u32((uint32_t)v.size());
+  for (const auto& is : v) writeIssue(w, is);
+}
+
+std::vector<Issue> readIssues(Reader& r) {
+  std::vector<Issue> v;
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) v.push_back(readIssue(r));
+  return v;
+}
+
+} // namespace
+
+ResultCache::ResultCache(std::string dir, uint64_t maxBytes)
+  : dir_(std::move(dir)), maxBytes_(maxBytes) {
+  llvm::sys::fs::create_directories(dir_);
+}
+
+std::string ResultCache::entryPath(const std::string& tu) const {
+  llvm::SmallString<256> p(dir_);
+  llvm::sys::path::append(p, llvm::utohexstr(llvm::xxHash64(tu), /*LowerCase=*/true) + ".aicr");
+  return std::string(p.str());
+}
+
+ResultCache::FileState ResultCache::stateOf(const std::string& path, bool needHash) {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = current_.find(path);
+    if (it != current_.end() && (it->second.hashed || !needHash || !it->second.exists))
+      return it->second;
+  }
+
+  FileState st;
+  llvm::sys::fs::file_status status;
+  if (!llvm::sys::fs::status(path, status)) {
+    st.exists = true;
+    st.size = status.getSize();
+    st.mtime = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 status.getLastModificationTime().time_since_epoch()).count();
+    if (needHash) {
+      auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                             /*RequiresNullTerminator=*/false);
+      if (buf) { st.hash = llvm::xxHash64((*buf)->getBuffer()); st.hashed = true; }
+      else st.exists = false;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_);
+  current_[path] = st;
+  return st;
+}
+
+bool ResultCache::describe(CachedDep& dep) {
+  FileState st = stateOf(dep.path, /*needHash=*/true);
+  if (!st.exists) return false;
+  dep.size = st.size; dep.mtime = st.mtime; dep.hash = st.hash;
+  return true;
+}
+
+// Same size and mtime is taken as unchanged; otherwise fall back to content,
+// so a touched-but-identical file still hits.
+bool ResultCache::depUnchanged(const CachedDep& dep) {
+  FileState st = stateOf(dep.path, /*needHash=*/false);
+  if (!st.exists || st.size != dep.size) return false;
+  if (st.mtime == dep.mtime) return true;
+  st = stateOf(dep.path, /*needHash=*/true);
+  return st.exists && st.hash == dep.hash;
+}
+
+std::optional<CacheEntry> ResultCache::lookup(const std::string& tu, uint64_t key) {
+  std::string path = entryPath(tu);
+  auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf) return std::nullopt;
+
+  auto data = (*buf)->getBuffer();
+  Reader r(data);
+  if (r.u32() != kMagic || r.u32() != kVersion || r.u64() != key || !r.ok)
+    return std::nullopt;
+  if (r.str() != tu) return std::nullopt; // file name hash collision
+
+  CacheEntry e;
+  uint32_t ndeps = r.u32();
+  for (uint32_t i = 0; i < ndeps && r.ok; ++i) {
+    CachedDep d;
+    d.path = r.str(); d.size = r.u64(); d.mtime = r.u64(); d.hash = r.u64();
+    d.candidate = r.u8() != 0;
+    // Bail out on the first stale dependency before decoding any issues
+    if (!r.ok || !depUnchanged(d)) return std::nullopt;
+    e.deps.push_back(std::move(d));
+  }
+  e.main = readIssues(r);
+  uint32_t nheaders = r.u32();
+  for (uint32_t i = 0; i < nheaders && r.ok; ++i) {
+    std::string h = r.str();
+    e.headers[h] = readIssues(r);
+  }
+  uint32_t nfacts = r.u32();
+  for (uint32_t i = 0; i < nfacts && r.ok; ++i) {
+    std::string id = r.str();
+    e.facts[id] = r.str();
+  }
+  if (!r.ok) return std::nullopt;
+
+  // Mark as recently used for eviction
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  return e;
+}
+
+bool ResultCache::store(const std::string& tu, uint64_t key, const CacheEntry& e) {
+  Writer w;
+  w.u32(kMagic); w.u32(kVersion); w.u64(key); w.str(tu);
+  w.u32((uint32_t)e.deps.size());
+  for (const auto& d : e.deps) {
+    w.str(d.path); w.u64(d.size); w.u64(d.mtime); w.u64(d.hash); w.u8(d.candidate ? 1 : 0);
+  }
+  writeIssues(w, e.main);
+  w.u32((uint32_t)e.headers.size());
+  for (const auto& [h, v] : e.headers) { w.str(h); writeIssues(w, v); }
+  w.u32((uint32_t)e.facts.size());
+  for (const auto& [id, f] : e.facts) { w.str(id); w.str(f); }
+
+  return writeFileAtomic(entryPath(tu), w.buf);
+}
+
+void ResultCache::evict() {
+  struct Item { fs::path path; uint64_t size; fs::file_time_type when; };
+  std::vector<Item> items;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (auto& e : fs::directory_iterator(dir_, ec)) {
+    if (e.path().extension() != ".aicr") continue;
+    std::error_code ec2;
+    uint64_t sz = e.file_size(ec2);
+    auto when = e.last_write_time(ec2);
+    if (ec2) continue;
+    items.push_back({e.path(), sz, when});
+    total += sz;
+  }
+  if (total <= maxBytes_) return;
+
+  std::sort(items.begin(), items.end(),
+            [](const Item& a, const Item& b) { return a.when < b.when; });
+  for (const auto& it : items) {
+    if (total <= maxBytes_) break;
+    std::error_code ec2;
+    if (fs::remove(it.path, ec2)) total -= it.size;
+  }
+}
+
+} // namespace aicr
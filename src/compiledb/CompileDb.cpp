@@ -0,0 +1,559 @@
+#include "compiledb/CompileDb.hpp"
+#include "cache/BinaryIO.hpp"
+#include "discovery/FileDiscovery.hpp"
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Driver/Driver.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ConvertUTF.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+
+using namespace clang::tooling;
+
+namespace aicr {
+
+namespace {
+
+constexpr uint32_t kIndexMagic = 0x44434941; // "AICD"
+constexpr uint32_t kIndexVersion = 1;
+
+bool isHeaderPath(llvm::StringRef path) {
+  auto ext = llvm::sys::path::extension(path);
+  return ext == ".h" || ext == ".hh" || ext == ".hpp" || ext == ".hxx";
+}
+
+// Absolute, dot-free spelling used as the index key
+std::string normalize(llvm::StringRef path, llvm::StringRef dir = "") {
+  llvm::SmallString<256> p(path);
+  if (!llvm::sys::path::is_absolute(p)) {
+    if (!dir.empty()) {
+      llvm::SmallString<256> d(dir);
+      llvm::sys::path::append(d, p);
+      p = d;
+    }
+    llvm::sys::fs::make_absolute(p);
+  }
+  llvm::sys::path::remove_dots(p, /*remove_dot_dot=*/true);
+  llvm::sys::path::native(p);
+  return std::string(p.str());
+}
+
+uint64_t mtimeNs(const llvm::sys::fs::file_status& st) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           st.getLastModificationTime().time_since_epoch()).count();
+}
+
+// Just enough JSON to find the top-level objects of compile_commands.json
+// and pull "file" and "directory" out of each, without building a tree.
+class Scanner {
+  const char* B;
+  const char* P;
+  const char* E;
+
+public:
+  bool ok = true;
+
+  explicit Scanner(llvm::StringRef buf) : B(buf.begin()), P(buf.begin()), E(buf.end()) {}
+
+  size_t offset() const { return P - B; }
+
+  void ws() {
+    while (P < E && (*P == ' ' || *P == '\n' || *P == '\r' || *P == '\t')) ++P;
+  }
+
+  bool eat(char c) {
+    ws();
+    if (P < E && *P == c) { ++P; return true; }
+    return false;
+  }
+
+  bool fail() { ok = false; return false; }
+
+  // Reads a string at the cursor, unescaped into `out` when non-null
+  bool string(std::string* out) {
+    if (!eat('"')) return fail();
+    while (P < E && *P != '"') {
+      if (*P != '\\') {
+        const char* run = P;
+        while (P < E && *P != '"' && *P != '\\') ++P;
+        if (out) out->append(run, P);
+        continue;
+      }
+      if (++P == E) return fail();
+      char c = *P++;
+      if (!out && c != 'u') continue;
+      switch (c) {
+      case 'b': *out += '\b'; break;
+      case 'f': *out += '\f'; break;
+      case 'n': *out += '\n'; break;
+      case 'r': *out += '\r'; break;
+      case 't': *out += '\t'; break;
+      case 'u': {
+        if (E - P < 4) return fail();
+        unsigned cp = 0;
+        if (llvm::StringRef(P, 4).getAsInteger(16, cp)) return fail();
+        P += 4;
+        if (cp >= 0xD800 && cp < 0xDC00 && E - P >= 6 && P[0] == '\\' && P[1] == 'u') {
+          unsigned lo = 0;
+          if (!llvm::StringRef(P + 2, 4).getAsInteger(16, lo) && lo >= 0xDC00 && lo < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            P += 6;
+          }
+        }
+        if (out) {
+          char buf[UNI_MAX_UTF8_BYTES_PER_CODE_POINT];
+          char* end = buf;
+          if (llvm::ConvertCodePointToUTF8(cp, end)) out->append(buf, end);
+        }
+        break;
+      }
+      default: *out += c; break; // \" \\ \/
+      }
+    }
+    if (P == E) return fail();
+    ++P;
+    return true;
+  }
+
+  // Skips one value of any kind
+  bool skip() {
+    ws();
+    if (P == E) return fail();
+    if (*P == '"') return string(nullptr);
+    if (*P == '{' || *P == '[') {
+      int depth = 0;
+      while (P < E) {
+        char c = *P;
+        if (c == '"') {
+          if (!string(nullptr)) return false;
+          continue;
+        }
+        ++P;
+        if (c == '{' || c == '[') ++depth;
+        else if ((c == '}' || c == ']') && --depth == 0) return true;
+      }
+      return fail();
+    }
+    while (P < E && *P != ',' && *P != '}' && *P != ']' && *P != ' ' &&
+           *P != '\n' && *P != '\r' && *P != '\t')
+      ++P;
+    return true;
+  }
+};
+
+// The command line of one entry. "arguments" is used as is; "command" is
+// split with shell rules.
+std::optional<CompileCommand> decode(llvm::StringRef object) {
+  auto v = llvm::json::parse(object);
+  if (!v) {
+    llvm::consumeError(v.takeError());
+    return std::nullopt;
+  }
+  const auto* o = v->getAsObject();
+  if (!o) return std::nullopt;
+  auto dir = o->getString("directory");
+  auto file = o->getString("file");
+  if (!dir || !file) return std::nullopt;
+
+  std::vector<std::string> args;
+  if (const auto* a = o->getArray("arguments")) {
+    for (const auto& x : *a)
+      if (auto s = x.getAsString()) args.push_back(s->str());
+  } else if (auto cmd = o->getString("command")) {
+    llvm::BumpPtrAllocator A;
+    llvm::StringSaver Saver(A);
+    llvm::SmallVector<const char*, 64> argv;
+    llvm::cl::TokenizeGNUCommandLine(*cmd, Saver, argv);
+    for (const char* s : argv) args.emplace_back(s);
+  }
+  if (args.empty()) return std::nullopt;
+  std::string output = o->getString("output").value_or("").str();
+  return CompileCommand(*dir, *file, std::move(args), std::move(output));
+}
+
+} // namespace
+
+struct IndexedCompilationDatabase::Impl {
+  struct Entry {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  std::string Path;
+  std::unique_ptr<llvm::MemoryBuffer> Json;
+  std::vector<Entry> Entries;
+  llvm::StringMap<llvm::SmallVector<uint32_t, 1>> Index; // normalized path → entries
+  std::vector<std::string> Sorted;                        // Index keys, sorted
+
+  mutable std::mutex M;
+  mutable std::unique_ptr<llvm::StringMap<std::string>> RealToKey; // built on first miss
+  mutable llvm::StringMap<std::vector<CompileCommand>> Inferred;
+
+  void add(std::string key, Entry e) {
+    Index[key].push_back((uint32_t)Entries.size());
+    Entries.push_back(e);
+  }
+
+  bool scan(std::string& error) {
+    Scanner S(Json->getBuffer());
+    if (!S.eat('[')) {
+      error = Path + ": expected a JSON array";
+      return false;
+    }
+    if (S.eat(']')) return true;
+    do {
+      S.ws();
+      Entry e;
+      e.offset = S.offset();
+      if (!S.eat('{')) break;
+      std::string file, dir;
+      if (!S.eat('}')) {
+        do {
+          std::string key;
+          if (!S.string(&key) || !S.eat(':')) break;
+          if (key == "file") S.string(&file);
+          else if (key == "directory") S.string(&dir);
+          else S.skip();
+        } while (S.ok && S.eat(','));
+        if (!S.eat('}')) S.fail();
+      }
+      if (!S.ok) break;
+      e.length = (uint32_t)(S.offset() - e.offset);
+      if (!file.empty()) add(normalize(file, dir), e);
+    } while (S.eat(','));
+    if (!S.ok || !S.eat(']')) {
+      error = Path + ": malformed JSON near byte " + std::to_string(S.offset());
+      return false;
+    }
+    return true;
+  }
+
+  std::string indexPath(const std::string& cacheDir) const {
+    llvm::SmallString<256> p(cacheDir);
+    llvm::sys::path::append(p, "compdb-" + llvm::utohexstr(llvm::xxHash64(Path)) + ".idx");
+    return std::string(p.str());
+  }
+
+  bool readIndex(const std::string& file, uint64_t size, uint64_t mtime) {
+    auto buf = llvm::MemoryBuffer::getFile(file, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (!buf) return false;
+    Reader r((*buf)->getBuffer());
+    if (r.u32() != kIndexMagic || r.u32() != kIndexVersion) return false;
+    if (r.ref() != Path || r.u64() != size || r.u64() != mtime || !r.ok) return false;
+    uint32_t n = r.u32();
+    Entries.reserve(n);
+    for (uint32_t i = 0; i < n && r.ok; ++i) {
+      llvm::StringRef key = r.ref();
+      Entry e;
+      e.offset = r.u64();
+      e.length = r.u32();
+      if (e.offset + e.length > Json->getBufferSize()) r.ok = false;
+      if (r.ok) add(key.str(), e);
+    }
+    if (r.ok) return true;
+    Entries.clear();
+    Index.clear();
+    return false;
+  }
+
+  void writeIndex(const std::string& file, uint64_t size, uint64_t mtime) const {
+    Writer w;
+    w.u32(kIndexMagic); w.u32(kIndexVersion);
+    w.str(Path); w.u64(size); w.u64(mtime);
+    w.u32((uint32_t)Entries.size());
+    // Entry order is preserved so multiple commands for a file keep theirs
+    std::vector<llvm::StringRef> keyOf(Entries.size());
+    for (const auto& kv : Index)
+      for (uint32_t i : kv.second) keyOf[i] = kv.first();
+    for (size_t i = 0; i < Entries.size(); ++i) {
+      w.str(keyOf[i]); w.u64(Entries[i].offset); w.u32(Entries[i].length);
+    }
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(file));
+    writeFileAtomic(file, w.buf);
+  }
+
+  std::vector<CompileCommand> commandsFor(llvm::StringRef key) const {
+    std::vector<CompileCommand> out;
+    auto it = Index.find(key);
+    if (it == Index.end()) return out;
+    for (uint32_t i : it->second) {
+      const Entry& e = Entries[i];
+      if (auto cmd = decode(Json->getBuffer().substr(e.offset, e.length)))
+        out.push_back(std::move(*cmd));
+    }
+    return out;
+  }
+
+  // Index key for a path spelled differently from the database, e.g.
+  // through a symlink. Every entry's real path is resolved once, lazily.
+  std::string keyByRealPath(const std::string& key) const {
+    llvm::SmallString<256> real;
+    if (llvm::sys::fs::real_path(key, real)) return {};
+    if (!RealToKey) {
+      RealToKey = std::make_unique<llvm::StringMap<std::string>>();
+      for (const auto& k : Sorted) {
+        llvm::SmallString<256> r;
+        if (!llvm::sys::fs::real_path(k, r)) RealToKey->try_emplace(r, k);
+      }
+    }
+    auto it = RealToKey->find(real);
+    return it == RealToKey->end() ? std::string() : it->second;
+  }
+
+  // The TU a header most likely belongs to: a same-stem source next to it,
+  // else the first source in the closest enclosing directory whose text
+  // includes the header by name, else simply the closest source.
+  std::string includingTU(const std::string& header) const {
+    llvm::StringRef name = llvm::sys::path::filename(header);
+    llvm::StringRef stem = llvm::sys::path::stem(header);
+    llvm::StringRef dir = llvm::sys::path::parent_path(header);
+
+    for (const char* ext : {".cpp", ".cc", ".cxx", ".c"}) {
+      llvm::SmallString<256> sib(dir);
+      llvm::sys::path::append(sib, stem + ext);
+      if (Index.count(sib)) return std::string(sib.str());
+    }
+
+    // Nearest directories first; each level only reads the TUs the one
+    // below it didn't
+    constexpr size_t kMaxScanned = 64;
+    size_t scanned = 0;
+    auto seenLo = Sorted.end(), seenHi = Sorted.end();
+    for (llvm::StringRef d = dir; !d.empty() && scanned < kMaxScanned;
+         d = llvm::sys::path::parent_path(d)) {
+      std::string prefix = (d + llvm::sys::path::get_separator()).str();
+      auto lo = std::lower_bound(Sorted.begin(), Sorted.end(), prefix);
+      auto hi = lo;
+      while (hi != Sorted.end() && llvm::StringRef(*hi).starts_with(prefix)) ++hi;
+      for (auto it = lo; it != hi && scanned < kMaxScanned; ++it) {
+        if (it == seenLo) {
+          it = seenHi - 1;
+          continue;
+        }
+        if (isHeaderPath(*it)) continue;
+        ++scanned;
+        auto buf = llvm::MemoryBuffer::getFile(*it, /*IsText=*/false,
+                                               /*RequiresNullTerminator=*/false);
+        if (buf && includes((*buf)->getBuffer(), name)) return *it;
+      }
+      if (lo != hi) { seenLo = lo; seenHi = hi; }
+      if (d == llvm::sys::path::root_path(d)) break;
+    }
+    return {};
+  }
+
+  // Whether `text` has an #include of a file named exactly `name`, in any
+  // directory
+  static bool includes(llvm::StringRef text, llvm::StringRef name) {
+    for (size_t at = text.find(name); at != llvm::StringRef::npos; at = text.find(name, at + 1)) {
+      size_t end = at + name.size();
+      if (at == 0 || end == text.size()) continue;
+      char before = text[at - 1], after = text[end];
+      if (before != '"' && before != '<' && before != '/' && before != '\\') continue;
+      if (after != '"' && after != '>') continue;
+      size_t bol = text.rfind('\n', at);
+      llvm::StringRef line = text.slice(bol == llvm::StringRef::npos ? 0 : bol + 1, at).ltrim();
+      if (!line.consume_front("#")) continue;
+      line = line.ltrim();
+      if (line.consume_front("include") || line.consume_front("import")) {
+        line.consume_front("_next");
+        line = line.ltrim();
+        if (line.starts_with("\"") || line.starts_with("<")) return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<CompileCommand> inferForHeader(const std::string& header) const {
+    std::string tu = includingTU(header);
+    std::vector<CompileCommand> out;
+    if (tu.empty()) return out;
+    for (auto cmd : commandsFor(tu)) {
+      bool isC = llvm::sys::path::extension(tu) == ".c";
+      std::vector<std::string> args;
+      args.push_back(cmd.CommandLine.front());
+      args.push_back("-x");
+      args.push_back(isC ? "c-header" : "c++-header");
+      auto& cl = cmd.CommandLine;
+      for (size_t i = 1; i < cl.size(); ++i) {
+        llvm::StringRef a = cl[i];
+        if (a == "-o" || a == "-x") { ++i; continue; }
+        // Joined forms, -o<file> and -x<lang>; other flags start with -o too
+        if (a.starts_with("-o") && a.size() > 2) {
+          llvm::StringRef out = a.drop_front(2);
+          auto ext = llvm::sys::path::extension(out);
+          if (out == cmd.Output || ext == ".o" || ext == ".obj") continue;
+        }
+        if (a.starts_with("-x") && a.size() > 2) continue;
+        if (a == cmd.Filename || normalize(a, cmd.Directory) == tu) {
+          args.push_back(header);
+          continue;
+        }
+        args.push_back(a.str());
+      }
+      CompileCommand h(cmd.Directory, header, std::move(args), "");
+      h.Heuristic = "inferred from " + tu;
+      out.push_back(std::move(h));
+    }
+    return out;
+  }
+};
+
+IndexedCompilationDatabase::IndexedCompilationDatabase(std::unique_ptr<Impl> impl)
+  : I(std::move(impl)) {}
+
+IndexedCompilationDatabase::~IndexedCompilationDatabase() = default;
+
+std::unique_ptr<IndexedCompilationDatabase>
+IndexedCompilationDatabase::loadFromFile(const std::string& jsonPath,
+                                         const std::string& cacheDir,
+                                         std::string& error) {
+  auto impl = std::make_unique<Impl>();
+  impl->Path = normalize(jsonPath);
+  auto buf = llvm::MemoryBuffer::getFile(impl->Path, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf) {
+    error = "Cannot read " + impl->Path + ": " + buf.getError().message();
+    return nullptr;
+  }
+  impl->Json = std::move(*buf);
+
+  llvm::sys::fs::file_status st;
+  bool haveStat = !llvm::sys::fs::status(impl->Path, st);
+  std::string idx = cacheDir.empty() ? std::string() : impl->indexPath(cacheDir);
+  bool cached = haveStat && !idx.empty() &&
+                impl->readIndex(idx, st.getSize(), mtimeNs(st));
+  if (!cached) {
+    if (!impl->scan(error)) return nullptr;
+    if (haveStat && !idx.empty()) impl->writeIndex(idx, st.getSize(), mtimeNs(st));
+  }
+
+  impl->Sorted.reserve(impl->Index.size());
+  for (const auto& kv : impl->Index) impl->Sorted.push_back(kv.first().str());
+  std::sort(impl->Sorted.begin(), impl->Sorted.end());
+  return std::unique_ptr<IndexedCompilationDatabase>(new IndexedCompilationDatabase(std::move(impl)));
+}
+
+std::vector<CompileCommand>
+IndexedCompilationDatabase::getCompileCommands(llvm::StringRef file) const {
+  std::string key = normalize(file);
+  if (I->Index.count(key)) return I->commandsFor(key);
+
+  std::lock_guard<std::mutex> L(I->M);
+  if (std::string alias = I->keyByRealPath(key); !alias.empty())
+    return I->commandsFor(alias);
+  if (!isHeaderPath(key)) return {};
+  auto it = I->Inferred.find(key);
+  if (it == I->Inferred.end())
+    it = I->Inferred.try_emplace(key, I->inferForHeader(key)).first;
+  return it->second;
+}
+
+std::vector<std::string> IndexedCompilationDatabase::getAllFiles() const {
+  return I->Sorted;
+}
+
+std::vector<CompileCommand> IndexedCompilationDatabase::getAllCompileCommands() const {
+  std::vector<CompileCommand> out;
+  for (const auto& e : I->Entries)
+    if (auto cmd = decode(I->Json->getBuffer().substr(e.offset, e.length)))
+      out.push_back(std::move(*cmd));
+  return out;
+}
+
+const std::string& IndexedCompilationDatabase::jsonPath() const { return I->Path; }
+
+std::string findCompileDb(const std::string& path, const std::string& explicitPath) {
+  std::string json;
+  auto tryDir = [&](llvm::StringRef d) {
+    llvm::SmallString<256> p(d);
+    llvm::sys::path::append(p, "compile_commands.json");
+    if (!llvm::sys::fs::exists(p)) return false;
+    json = std::string(p.str());
+    return true;
+  };
+
+  if (!explicitPath.empty()) {
+    if (llvm::sys::fs::is_directory(explicitPath)) tryDir(explicitPath);
+    else json = explicitPath;
+  } else {
+    std::string start = normalize(path);
+    if (!llvm::sys::fs::is_directory(start)) start = llvm::sys::path::parent_path(start).str();
+    for (llvm::StringRef d = start; !d.empty() && !tryDir(d); d = llvm::sys::path::parent_path(d)) {
+      if (d == llvm::sys::path::root_path(d)) break;
+    }
+    if (json.empty()) tryDir(normalize("."));
+  }
+  return json;
+}
+
+std::shared_ptr<CompilationDatabase>
+openCompileDb(const std::string& path, const std::string& explicitPath,
+              const std::string& cacheDir, std::string& error) {
+  std::string json = findCompileDb(path, explicitPath);
+  if (json.empty()) {
+    error = "no compile_commands.json in " + (explicitPath.empty() ? path : explicitPath) +
+            " or any parent directory";
+    return nullptr;
+  }
+
+  // A long-lived process (--serve) picks up a regenerated database; callers
+  // holding the previous one keep it alive until they're done.
+  struct Loaded {
+    std::shared_ptr<CompilationDatabase> db;
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+  };
+  static std::mutex M;
+  static std::map<std::string, Loaded> Cache;
+  llvm::sys::fs::file_status st;
+  if (llvm::sys::fs::status(json, st)) {
+    error = "Cannot stat " + json;
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> L(M);
+  auto& slot = Cache[normalize(json)];
+  if (!slot.db || slot.size != st.getSize() || slot.mtime != mtimeNs(st)) {
+    auto db = IndexedCompilationDatabase::loadFromFile(json, cacheDir, error);
+    if (!db) return nullptr;
+    slot.db = inferTargetAndDriverMode(std::move(db));
+    slot.size = st.getSize();
+    slot.mtime = mtimeNs(st);
+  }
+  return slot.db;
+}
+
+const std::string& clangResourceDir() {
+  static const std::string dir = [] {
+    if (const char* rd = std::getenv("CLANG_RESOURCE_DIR")) return std::string(rd);
+#ifdef AICR_CLANG_RESOURCE_DIR
+    if (llvm::sys::fs::is_directory(AICR_CLANG_RESOURCE_DIR)) return std::string(AICR_CLANG_RESOURCE_DIR);
+#endif
+    static int anchor;
+    std::string exe = llvm::sys::fs::getMainExecutable("aicr", &anchor);
+    return clang::driver::Driver::GetResourcesPath(exe);
+  }();
+  return dir;
+}
+
+std::string realPath(const clang::FileManager& FM, llvm::StringRef name) {
+  llvm::SmallString<256> abs(name);
+  FM.makeAbsolutePath(abs);
+  return realPath(abs);
+}
+
+} // namespace aicr
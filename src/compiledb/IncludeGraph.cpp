@@ -0,0 +1,265 @@
+#include "compiledb/IncludeGraph.hpp"
+#include "cache/BinaryIO.hpp"
+#include "compiledb/CompileDb.hpp"
+#include "discovery/FileDiscovery.hpp"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+using namespace clang;
+using namespace clang::tooling;
+
+namespace aicr {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x49434941; // "AICI"
+constexpr uint32_t kVersion = 1;
+
+// Size and mtime of files as they are now, looked up once per run
+class StatCache {
+  std::mutex M;
+  std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> Seen;
+
+public:
+  bool stat(const std::string& path, uint64_t& size, uint64_t& mtime) {
+    {
+      std::lock_guard<std::mutex> lock(M);
+      auto it = Seen.find(path);
+      if (it != Seen.end()) {
+        size = it->second.first; mtime = it->second.second;
+        return size != UINT64_MAX;
+      }
+    }
+    llvm::sys::fs::file_status st;
+    bool ok = !llvm::sys::fs::status(path, st);
+    size = ok ? st.getSize() : UINT64_MAX;
+    mtime = ok ? (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   st.getLastModificationTime().time_since_epoch()).count()
+               : 0;
+    std::lock_guard<std::mutex> lock(M);
+    Seen[path] = {size, mtime};
+    return ok;
+  }
+};
+
+// Project headers only: system headers aren't part of any change
+class UserDepsCollector : public DependencyCollector {
+  bool needSystemDependencies() override { return false; }
+};
+
+class ScanAction : public PreprocessOnlyAction {
+  std::vector<std::string>& Deps;
+  std::shared_ptr<UserDepsCollector> Collector = std::make_shared<UserDepsCollector>();
+
+public:
+  explicit ScanAction(std::vector<std::string>& deps) : Deps(deps) {}
+
+  bool BeginInvocation(CompilerInstance& CI) override {
+    CI.addDependencyCollector(Collector);
+    return true;
+  }
+
+  void EndSourceFileAction() override {
+    const auto& FM = getCompilerInstance().getFileManager();
+    for (const auto& d : Collector->getDependencies()) Deps.push_back(realPath(FM, d));
+    PreprocessOnlyAction::EndSourceFileAction();
+  }
+};
+
+class ScanActionFactory : public FrontendActionFactory {
+  std::vector<std::string>& Deps;
+public:
+  explicit ScanActionFactory(std::vector<std::string>& deps) : Deps(deps) {}
+  std::unique_ptr<FrontendAction> create() override { return std::make_unique<ScanAction>(Deps); }
+};
+
+uint64_t commandKey(const CompilationDatabase& db, const std::string& file,
+                    const std::vector<std::string>& args) {
+  std::string k;
+  llvm::raw_string_ostream os(k);
+  for (const auto& a : args) os << a << '\0';
+  for (const auto& cmd : db.getCompileCommands(file)) {
+    os << ";dir=" << cmd.Directory;
+    for (const auto& a : cmd.CommandLine) os << '\0' << a;
+  }
+  return llvm::xxHash64(os.str());
+}
+
+} // namespace
+
+IncludeGraph::IncludeGraph(std::string file) : file_(std::move(file)) {
+  if (!file_.empty()) load();
+}
+
+uint32_t IncludeGraph::pathId(const std::string& path) {
+  auto [it, inserted] = ids_.emplace(path, (uint32_t)paths_.size());
+  if (inserted) paths_.push_back(path);
+  return it->second;
+}
+
+bool IncludeGraph::load() {
+  auto buf = llvm::MemoryBuffer::getFile(file_, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf) return false;
+  Reader r((*buf)->getBuffer());
+  if (r.u32() != kMagic || r.u32() != kVersion || !r.ok) return false;
+
+  std::vector<std::string> paths;
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) paths.push_back(r.str());
+  std::map<std::string, Entry> tus;
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    std::string tu = r.str();
+    Entry e;
+    e.key = r.u64();
+    uint32_t deps = r.u32();
+    for (uint32_t d = 0; d < deps && r.ok; ++d) {
+      Dep dep;
+      dep.path = r.u32(); dep.size = r.u64(); dep.mtime = r.u64();
+      if (dep.path >= paths.size()) r.ok = false;
+      e.deps.push_back(dep);
+    }
+    tus.emplace(std::move(tu), std::move(e));
+  }
+  if (!r.ok) return false;
+
+  paths_ = std::move(paths);
+  for (uint32_t i = 0; i < paths_.size(); ++i) ids_.emplace(paths_[i], i);
+  tus_ = std::move(tus);
+  return true;
+}
+
+void IncludeGraph::save() const {
+  // Only paths some TU still reads are written, so the table doesn't grow
+  // with every header that ever existed
+  std::vector<uint32_t> remap(paths_.size(), UINT32_MAX);
+  std::vector<uint32_t> used;
+  for (const auto& [tu, e] : tus_)
+    for (const auto& d : e.deps)
+      if (remap[d.path] == UINT32_MAX) {
+        remap[d.path] = (uint32_t)used.size();
+        used.push_back(d.path);
+      }
+
+  Writer w;
+  w.u32(kMagic); w.u32(kVersion);
+  w.u32((uint32_t)used.size());
+  for (uint32_t id : used) w.str(paths_[id]);
+  w.u32((uint32_t)tus_.size());
+  for (const auto& [tu, e] : tus_) {
+    w.str(tu); w.u64(e.key);
+    w.u32((uint32_t)e.deps.size());
+    for (const auto& d : e.deps) { w.u32(remap[d.path]); w.u64(d.size); w.u64(d.mtime); }
+  }
+  writeFileAtomic(file_, w.buf); // best effort; rebuilt next time if lost
+}
+
+void IncludeGraph::update(const CompilationDatabase& db, const std::vector<std::string>& tus,
+                          const std::vector<std::string>& args, unsigned jobs) {
+  StatCache stats;
+  std::vector<size_t> stale;
+  std::vector<std::string> reals(tus.size());
+  std::vector<uint64_t> keys(tus.size());
+  for (size_t i = 0; i < tus.size(); ++i) {
+    reals[i] = realPath(tus[i]);
+    names_[reals[i]] = tus[i];
+    keys[i] = commandKey(db, tus[i], args);
+    auto it = tus_.find(reals[i]);
+    bool fresh = it != tus_.end() && it->second.key == keys[i];
+    for (size_t d = 0; fresh && d < it->second.deps.size(); ++d) {
+      const Dep& dep = it->second.deps[d];
+      uint64_t size, mtime;
+      fresh = stats.stat(paths_[dep.path], size, mtime) && size == dep.size && mtime == dep.mtime;
+    }
+    if (!fresh) stale.push_back(i);
+  }
+  if (stale.empty()) return;
+
+  // Each scan gets its own tool and VFS, as analysis does
+  std::vector<std::vector<std::string>> found(stale.size());
+  std::vector<char> failed(stale.size());
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t s = next++; s < stale.size(); s = next++) {
+      IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS = llvm::vfs::createPhysicalFileSystem();
+      ClangTool Tool(db, {tus[stale[s]]}, std::make_shared<PCHContainerOperations>(), FS);
+      Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(args, ArgumentInsertPosition::BEGIN));
+      IgnoringDiagConsumer quiet; // a missing include still leaves the rest
+      Tool.setDiagnosticConsumer(&quiet);
+      ScanActionFactory factory(found[s]);
+      failed[s] = Tool.run(&factory) != 0;
+    }
+  };
+  unsigned n = std::max(1u, std::min<unsigned>(jobs, stale.size()));
+  if (n == 1) {
+    work();
+  } else {
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < n; ++t) pool.emplace_back(work);
+    for (auto& th : pool) th.join();
+  }
+  for (size_t s = 0; s < stale.size(); ++s) {
+    size_t i = stale[s];
+    // What it reads is unknown, so it is affected by anything, and
+    // scanned again next time
+    if (failed[s]) {
+      llvm::errs() << tus[i] << ": preprocessing failed; taking it as affected by any change\n";
+      unscanned_.insert(reals[i]);
+      tus_.erase(reals[i]);
+      continue;
+    }
+    Entry e;
+    e.key = keys[i];
+    std::vector<std::string> deps{reals[i]};
+    deps.insert(deps.end(), found[s].begin(), found[s].end());
+    std::sort(deps.begin() + 1, deps.end());
+    deps.erase(std::unique(deps.begin() + 1, deps.end()), deps.end());
+    for (const auto& d : deps) {
+      Dep dep;
+      dep.path = pathId(d);
+      stats.stat(d, dep.size, dep.mtime);
+      e.deps.push_back(dep);
+    }
+    tus_[reals[i]] = std::move(e);
+  }
+  if (!file_.empty()) save();
+}
+
+std::vector<std::string> IncludeGraph::affected(const std::set<std::string>& files) const {
+  std::vector<std::string> out;
+  for (const auto& [real, name] : names_) {
+    if (unscanned_.count(real)) {
+      out.push_back(name);
+      continue;
+    }
+    auto it = tus_.find(real);
+    if (it == tus_.end()) continue;
+    for (const auto& d : it->second.deps) {
+      if (files.count(paths_[d.path])) {
+        out.push_back(name);
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+} // namespace aicr
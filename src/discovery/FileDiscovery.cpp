@@ -0,0 +1,327 @@
+#include "discovery/FileDiscovery.hpp"
+#include "compiledb/CompileDb.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace aicr {
+
+namespace {
+
+// Glob match where `*` and `?` stop at '/', `**` spans directories and
+// [...] is a character class, as in .gitignore
+bool globMatch(const char* p, const char* s) {
+  for (; *p; ++p, ++s) {
+    switch (*p) {
+    case '*':
+      if (p[1] == '*') {
+        p += 2;
+        if (*p == '/') {
+          // "**/" matches zero or more whole directories
+          ++p;
+          for (const char* t = s;; ++t) {
+            if ((t == s || t[-1] == '/') && globMatch(p, t)) return true;
+            if (!*t) return false;
+          }
+        }
+        for (const char* t = s;; ++t) {
+          if (globMatch(p, t)) return true;
+          if (!*t) return false;
+        }
+      }
+      for (const char* t = s;; ++t) {
+        if (globMatch(p + 1, t)) return true;
+        if (!*t || *t == '/') return false;
+      }
+    case '?':
+      if (!*s || *s == '/') return false;
+      break;
+    case '[': {
+      if (!*s || *s == '/') return false;
+      const char* q = p + 1;
+      bool negate = *q == '!' || *q == '^';
+      if (negate) ++q;
+      bool hit = false;
+      for (bool first = true; *q && (first || *q != ']'); first = false, ++q) {
+        if (q[1] == '-' && q[2] && q[2] != ']') {
+          hit |= *s >= q[0] && *s <= q[2];
+          q += 2;
+        } else {
+          hit |= *s == *q;
+        }
+      }
+      if (*q != ']') return *s == '[' && globMatch(p + 1, s + 1); // literal '['
+      if (hit == negate) return false;
+      p = q;
+      break;
+    }
+    case '\\':
+      if (p[1]) ++p;
+      [[fallthrough]];
+    default:
+      if (*s != *p) return false;
+    }
+  }
+  return !*s;
+}
+
+struct IgnoreRule {
+  std::string base;     // directory the pattern is relative to, with trailing '/'
+  std::string pattern;
+  bool negate = false;
+  bool dirOnly = false;
+  bool anchored = false; // matched against the relative path, not the basename
+};
+
+using Rules = std::shared_ptr<const std::vector<IgnoreRule>>;
+
+void parseRule(llvm::StringRef line, const std::string& base, std::vector<IgnoreRule>& out) {
+  line = line.rtrim("\r");
+  if (!line.ends_with("\\ ")) line = line.rtrim(' ');
+  if (line.empty() || line.starts_with("#")) return;
+  IgnoreRule r;
+  r.base = base;
+  if (line.consume_front("!")) r.negate = true;
+  if (line.consume_back("/")) r.dirOnly = true;
+  if (line.empty()) return;
+  r.anchored = line.contains('/');
+  line.consume_front("/");
+  r.pattern = line.str();
+  out.push_back(std::move(r));
+}
+
+// Rules of `dir`/.gitignore appended to the inherited ones, or the
+// inherited set itself when there's no file
+Rules withGitignore(const Rules& parent, const std::string& dir) {
+  auto buf = llvm::MemoryBuffer::getFile(dir + "/.gitignore");
+  if (!buf) return parent;
+  auto rules = std::make_shared<std::vector<IgnoreRule>>(*parent);
+  llvm::SmallVector<llvm::StringRef, 32> lines;
+  (*buf)->getBuffer().split(lines, '\n');
+  for (auto l : lines) parseRule(l, dir + "/", *rules);
+  return rules;
+}
+
+// Last matching rule wins, as in git
+bool ignored(const std::vector<IgnoreRule>& rules, const std::string& path, bool isDir) {
+  bool out = false;
+  for (const auto& r : rules) {
+    if (r.negate != out) continue; // can't change the answer
+    if (r.dirOnly && !isDir) continue;
+    if (!llvm::StringRef(path).starts_with(r.base)) continue;
+    std::string rel = path.substr(r.base.size());
+    const std::string& subject = r.anchored ? rel : llvm::sys::path::filename(rel).str();
+    if (globMatch(r.pattern.c_str(), subject.c_str())) out = !r.negate;
+  }
+  return out;
+}
+
+// Whether `path` below `root` is ignored itself or lies in an ignored
+// directory; for paths that didn't come from the walk
+bool ignoredBelow(const std::vector<IgnoreRule>& rules, const std::string& root,
+                  const std::string& path) {
+  for (size_t i = path.find('/', root.size() + 1); i != std::string::npos;
+       i = path.find('/', i + 1))
+    if (ignored(rules, path.substr(0, i), true)) return true;
+  return ignored(rules, path, false);
+}
+
+std::string canonical(const std::string& p) {
+  llvm::SmallString<256> real;
+  if (llvm::sys::fs::real_path(p, real)) return {};
+  return std::string(real.str());
+}
+
+// Loads .gitignore files from the enclosing repository's top level down to
+// (but not including) `dir`, so a root inside a repo honors its parents'
+// rules too
+Rules ancestorRules(const std::string& dir) {
+  std::vector<std::string> chain;
+  for (llvm::StringRef d = llvm::sys::path::parent_path(dir); !d.empty();
+       d = llvm::sys::path::parent_path(d)) {
+    chain.push_back(d.str());
+    if (llvm::sys::fs::exists(d + "/.git")) break;
+    if (d == llvm::sys::path::root_path(d)) {
+      chain.clear(); // not inside a repository
+      break;
+    }
+  }
+  Rules rules = std::make_shared<std::vector<IgnoreRule>>();
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) rules = withGitignore(rules, *it);
+  return rules;
+}
+
+class Walker {
+  struct Dir {
+    std::string path;
+    Rules rules;
+  };
+
+  const DiscoverOptions& Opts;
+  bool WantSources;
+  std::mutex M;
+  std::condition_variable CV;
+  std::deque<Dir> Queue;
+  unsigned Busy = 0;
+  std::set<llvm::sys::fs::UniqueID> Visited;
+  std::vector<std::string> Found;
+
+  bool wanted(const std::string& path) const {
+    return isHeaderFile(path) || (WantSources && isSourceFile(path));
+  }
+
+  void visit(const Dir& d, std::vector<Dir>& subdirs, std::vector<std::string>& files) {
+    Rules rules = Opts.gitignore ? withGitignore(d.rules, d.path) : d.rules;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(d.path, ec, /*follow_symlinks=*/true), end;
+         it != end && !ec; it.increment(ec)) {
+      std::string path = it->path();
+      llvm::StringRef name = llvm::sys::path::filename(path);
+      auto st = it->status();
+      if (!st) continue; // dangling symlink
+      bool isDir = st->type() == llvm::sys::fs::file_type::directory_file;
+      if (isDir && name == ".git") continue;
+      if (ignored(*rules, path, isDir)) continue;
+      if (isDir) {
+        subdirs.push_back({path, rules});
+      } else if (wanted(path)) {
+        std::string real = canonical(path);
+        if (!real.empty()) files.push_back(std::move(real));
+      }
+    }
+  }
+
+  // Claims a directory by its device/inode, so one reached again through a
+  // symlink (cycle or not) isn't walked twice
+  bool claim(const std::string& path) {
+    llvm::sys::fs::file_status st;
+    if (llvm::sys::fs::status(path, st)) return false;
+    return Visited.insert(st.getUniqueID()).second;
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> L(M);
+    for (;;) {
+      CV.wait(L, [&] { return !Queue.empty() || Busy == 0; });
+      if (Queue.empty()) return;
+      Dir d = std::move(Queue.front());
+      Queue.pop_front();
+      ++Busy;
+      L.unlock();
+
+      std::vector<Dir> subdirs;
+      std::vector<std::string> files;
+      visit(d, subdirs, files);
+
+      L.lock();
+      for (auto& s : subdirs)
+        if (claim(s.path)) Queue.push_back(std::move(s));
+      Found.insert(Found.end(), files.begin(), files.end());
+      --Busy;
+      CV.notify_all();
+    }
+  }
+
+public:
+  Walker(const DiscoverOptions& opts, bool wantSources)
+    : Opts(opts), WantSources(wantSources) {}
+
+  void addRoot(const std::string& dir, Rules rules) {
+    if (claim(dir)) Queue.push_back({dir, std::move(rules)});
+  }
+
+  std::vector<std::string> run() {
+    unsigned n = Opts.jobs ? Opts.jobs : std::thread::hardware_concurrency();
+    n = std::max(1u, n);
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < n; ++t) pool.emplace_back([this] { work(); });
+    work();
+    for (auto& th : pool) th.join();
+    return std::move(Found);
+  }
+};
+
+} // namespace
+
+bool isSourceFile(const std::string& path) {
+  llvm::StringRef ext = llvm::sys::path::extension(path);
+  return ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".c";
+}
+
+bool isHeaderFile(const std::string& path) {
+  llvm::StringRef ext = llvm::sys::path::extension(path);
+  return ext == ".h" || ext == ".hh" || ext == ".hpp" || ext == ".hxx";
+}
+
+bool discoverFiles(const std::vector<std::string>& roots,
+                   const DiscoverOptions& opts,
+                   std::vector<std::string>& out,
+                   std::string* error) {
+  Walker walker(opts, !opts.fromCompileDb);
+  // Directory roots with their --exclude rules, for filtering database entries
+  std::vector<std::pair<std::string, std::vector<IgnoreRule>>> dirs;
+
+  for (const auto& r : roots) {
+    std::string real = canonical(r);
+    if (real.empty()) {
+      if (error) *error = "No such file or directory: " + r;
+      return false;
+    }
+    if (!llvm::sys::fs::is_directory(real)) {
+      out.push_back(std::move(real));
+      continue;
+    }
+    std::vector<IgnoreRule> excludes;
+    for (const auto& x : opts.excludes) parseRule(x, real + "/", excludes);
+    auto rules = std::make_shared<std::vector<IgnoreRule>>();
+    if (opts.gitignore) *rules = *ancestorRules(real);
+    rules->insert(rules->end(), excludes.begin(), excludes.end());
+    walker.addRoot(real, rules);
+    dirs.emplace_back(real, std::move(excludes));
+  }
+
+  std::vector<std::string> found = walker.run();
+  out.insert(out.end(), found.begin(), found.end());
+
+  if (opts.fromCompileDb && !dirs.empty()) {
+    std::string err;
+    auto db = openCompileDb(roots.front(), opts.compileDb, opts.cacheDir, err);
+    if (!db) {
+      if (error) *error = "Compilation DB not found (" + err + ")";
+      return false;
+    }
+    for (const auto& f : db->getAllFiles()) {
+      std::string real = canonical(f);
+      if (real.empty()) continue; // stale entry
+      for (const auto& [dir, rules] : dirs) {
+        if (!llvm::StringRef(real).starts_with(dir + "/")) continue;
+        // Only --exclude applies: a file with a compile command is part of
+        // the build even if .gitignore says otherwise (generated code)
+        if (!ignoredBelow(rules, dir, real)) out.push_back(real);
+        break;
+      }
+    }
+  }
+
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return true;
+}
+
+std::string realPath(llvm::StringRef path) {
+  llvm::SmallString<256> buf;
+  if (llvm::sys::fs::real_path(path, buf)) return path.str();
+  return std::string(buf.str());
+}
+
+} // namespace aicr
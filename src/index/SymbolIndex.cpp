@@ -0,0 +1,168 @@
+#include "index/SymbolIndex.hpp"
+#include "cache/BinaryIO.hpp"
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Index/USRGeneration.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace aicr {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x53434941; // "AICS"
+constexpr uint32_t kVersion = 1;
+
+} // namespace
+
+std::string symbolUsr(const clang::NamedDecl& D, const clang::SourceManager& SM) {
+  const auto* Canon = llvm::cast<clang::NamedDecl>(D.getCanonicalDecl());
+  llvm::SmallString<128> usr;
+  if (clang::index::generateUSRForDecl(Canon, usr)) return {};
+  if (Canon->isExternallyVisible()) return std::string(usr.str());
+
+  auto FE = SM.getFileEntryRefForID(SM.getFileID(SM.getExpansionLoc(Canon->getLocation())));
+  if (!FE) return {};
+  llvm::SmallString<256> path(FE->getName());
+  SM.getFileManager().makeAbsolutePath(path);
+  llvm::SmallString<256> real;
+  if (!llvm::sys::fs::real_path(path, real)) path = real;
+  return std::string(usr.str()) + "#" + std::string(path.str());
+}
+
+uint32_t TUSymbols::usrIndex(llvm::StringRef usr) {
+  auto [it, inserted] = usrIds_.try_emplace(usr, (uint32_t)usrs.size());
+  if (inserted) usrs.push_back(usr.str());
+  return it->second;
+}
+
+void TUSymbols::add(llvm::StringRef usr, llvm::StringRef file, unsigned offset,
+                    unsigned length) {
+  Ref r;
+  r.usr = usrIndex(usr);
+  auto [it, inserted] = fileIds_.try_emplace(file, (uint32_t)files.size());
+  if (inserted) files.push_back(file.str());
+  r.file = it->second;
+  r.offset = offset;
+  r.length = length;
+  refs.push_back(r);
+}
+
+void TUSymbols::markUnsafe(llvm::StringRef usr) {
+  unsafe.push_back(usrIndex(usr));
+}
+
+void TUSymbols::clear() {
+  usrs.clear(); files.clear(); refs.clear(); unsafe.clear();
+  usrIds_.clear(); fileIds_.clear();
+}
+
+SymbolIndex::SymbolIndex(std::string dir) : dir_(std::move(dir)) {
+  if (!dir_.empty()) llvm::sys::fs::create_directories(dir_);
+}
+
+std::string SymbolIndex::recordPath(const std::string& tu) const {
+  llvm::SmallString<256> p(dir_);
+  llvm::sys::path::append(p, llvm::utohexstr(llvm::xxHash64(tu)) + ".sym");
+  return std::string(p.str());
+}
+
+void SymbolIndex::invalidate() {
+  built_ = false;
+  byUsr_.clear();
+  unsafe_.clear();
+}
+
+void SymbolIndex::update(const std::string& tu, uint64_t key, TUSymbols syms) {
+  if (!dir_.empty()) {
+    Writer w;
+    w.u32(kMagic); w.u32(kVersion); w.str(tu); w.u64(key);
+    w.u32((uint32_t)syms.usrs.size());
+    for (const auto& u : syms.usrs) w.str(u);
+    w.u32((uint32_t)syms.files.size());
+    for (const auto& f : syms.files) w.str(f);
+    w.u32((uint32_t)syms.refs.size());
+    for (const auto& r : syms.refs) { w.u32(r.usr); w.u32(r.file); w.u32(r.offset); w.u32(r.length); }
+    w.u32((uint32_t)syms.unsafe.size());
+    for (uint32_t u : syms.unsafe) w.u32(u);
+    writeFileAtomic(recordPath(tu), w.buf);
+  }
+  std::lock_guard<std::mutex> lock(m_);
+  tus_[tu] = std::move(syms);
+  invalidate();
+}
+
+bool SymbolIndex::load(const std::string& tu, uint64_t key) {
+  if (dir_.empty()) return false;
+  auto buf = llvm::MemoryBuffer::getFile(recordPath(tu), /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf) return false;
+  Reader r((*buf)->getBuffer());
+  if (r.u32() != kMagic || r.u32() != kVersion || r.ref() != tu || r.u64() != key || !r.ok)
+    return false;
+
+  TUSymbols syms;
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) syms.usrs.push_back(r.str());
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) syms.files.push_back(r.str());
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    TUSymbols::Ref ref;
+    ref.usr = r.u32(); ref.file = r.u32(); ref.offset = r.u32(); ref.length = r.u32();
+    if (ref.usr >= syms.usrs.size() || ref.file >= syms.files.size()) r.ok = false;
+    syms.refs.push_back(ref);
+  }
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    uint32_t u = r.u32();
+    if (u >= syms.usrs.size()) r.ok = false;
+    syms.unsafe.push_back(u);
+  }
+  if (!r.ok) return false;
+
+  std::lock_guard<std::mutex> lock(m_);
+  tus_[tu] = std::move(syms);
+  invalidate();
+  return true;
+}
+
+std::optional<std::vector<SymbolOccurrence>>
+SymbolIndex::occurrences(const std::string& usr) const {
+  std::lock_guard<std::mutex> lock(m_);
+  if (!built_) {
+    for (const auto& [tu, syms] : tus_) {
+      for (uint32_t i = 0; i < syms.refs.size(); ++i)
+        byUsr_[syms.usrs[syms.refs[i].usr]].push_back({&syms, i});
+      for (uint32_t u : syms.unsafe) unsafe_[syms.usrs[u]] = true;
+    }
+    built_ = true;
+  }
+  if (unsafe_.count(usr)) return std::nullopt;
+
+  std::vector<SymbolOccurrence> out;
+  auto it = byUsr_.find(usr);
+  if (it == byUsr_.end()) return out;
+  for (const auto& l : it->second) {
+    const auto& ref = l.tu->refs[l.ref];
+    out.push_back({l.tu->files[ref.file], ref.offset, ref.length});
+  }
+  // A header's uses are seen by every TU that includes it
+  auto key = [](const SymbolOccurrence& o) { return std::tie(o.file, o.offset, o.length); };
+  std::sort(out.begin(), out.end(),
+            [&](const SymbolOccurrence& a, const SymbolOccurrence& b) { return key(a) < key(b); });
+  out.erase(std::unique(out.begin(), out.end(),
+                        [&](const SymbolOccurrence& a, const SymbolOccurrence& b) { return key(a) == key(b); }),
+            out.end());
+  return out;
+}
+
+} // namespace aicr
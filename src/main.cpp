@@ -1,31 +1,96 @@
 #include "analyzers/Analyzer.hpp"
+#include "analyzers/Baseline.hpp"
+#include "analyzers/Overlay.hpp"
+#include "discovery/FileDiscovery.hpp"
 #include "ai/AiEngine.hpp"
+#include "profile/Profiler.hpp"
+#include "profile/Trace.hpp"
+#include "refactor/RefactorEngine.hpp"
+#include "report/Reporter.hpp"
+#include "server/Server.hpp"
+#include "shard/Shard.hpp"
+#include "vcs/GitDiff.hpp"
 
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
-#include <iostream>
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <iterator>
+#include <map>
 #include <memory>
-#include <filesystem> 
+#include <optional>
+#include <set>
+#include <tuple>
+#include <unistd.h>
 
 using namespace aicr;
 
 static llvm::cl::OptionCategory ToolCat("aicr options");
 
+static llvm::cl::SubCommand MergeCmd(
+  "merge", "Combine --shard-out result files into one report and fix set");
+
+static llvm::cl::list<std::string> MergeInputs(
+  llvm::cl::Positional, llvm::cl::desc("<shard result files>"), llvm::cl::OneOrMore,
+  llvm::cl::sub(MergeCmd));
+
 static llvm::cl::list<std::string> Paths(
   "paths", llvm::cl::desc("Source files or directories to analyze (recursive)"),
-  llvm::cl::OneOrMore, llvm::cl::cat(ToolCat));
+  llvm::cl::ZeroOrMore, llvm::cl::cat(ToolCat));
 
 static llvm::cl::opt<int> LongFnThresh(
   "long-fn", llvm::cl::desc("Long function threshold (lines)"),
   llvm::cl::init(80), llvm::cl::cat(ToolCat));
 
+static llvm::cl::opt<unsigned> DupMinNodes(
+  "dup-min-nodes",
+  llvm::cl::desc("Smallest function body or block DUPLICATE_CODE compares (AST nodes)"),
+  llvm::cl::init(50), llvm::cl::cat(ToolCat));
+
 static llvm::cl::opt<bool> Fix(
   "fix", llvm::cl::desc("Apply available fixes"), llvm::cl::init(false),
-  llvm::cl::cat(ToolCat));
+  llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
 
 static llvm::cl::opt<bool> NoBackup(
   "no-backup", llvm::cl::desc("Do not write .bak backups when applying fixes"),
+  llvm::cl::init(false), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<bool> VerifyFixes(
+  "verify-fixes", llvm::cl::desc("Before writing fixes, reparse the TUs that read an edited file with the edits in memory, and drop fixes that add compile errors"),
   llvm::cl::init(false), llvm::cl::cat(ToolCat));
 
+static llvm::cl::opt<std::string> FixOutput(
+  "fix-output", llvm::cl::desc("Write fixes to this file ('-' for stdout) as --fix-format instead of applying them; sources are left untouched"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+enum class FixFormat { Diff, Edits };
+
+static llvm::cl::opt<FixFormat> FixFormatOpt(
+  "fix-format", llvm::cl::desc("Format of --fix-output"),
+  llvm::cl::values(
+    clEnumValN(FixFormat::Diff, "diff", "Unified diff, for patch -p1 or git apply (default)"),
+    clEnumValN(FixFormat::Edits, "edits", "One JSON object per edit per line, with offsets and line/column ranges")),
+  llvm::cl::init(FixFormat::Diff), llvm::cl::cat(ToolCat),
+  llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<std::string> StdinFile(
+  "stdin-file", llvm::cl::desc("Take the contents of this file from stdin instead of disk, eg. an unsaved editor buffer (analyzed by default)"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> OverlayFile(
+  "overlay", llvm::cl::desc("JSON object of path: contents to use instead of those files on disk ('-' reads it from stdin; the files are analyzed by default)"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> BaselineFile(
+  "baseline", llvm::cl::desc("Report only issues not in this baseline; rules aren't even run where their issue is known. Cached results depend on the baseline's contents, so any change to it reanalyzes every TU"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<std::string> BaselineWrite(
+  "baseline-write", llvm::cl::desc("Record the fingerprint of every issue reported to this file, for later --baseline runs"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
 static llvm::cl::opt<bool> NoDocs(
   "no-docs", llvm::cl::desc("Disable doc stub suggestions"),
   llvm::cl::init(false), llvm::cl::cat(ToolCat));
@@ -34,67 +99,659 @@ static llvm::cl::opt<bool> NoNames(
   "no-names", llvm::cl::desc("Disable variable naming suggestions"),
   llvm::cl::init(false), llvm::cl::cat(ToolCat));
 
+static llvm::cl::list<std::string> Rules(
+  "rules", llvm::cl::desc("Rules to run, eg. LONG_FUNC,MISSING_DOC (default: all). Fewer rules can mean a cheaper parse"),
+  llvm::cl::CommaSeparated, llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<unsigned> Jobs(
+  "jobs", llvm::cl::desc("Translation units to analyze in parallel (0 = all cores)"),
+  llvm::cl::init(1), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<std::string> Since(
+  "since", llvm::cl::desc("Only analyze TUs affected by changes since this git revision (from its merge base with HEAD), and only report issues on changed lines. Which files each TU reads is kept in --cache-dir, or in the user cache directory without one"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> Shard(
+  "shard", llvm::cl::desc("Analyze only part i/N (0-based) of the files, split by recorded cost; needs --shard-out"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> ShardOut(
+  "shard-out", llvm::cl::desc("Write this shard's issues, fixes and timings here for `aicr merge`"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> ShardCosts(
+  "shard-costs", llvm::cl::desc("Per-file cost history: --shard splits by it, `aicr merge` updates it"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<bool> FromCompileDb(
+  "from-compile-db", llvm::cl::desc("Take sources under the given directories from compile_commands.json instead of walking for them"),
+  llvm::cl::init(false), llvm::cl::cat(ToolCat));
+
+static llvm::cl::list<std::string> Exclude(
+  "exclude", llvm::cl::desc("Skip paths matching these .gitignore-style patterns (relative to each directory given)"),
+  llvm::cl::CommaSeparated, llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<bool> NoGitignore(
+  "no-gitignore", llvm::cl::desc("Do not honor .gitignore files while walking directories"),
+  llvm::cl::init(false), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> CompileDb(
+  "compile-db", llvm::cl::desc("compile_commands.json, or the directory holding it (default: search upward from the first path, or from the working directory for `aicr merge`). Shard results name files relative to its directory"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<std::string> ResourceDir(
+  "resource-dir", llvm::cl::desc("Clang resource directory (default: detected from the Clang aicr was built with)"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> CacheDir(
+  "cache-dir", llvm::cl::desc("Directory for the incremental result cache (disabled if empty)"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<unsigned> CacheMaxMB(
+  "cache-max-mb", llvm::cl::desc("Size bound of the result cache in MiB"),
+  llvm::cl::init(512), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<unsigned> MaxMemoryMB(
+  "max-memory", llvm::cl::desc("Budget in MiB for the ASTs and buffers of TUs parsed at once (0 = none). A TU that doesn't fit next to those running waits for room; one too big even alone is analyzed last with function bodies skipped. Footprints are kept in --cache-dir"),
+  llvm::cl::init(0), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<unsigned> MemoryReport(
+  "memory-report", llvm::cl::desc("Print the <n> TUs holding the most memory once parsed, with their AST, source buffer and preprocessor sizes and issue counts"),
+  llvm::cl::init(0), llvm::cl::value_desc("n"), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> PchDir(
+  "pch-dir", llvm::cl::desc("Precompile leading <...> includes shared by TUs into this directory"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<bool> Profile(
+  "profile", llvm::cl::desc("Report per-stage, per-rule, per-TU and AI timings at exit"),
+  llvm::cl::init(false), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> ProfileJson(
+  "profile-json", llvm::cl::desc("Also write the --profile report as JSON to this file"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> TraceFile(
+  "trace", llvm::cl::desc("Write a Chrome trace-event timeline of the run (stages, TUs and their phases, rules, AI calls, file writes, Clang's -ftime-trace) to this file"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<unsigned> TraceGranularity(
+  "trace-granularity", llvm::cl::desc("Leave spans shorter than this many microseconds out of --trace"),
+  llvm::cl::init(500), llvm::cl::cat(ToolCat));
+
+enum class OutputFormat { Text, Jsonl, Sarif };
+
+static llvm::cl::opt<OutputFormat> Format(
+  "format", llvm::cl::desc("Issue output format"),
+  llvm::cl::values(
+    clEnumValN(OutputFormat::Text, "text", "file:line:col [ID] message (default)"),
+    clEnumValN(OutputFormat::Jsonl, "jsonl", "One JSON object per issue per line"),
+    clEnumValN(OutputFormat::Sarif, "sarif", "SARIF 2.1.0 log")),
+  llvm::cl::init(OutputFormat::Text), llvm::cl::cat(ToolCat),
+  llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
+static llvm::cl::opt<std::string> Output(
+  "output", llvm::cl::desc("Write issues to this file instead of stdout"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat), llvm::cl::sub(llvm::cl::SubCommand::getAll()));
+
 static llvm::cl::opt<std::string> OnnxModel(
   "onnx-model", llvm::cl::desc("Path to ONNX model (enables ONNX engine)"),
   llvm::cl::init(""), llvm::cl::cat(ToolCat));
 
-int main(int argc, const char** argv) {
-  llvm::cl::HideUnrelatedOptions(ToolCat);
-  llvm::cl::ParseCommandLineOptions(argc, argv, "AI-powered code search & refactor (MVP)\n");
+static llvm::cl::opt<std::string> Serve(
+  "serve", llvm::cl::desc("Stay resident and answer requests on this Unix socket, keeping the compilation database, AI engine and caches warm"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static llvm::cl::opt<std::string> Connect(
+  "connect", llvm::cl::desc("Have the --serve process on this Unix socket run the request"),
+  llvm::cl::init(""), llvm::cl::cat(ToolCat));
+
+static const char* const kOverview = "AI-powered code search & refactor (MVP)\n";
+
+// Engines are kept for the life of the process, so a server loads a model
+// once no matter how many requests use it
+static AiEngine* engineFor(const std::string& model) {
+  static std::map<std::string, std::unique_ptr<AiEngine>> engines;
+  auto& ai = engines[model];
+#ifdef ENABLE_ONNXRUNTIME
+  if (!ai && !model.empty()) ai.reset(makeOnnxAi(model));
+#endif
+  if (!ai) ai.reset(makeHeuristicAi());
+  return ai.get();
+}
+
+// The --output file if one is named, else `out`; null after reporting why
+// the file can't be opened
+static llvm::raw_ostream* openOutput(llvm::raw_ostream& out, llvm::raw_ostream& err,
+                                     std::unique_ptr<llvm::raw_fd_ostream>& file) {
+  if (Output.empty()) return &out;
+  std::error_code ec;
+  file = std::make_unique<llvm::raw_fd_ostream>(Output, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    err << "Cannot open " << Output << ": " << ec.message() << "\n";
+    return nullptr;
+  }
+  return file.get();
+}
+
+// Set while a server runs a request: what the client read from its stdin
+static const std::string* RequestInput = nullptr;
+
+static bool readStdin(std::string& out, llvm::raw_ostream& err) {
+  if (RequestInput) {
+    out = *RequestInput;
+    return true;
+  }
+  auto buf = llvm::MemoryBuffer::getSTDIN();
+  if (!buf) {
+    err << "Cannot read stdin: " << buf.getError().message() << "\n";
+    return false;
+  }
+  out = (*buf)->getBuffer().str();
+  return true;
+}
+
+// Unsaved buffers from --overlay and --stdin-file
+static bool loadOverlay(Overlay& overlay, llvm::raw_ostream& err) {
+  if (!StdinFile.empty() && OverlayFile == "-") {
+    err << "--stdin-file and --overlay=- cannot both read stdin\n";
+    return false;
+  }
+  if (!OverlayFile.empty()) {
+    std::string json;
+    if (OverlayFile == "-") {
+      if (!readStdin(json, err)) return false;
+    } else {
+      auto buf = llvm::MemoryBuffer::getFile(OverlayFile);
+      if (!buf) {
+        err << "Cannot read " << OverlayFile << ": " << buf.getError().message() << "\n";
+        return false;
+      }
+      json = (*buf)->getBuffer().str();
+    }
+    std::string e;
+    if (!overlay.parse(json, &e)) {
+      err << OverlayFile << ": " << e << "\n";
+      return false;
+    }
+  }
+  if (!StdinFile.empty()) {
+    std::string contents;
+    if (!readStdin(contents, err)) return false;
+    overlay.set(StdinFile, std::move(contents));
+  }
+  return true;
+}
+
+// --fix-output: the fixes as a diff or edit list, in place of applying them
+static bool writeFixOutput(const std::vector<FixIt>& fixes, const Overlay* overlay,
+                           llvm::raw_ostream& out, llvm::raw_ostream& err) {
+  std::vector<FileEdits> files;
+  ApplyStats st;
+  std::string e;
+  if (!RefactorEngine::planFixes(fixes, overlay, files, &e, &st)) {
+    err << e << "\n";
+    return false;
+  }
+  if (st.rejected)
+    err << "Skipped " << st.rejected << " fix(es) overlapping an earlier edit\n";
+
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  llvm::raw_ostream* os = &out;
+  if (FixOutput != "-") {
+    std::error_code ec;
+    file = std::make_unique<llvm::raw_fd_ostream>(FixOutput, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+      err << "Cannot open " << FixOutput << ": " << ec.message() << "\n";
+      return false;
+    }
+    os = file.get();
+  }
+  if (FixFormatOpt != FixFormat::Diff) {
+    RefactorEngine::writeEdits(files, *os);
+    return true;
+  }
+  std::string base = RefactorEngine::writeDiff(files, *os);
+  llvm::SmallString<256> cwd;
+  if (!base.empty() && !llvm::sys::fs::current_path(cwd) && cwd != base)
+    err << "Note: some fixes edit files outside the current directory; the diff's paths are "
+           "relative to " << base << ", apply it from there\n";
+  return true;
+}
+
+static std::unique_ptr<Reporter> makeReporter(llvm::raw_ostream& os) {
+  switch (Format) {
+  case OutputFormat::Text: return makeTextReporter(os);
+  case OutputFormat::Jsonl: return makeJsonlReporter(os);
+  case OutputFormat::Sarif: return makeSarifReporter(os);
+  }
+  return makeTextReporter(os);
+}
+
+// Notes the fingerprint of each issue on its way to the real reporter, for
+// --baseline-write
+class BaselineRecorder final : public Reporter {
+  std::unique_ptr<Reporter> Inner;
+  Baseline& Out;
+public:
+  BaselineRecorder(std::unique_ptr<Reporter> inner, Baseline& out)
+    : Inner(std::move(inner)), Out(out) {}
+  void begin() override { Inner->begin(); }
+  void report(const IssueStore& issues) override {
+    for (const auto& e : issues.entries()) Out.add(e.fingerprint);
+    Inner->report(issues);
+  }
+  void end() override { Inner->end(); }
+};
+
+// --baseline, loaded into `baseline`; false after reporting why it can't be
+static bool loadBaseline(Baseline& baseline, llvm::raw_ostream& err) {
+  if (BaselineFile.empty()) return true;
+  if (!BaselineWrite.empty()) {
+    err << "--baseline and --baseline-write cannot be combined: a new baseline records every issue\n";
+    return false;
+  }
+  std::string e;
+  if (baseline.load(BaselineFile, &e)) return true;
+  err << e << "\n";
+  return false;
+}
+
+static bool writeBaseline(Baseline& recorded, llvm::raw_ostream& err) {
+  if (BaselineWrite.empty()) return true;
+  recorded.finalize();
+  std::string e;
+  if (!recorded.write(BaselineWrite, &e)) {
+    err << e << "\n";
+    return false;
+  }
+  err << "Wrote " << recorded.size() << " issue fingerprint(s) to " << BaselineWrite << "\n";
+  return true;
+}
+
+// One analysis with the options as parsed, writing what the user sees to
+// `out` and `err`. Shared by direct runs and server requests.
+static int run(llvm::raw_ostream& out, llvm::raw_ostream& err) {
+  Overlay overlay;
+  if (!loadOverlay(overlay, err)) return 1;
+
+  // Unsaved buffers are what is analyzed unless --paths says otherwise
+  std::vector<std::string> roots(Paths.begin(), Paths.end());
+  if (roots.empty()) roots = overlay.paths();
+  if (roots.empty()) {
+    err << "No --paths given.\n";
+    return 1;
+  }
+
+  if (!BaselineWrite.empty()) {
+    if (!Since.empty()) {
+      err << "--baseline-write cannot be combined with --since: it would record only the issues on changed lines\n";
+      return 1;
+    }
+    if (!Rules.empty() || NoDocs || NoNames || !StdinFile.empty() || !OverlayFile.empty())
+      err << "Warning: --baseline-write records only what this run reports; with --rules, "
+             "--no-docs, --no-names, --stdin-file or --overlay narrowing it, the baseline is partial\n";
+  }
+
+  if (VerifyFixes && !Fix && FixOutput.empty()) {
+    err << "--verify-fixes needs --fix or --fix-output: there are no fixes to verify otherwise\n";
+    return 1;
+  }
+
+  ShardSpec shard;
+  if (!Shard.empty()) {
+    std::string e;
+    if (!parseShardSpec(Shard, shard, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+    if (ShardOut.empty()) {
+      err << "--shard needs --shard-out\n";
+      return 1;
+    }
+    if (Fix) err << "Note: shard fixes are applied by `aicr merge --fix`\n";
+    if (!FixOutput.empty()) {
+      err << "--fix-output goes with `aicr merge`, not --shard\n";
+      return 1;
+    }
+    if (!BaselineWrite.empty()) {
+      err << "--baseline-write goes with `aicr merge`, not --shard\n";
+      return 1;
+    }
+  }
 
   AnalyzeOptions opts;
   opts.longFunctionLineThreshold = LongFnThresh;
+  opts.duplicateMinNodes = DupMinNodes;
   opts.suggestDocs = !NoDocs;
   opts.suggestBetterVarNames = !NoNames;
   opts.fix = Fix;
   opts.backup = !NoBackup;
+  opts.verifyFixes = VerifyFixes;
+  opts.jobs = Jobs;
+  opts.cacheDir = CacheDir;
+  opts.cacheMaxBytes = (uint64_t)CacheMaxMB << 20;
+  opts.maxMemoryBytes = (uint64_t)MaxMemoryMB << 20;
+  opts.memoryReport = MemoryReport;
+  opts.pchDir = PchDir;
+  opts.compileDb = CompileDb;
+  opts.resourceDir = ResourceDir;
+  opts.rules.assign(Rules.begin(), Rules.end());
+  if (!overlay.empty()) opts.overlay = &overlay;
 
-  std::unique_ptr<AiEngine> ai;
-#ifdef ENABLE_ONNXRUNTIME
-  if (!OnnxModel.empty()) ai.reset(makeOnnxAi(OnnxModel));
-#endif
-  if (!ai) ai.reset(makeHeuristicAi());
+  // Known issues are dropped before any fix, AI request or report is made
+  Baseline baseline, recorded;
+  if (!loadBaseline(baseline, err)) return 1;
+  if (!BaselineFile.empty()) opts.baseline = &baseline;
+
+  // Rendered fixes are collected rather than written
+  std::vector<FixIt> fixes;
+  if (!FixOutput.empty()) {
+    opts.fix = true;
+    opts.deferredFixes = &fixes;
+  }
 
+  ChangedLines changed;
+  if (!Since.empty()) {
+    std::string e;
+    if (!gitChangedLines(Since, changed, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+    opts.changed = &changed;
+  }
+
+  if (Profile || !ProfileJson.empty()) Profiler::enable();
+  if (!TraceFile.empty()) Tracer::enable(TraceGranularity);
+
+  AiEngine* ai = engineFor(OnnxModel);
   auto cpp = makeCppAnalyzer();
 
   std::vector<std::string> files;
+  std::optional<StageTimer> discoveryTimer(std::in_place, "discovery");
 
-  // Expand directories recursively
-  auto addPath = [&](const std::string& p){
-    namespace fs = std::filesystem;
-    std::error_code ec;
-    fs::file_status st = fs::status(p, ec);
-    if (ec) return;
-    if (fs::is_directory(st)) {
-      for (auto& e : fs::recursive_directory_iterator(p, fs::directory_options::follow_directory_symlink)) {
-        const auto& path = e.path();
-        auto ext = path.extension().string();
-        if (ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".c" ||
-            ext == ".hpp" || ext == ".hh" || ext == ".h")
-          files.push_back(path.string());
-      }
-    } else {
-      files.push_back(p);
+  // Headers are passed along too: the analyzer covers each one once, inside
+  // the first TU that includes it.
+  DiscoverOptions dopts;
+  dopts.fromCompileDb = FromCompileDb;
+  dopts.gitignore = !NoGitignore;
+  dopts.excludes.assign(Exclude.begin(), Exclude.end());
+  dopts.jobs = Jobs;
+  dopts.compileDb = CompileDb;
+  dopts.cacheDir = CacheDir;
+  std::string derr;
+  if (!discoverFiles(roots, dopts, files, &derr)) {
+    err << derr << "\n";
+    return 1;
+  }
+  discoveryTimer.reset();
+
+  // A shard analyzes its part of the files and saves everything for
+  // `aicr merge`: issues, the fixes (applied only once merged) and timings
+  // for the next split, plus what project-wide rules need to report across
+  // shards
+  IssueStore shardIssues;
+  std::vector<FixIt> shardFixes;
+  RuleFacts shardFacts;
+  CostHistory measured;
+  std::string root;
+  if (!Shard.empty()) {
+    CostHistory history;
+    std::string e;
+    if (!ShardCosts.empty() && !history.load(ShardCosts, &e)) {
+      err << e << "\n";
+      return 1;
     }
-  };
-  for (const auto& p : Paths) addPath(p);
+    root = shardRoot(files.empty() ? roots.front() : files.front(), CompileDb);
+    files = selectShard(files, shard, history, root);
+    opts.fix = true;
+    opts.deferredFixes = &shardFixes;
+    opts.deferredFacts = &shardFacts;
+    opts.costs = &measured;
+  }
+
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  llvm::raw_ostream* os = Shard.empty() ? openOutput(out, err, file) : &out;
+  if (!os) return 1;
+
+  // Issues are written as each TU finishes rather than collected first
+  std::unique_ptr<Reporter> reporter;
+  if (Shard.empty()) reporter = makeReporter(*os);
+  else reporter = std::make_unique<StoreReporter>(shardIssues);
+  if (!BaselineWrite.empty())
+    reporter = std::make_unique<BaselineRecorder>(std::move(reporter), recorded);
 
-  std::vector<Issue> issues;
-  if (!cpp->analyzePaths(files, opts, ai.get(), issues)) {
-    std::cerr << "Analysis failed.\n";
+  reporter->begin();
+  bool ok = (!Shard.empty() && files.empty()) // more shards than files
+            || cpp->analyzePaths(files, opts, ai, *reporter);
+  reporter->end();
+  if (!ok) {
+    err << "Analysis failed.\n";
     return 1;
   }
+  if (!writeBaseline(recorded, err)) return 1;
+
+  if (!Shard.empty()) {
+    std::string e;
+    if (!writeShardResult(ShardOut, root, shard, shardIssues, shardFixes, measured, shardFacts, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+  } else if (!FixOutput.empty()) {
+    os->flush();
+    if (!writeFixOutput(fixes, opts.overlay, out, err)) return 1;
+  } else if (opts.fix) {
+    err << "\nApplied fixes where available.\n";
+  }
+
+  if (auto* p = Profiler::active()) {
+    os->flush();
+    p->print(err);
+    std::string e;
+    if (!ProfileJson.empty() && !p->writeJson(ProfileJson, &e)) err << e << "\n";
+  }
+  if (auto* t = Tracer::active()) {
+    std::string e;
+    if (!t->write(TraceFile, &e)) err << e << "\n";
+  }
+  return 0;
+}
+
+// `aicr merge`: one report and one fix set from every shard of a run
+static int merge(llvm::raw_ostream& out, llvm::raw_ostream& err) {
+  IssueStore issues;
+  std::vector<FixIt> fixes;
+  CostHistory measured;
+  RuleFacts facts;
+  std::vector<bool> seen;
+  std::set<std::string> shardRoots;
+  const std::string root = shardRoot(".", CompileDb);
+  for (const auto& path : MergeInputs) {
+    ShardResult r;
+    std::string e;
+    if (!readShardResult(path, root, r, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+    if (seen.empty()) seen.assign(r.spec.count, false);
+    if (r.spec.count != seen.size() || seen[r.spec.index]) {
+      err << path << ": shard " << r.spec.index << "/" << r.spec.count
+          << " doesn't fit with the other inputs\n";
+      return 1;
+    }
+    seen[r.spec.index] = true;
+    issues.append(std::move(r.issues));
+    fixes.insert(fixes.end(), std::make_move_iterator(r.fixes.begin()),
+                 std::make_move_iterator(r.fixes.end()));
+    measured.merge(r.costs);
+    shardRoots.insert(r.root);
+    for (auto& [id, blobs] : r.facts) {
+      auto& all = facts[id];
+      all.insert(all.end(), std::make_move_iterator(blobs.begin()),
+                 std::make_move_iterator(blobs.end()));
+    }
+  }
+  for (size_t i = 0; i < seen.size(); ++i)
+    if (!seen[i]) {
+      err << "Missing shard " << i << "/" << seen.size() << "\n";
+      return 1;
+    }
+
+  // Findings spanning shards, from what each one saw
+  std::vector<Issue> project;
+  finishRuleFacts(facts, project);
+  for (const auto& from : shardRoots) rebaseIssues(project, from, root);
+  issues.add(project);
+
+  // Shards run without --baseline still have their known issues
+  Baseline baseline, recorded;
+  if (!loadBaseline(baseline, err)) return 1;
+  if (!BaselineFile.empty()) issues.removeIf([&](const IssueStore::Entry& e) {
+    return baseline.contains(e.fingerprint);
+  });
 
-  // Pretty-print results
-  for (const auto& i : issues) {
-    std::cout << i.file << ":" << i.line << ":" << i.column
-              << " [" << i.id << "] " << i.message << "\n";
-    for (const auto& f : i.fixes) {
-      std::cout << "  fix: " << f.note << " (offset " << f.offset
-                << ", len " << f.length << ")\n";
+  // Headers are analyzed by every shard whose TUs include them
+  issues.sortByLocation();
+  issues.dedupe();
+
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  llvm::raw_ostream* os = openOutput(out, err, file);
+  if (!os) return 1;
+  std::unique_ptr<Reporter> reporter = makeReporter(*os);
+  if (!BaselineWrite.empty())
+    reporter = std::make_unique<BaselineRecorder>(std::move(reporter), recorded);
+  reporter->begin();
+  reporter->report(issues);
+  reporter->end();
+  if (!writeBaseline(recorded, err)) return 1;
+
+  if (Fix || !FixOutput.empty()) {
+    auto key = [](const FixIt& f) {
+      return std::tie(f.file, f.offset, f.length, f.replacement);
+    };
+    std::sort(fixes.begin(), fixes.end(),
+              [&](const FixIt& a, const FixIt& b) { return key(a) < key(b); });
+    fixes.erase(std::unique(fixes.begin(), fixes.end(),
+                            [&](const FixIt& a, const FixIt& b) { return key(a) == key(b); }),
+                fixes.end());
+    if (!FixOutput.empty()) {
+      os->flush();
+      if (!writeFixOutput(fixes, nullptr, out, err)) return 1;
+    } else {
+      ApplyOptions ao;
+      ao.backup = !NoBackup;
+      ao.jobs = Jobs;
+      ApplyStats st;
+      std::string e;
+      if (!RefactorEngine::applyFixes(fixes, ao, &e, &st)) {
+        err << "Apply failed: " << e << "\n";
+        return 1;
+      }
+      if (st.rejected)
+        err << "Skipped " << st.rejected << " fix(es) overlapping an earlier edit\n";
+      err << "\nApplied fixes where available.\n";
     }
   }
 
-  if (opts.fix) std::cout << "\nApplied fixes where available.\n";
+  if (!ShardCosts.empty()) {
+    CostHistory history;
+    std::string e;
+    if (!history.load(ShardCosts, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+    history.merge(measured);
+    history.prune(root);
+    if (!history.save(ShardCosts, &e)) {
+      err << e << "\n";
+      return 1;
+    }
+  }
   return 0;
 }
+
+static int dispatch(llvm::raw_ostream& out, llvm::raw_ostream& err) {
+  if (Fix && !FixOutput.empty()) {
+    err << "--fix and --fix-output are exclusive: --fix-output leaves the sources untouched\n";
+    return 1;
+  }
+  return MergeCmd ? merge(out, err) : run(out, err);
+}
+
+// Requests carry the client's full command line; it is parsed into the same
+// options a direct run uses, after resetting what the previous request set.
+static int serveRequests() {
+  // Unless the client names one, results go to a cache owned by the server,
+  // so unchanged TUs are replayed rather than reparsed
+  std::string cacheDir = CacheDir.empty() ? Serve + ".cache" : std::string(CacheDir);
+  std::string socket = Serve;
+
+  return serve(socket, [&](const ServeRequest& req, llvm::raw_ostream& out,
+                           llvm::raw_ostream& err) {
+    if (::chdir(req.cwd.c_str()) != 0) {
+      err << "Cannot enter " << req.cwd << "\n";
+      return 1;
+    }
+    // These print and exit() from inside the parser, which would end the
+    // server; a client runs them itself before connecting
+    for (size_t i = 1; i < req.args.size(); ++i) {
+      llvm::StringRef arg = req.args[i];
+      if (arg == "--") break;
+      llvm::StringRef name = arg.ltrim('-').split('=').first;
+      if (arg.starts_with("-") && (name == "help" || name.starts_with("help-") || name == "version")) {
+        err << req.args[i] << " cannot be forwarded to a server\n";
+        return 1;
+      }
+    }
+    llvm::cl::ResetAllOptionOccurrences();
+    std::vector<const char*> argv;
+    for (const auto& a : req.args) argv.push_back(a.c_str());
+    if (!llvm::cl::ParseCommandLineOptions((int)argv.size(), argv.data(), kOverview, &err))
+      return 1;
+    if (!Serve.empty() || !Connect.empty()) {
+      err << "--serve and --connect cannot be forwarded to a server\n";
+      return 1;
+    }
+    if (CacheDir.empty()) CacheDir = cacheDir;
+    RequestInput = req.hasInput ? &req.input : nullptr;
+    int rc = dispatch(out, err);
+    RequestInput = nullptr;
+    Profiler::disable();
+    Tracer::disable();
+    return rc;
+  });
+}
+
+int main(int argc, const char** argv) {
+  llvm::cl::HideUnrelatedOptions(ToolCat);
+  llvm::cl::ParseCommandLineOptions(argc, argv, kOverview);
+
+  if (!Serve.empty()) return serveRequests();
+
+  if (!Connect.empty()) {
+    ServeRequest req;
+    llvm::SmallString<256> cwd;
+    llvm::sys::fs::current_path(cwd);
+    req.cwd = std::string(cwd.str());
+    for (int i = 0; i < argc; ++i) {
+      llvm::StringRef a = argv[i];
+      if (a == "-connect" || a == "--connect") { ++i; continue; }
+      if (a.starts_with("-connect=") || a.starts_with("--connect=")) continue;
+      req.args.push_back(a.str());
+    }
+    // The server can't see our stdin, so what it would read travels along
+    if (!StdinFile.empty() || OverlayFile == "-") {
+      if (!readStdin(req.input, llvm::errs())) return 1;
+      req.hasInput = true;
+    }
+    std::string e;
+    int rc = runClient(Connect, req, &e);
+    if (rc < 0) {
+      llvm::errs() << e << "\n";
+      return 1;
+    }
+    return rc;
+  }
+
+  return dispatch(llvm::outs(), llvm::errs());
+}
@@ -0,0 +1,210 @@
+#include "profile/Profiler.hpp"
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <ctime>
+
+namespace aicr {
+
+Profiler* Profiler::instance_ = nullptr;
+
+void Profiler::enable() {
+  if (!instance_) instance_ = new Profiler(); // lives until exit
+}
+
+void Profiler::disable() {
+  delete instance_;
+  instance_ = nullptr;
+}
+
+double threadCpuMs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double processCpuMs() {
+  return (double)std::clock() * 1e3 / CLOCKS_PER_SEC;
+}
+
+void LatencyHistogram::add(uint64_t us) {
+  unsigned b = 0;
+  while (b + 1 < buckets.size() && (us >> (b + 1))) ++b;
+  buckets[b].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  totalUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+void Profiler::mergeRule(const std::string& id, const TimeStats& s) {
+  std::lock_guard<std::mutex> lock(m_);
+  rules_[id].add(s);
+}
+
+void Profiler::mergeMatcher(const std::string& id, const TimeStats& s) {
+  std::lock_guard<std::mutex> lock(m_);
+  matchers_[id].add(s);
+}
+
+void Profiler::addStage(const std::string& stage, const TimeStats& s) {
+  std::lock_guard<std::mutex> lock(m_);
+  stages_[stage].add(s);
+}
+
+void Profiler::addTU(TUProfile tu) {
+  std::lock_guard<std::mutex> lock(m_);
+  tus_.push_back(std::move(tu));
+}
+
+LatencyHistogram& Profiler::aiLatency(const std::string& call) {
+  std::lock_guard<std::mutex> lock(m_);
+  return ai_[call];
+}
+
+static void printTable(llvm::raw_ostream& os, const char* title,
+                       const std::map<std::string, TimeStats>& m) {
+  if (m.empty()) return;
+  os << title << "\n";
+  os << "  name                              calls      wall ms       cpu ms     issues\n";
+  for (const auto& [name, s] : m) {
+    os << llvm::format("  %-28s %10llu %12.2f %12.2f %10llu\n", name.c_str(),
+                       (unsigned long long)s.calls, s.wallMs, s.cpuMs,
+                       (unsigned long long)s.issues);
+  }
+}
+
+std::map<std::string, TimeStats> Profiler::stageTotals() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return stages_;
+}
+
+std::map<std::string, TimeStats> Profiler::ruleTotals() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return rules_;
+}
+
+std::vector<TUProfile> Profiler::tuProfiles() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return tus_;
+}
+
+void Profiler::print(llvm::raw_ostream& os) const {
+  std::lock_guard<std::mutex> lock(m_);
+  os << "=== aicr profile ===\n";
+  printTable(os, "Stages:", stages_);
+  printTable(os, "Rules:", rules_);
+  printTable(os, "Matchers (Clang profiling):", matchers_);
+
+  for (const auto& [call, h] : ai_) {
+    uint64_t n = h.count.load();
+    if (!n) continue;
+    os << "AI " << call << ": " << n << " calls, mean "
+       << llvm::format("%.1f", (double)h.totalUs.load() / n) << " us\n";
+    for (size_t b = 0; b < h.buckets.size(); ++b) {
+      uint64_t c = h.buckets[b].load();
+      if (c) os << llvm::format("  [%8llu us, %8llu us) %llu\n", b ? 1ull << b : 0ull,
+                                2ull << b, (unsigned long long)c);
+    }
+  }
+
+  if (!tus_.empty()) {
+    auto tus = tus_;
+    std::sort(tus.begin(), tus.end(),
+              [](const TUProfile& a, const TUProfile& b) { return a.totalMs > b.totalMs; });
+    os << "Slowest TUs (parse = total - match):\n";
+    for (size_t i = 0; i < tus.size() && i < 10; ++i) {
+      const auto& t = tus[i];
+      os << llvm::format("  %10.2f ms  parse %10.2f  match %10.2f  ", t.totalMs,
+                         t.totalMs - t.matchMs, t.matchMs)
+         << t.file << (t.cached ? " (cached)" : "") << "\n";
+    }
+    printMemoryTable(os, std::move(tus), 10);
+  }
+}
+
+void printMemoryTable(llvm::raw_ostream& os, std::vector<TUProfile> tus, size_t limit) {
+  std::sort(tus.begin(), tus.end(), [](const TUProfile& a, const TUProfile& b) {
+    return a.astBytes + a.sourceBytes + a.ppBytes > b.astBytes + b.sourceBytes + b.ppBytes;
+  });
+  os << "Largest TUs (MiB held once parsed):\n";
+  for (size_t i = 0; i < tus.size() && i < limit && !tus[i].cached; ++i) {
+    const auto& t = tus[i];
+    auto mib = [](uint64_t b) { return (double)b / (1 << 20); };
+    os << llvm::format("  %10.1f  ast %9.1f  sources %9.1f  pp %8.1f  issues %6llu  ",
+                       mib(t.astBytes + t.sourceBytes + t.ppBytes), mib(t.astBytes),
+                       mib(t.sourceBytes), mib(t.ppBytes), (unsigned long long)t.issues)
+       << t.file << (t.fallback ? " (bodies skipped)" : "") << "\n";
+  }
+}
+
+static llvm::json::Object toJson(const TimeStats& s) {
+  return llvm::json::Object{{"calls", (int64_t)s.calls}, {"wall_ms", s.wallMs},
+                            {"cpu_ms", s.cpuMs}, {"issues", (int64_t)s.issues}};
+}
+
+static llvm::json::Object toJson(const std::map<std::string, TimeStats>& m) {
+  llvm::json::Object o;
+  for (const auto& [name, s] : m) o[name] = toJson(s);
+  return o;
+}
+
+bool Profiler::writeJson(const std::string& path, std::string* error) const {
+  std::lock_guard<std::mutex> lock(m_);
+  llvm::json::Object root;
+  root["stages"] = toJson(stages_);
+  root["rules"] = toJson(rules_);
+  root["matchers"] = toJson(matchers_);
+
+  llvm::json::Object ai;
+  for (const auto& [call, h] : ai_) {
+    llvm::json::Array buckets;
+    for (const auto& b : h.buckets) buckets.push_back((int64_t)b.load());
+    ai[call] = llvm::json::Object{{"calls", (int64_t)h.count.load()},
+                                  {"total_us", (int64_t)h.totalUs.load()},
+                                  {"log2_us_buckets", std::move(buckets)}};
+  }
+  root["ai"] = std::move(ai);
+
+  llvm::json::Array tus;
+  for (const auto& t : tus_) {
+    tus.push_back(llvm::json::Object{{"file", t.file}, {"total_ms", t.totalMs},
+                                     {"parse_ms", t.totalMs - t.matchMs},
+                                     {"match_ms", t.matchMs}, {"cached", t.cached},
+                                     {"fallback", t.fallback},
+                                     {"ast_bytes", (int64_t)t.astBytes},
+                                     {"source_bytes", (int64_t)t.sourceBytes},
+                                     {"pp_bytes", (int64_t)t.ppBytes},
+                                     {"issues", (int64_t)t.issues}});
+  }
+  root["tus"] = std::move(tus);
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    if (error) *error = "Failed to write " + path + ": " + ec.message();
+    return false;
+  }
+  os << llvm::formatv("{0:2}", llvm::json::Value(std::move(root))) << "\n";
+  return true;
+}
+
+StageTimer::StageTimer(const char* stage)
+  : stage_(stage), p_(Profiler::active()), span_("stage", stage) {
+  if (!p_) return;
+  wall_ = std::chrono::steady_clock::now();
+  cpu_ = processCpuMs();
+}
+
+StageTimer::~StageTimer() {
+  if (!p_) return;
+  TimeStats s;
+  s.calls = 1;
+  s.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_).count();
+  s.cpuMs = processCpuMs() - cpu_;
+  p_->addStage(stage_, s);
+}
+
+} // namespace aicr
@@ -0,0 +1,129 @@
+#include "profile/Trace.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+
+namespace aicr {
+
+namespace {
+
+// Small stable ids make for readable tracks; OS thread ids don't
+uint32_t threadId() {
+  static std::atomic<uint32_t> next{1};
+  thread_local uint32_t id = next++;
+  return id;
+}
+
+thread_local uint64_t clangTraceStart = 0; // when this thread's Clang profiler began
+
+} // namespace
+
+Tracer* Tracer::instance_ = nullptr;
+
+Tracer::Tracer(unsigned granularityUs)
+  : granularityUs_(granularityUs), start_(std::chrono::steady_clock::now()) {}
+
+void Tracer::enable(unsigned granularityUs) {
+  if (!instance_) instance_ = new Tracer(granularityUs); // lives until exit
+}
+
+void Tracer::disable() {
+  delete instance_;
+  instance_ = nullptr;
+}
+
+uint64_t Tracer::now() const {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - start_).count();
+}
+
+void Tracer::complete(const char* cat, llvm::StringRef name, llvm::StringRef detail,
+                      uint64_t startUs, uint64_t durUs) {
+  if (durUs < granularityUs_) return;
+  uint32_t tid = threadId();
+  std::lock_guard<std::mutex> lock(m_);
+  events_.push_back({cat, name.str(), detail.str(), startUs, durUs, tid});
+}
+
+void Tracer::beginClangTrace() {
+  clangTraceStart = now();
+  llvm::timeTraceProfilerInitialize(granularityUs_, "aicr");
+}
+
+void Tracer::endClangTrace() {
+  if (!llvm::timeTraceProfilerEnabled()) return;
+  llvm::SmallString<0> buf;
+  llvm::raw_svector_ostream os(buf);
+  llvm::timeTraceProfilerWrite(os);
+  llvm::timeTraceProfilerCleanup();
+
+  // Clang's timestamps count from when its profiler started. Its "Total"
+  // summary events and metadata are left out.
+  auto v = llvm::json::parse(buf);
+  if (!v) {
+    llvm::consumeError(v.takeError());
+    return;
+  }
+  const auto* root = v->getAsObject();
+  const auto* events = root ? root->getArray("traceEvents") : nullptr;
+  if (!events) return;
+  uint32_t tid = threadId();
+  std::lock_guard<std::mutex> lock(m_);
+  for (const auto& ev : *events) {
+    const auto* o = ev.getAsObject();
+    if (!o || o->getString("ph") != llvm::StringRef("X")) continue;
+    auto name = o->getString("name");
+    auto ts = o->getInteger("ts");
+    auto dur = o->getInteger("dur");
+    if (!name || !ts || !dur || name->starts_with("Total ")) continue;
+    llvm::StringRef detail;
+    if (const auto* args = o->getObject("args"))
+      if (auto d = args->getString("detail")) detail = *d;
+    events_.push_back({"clang", name->str(), detail.str(), clangTraceStart + (uint64_t)*ts,
+                       (uint64_t)*dur, tid});
+  }
+}
+
+bool Tracer::write(const std::string& path, std::string* error) const {
+  std::lock_guard<std::mutex> lock(m_);
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    if (error) *error = "Failed to write " + path + ": " + ec.message();
+    return false;
+  }
+  llvm::json::OStream J(os);
+  J.object([&] {
+    J.attributeArray("traceEvents", [&] {
+      J.object([&] {
+        J.attribute("ph", "M");
+        J.attribute("name", "process_name");
+        J.attribute("pid", 1);
+        J.attribute("tid", 0);
+        J.attributeObject("args", [&] { J.attribute("name", "aicr"); });
+      });
+      for (const auto& e : events_) {
+        J.object([&] {
+          J.attribute("ph", "X");
+          J.attribute("pid", 1);
+          J.attribute("tid", (int64_t)e.tid);
+          J.attribute("ts", (int64_t)e.ts);
+          J.attribute("dur", (int64_t)e.dur);
+          J.attribute("cat", e.cat);
+          J.attribute("name", e.name);
+          if (!e.detail.empty())
+            J.attributeObject("args", [&] { J.attribute("detail", e.detail); });
+        });
+      }
+    });
+    J.attribute("displayTimeUnit", "ms");
+  });
+  os << "\n";
+  return true;
+}
+
+} // namespace aicr
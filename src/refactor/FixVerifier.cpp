@@ -0,0 +1,245 @@
+#include "refactor/FixVerifier.hpp"
+#include "analyzers/Overlay.hpp"
+#include "compiledb/IncludeGraph.hpp"
+#include "discovery/FileDiscovery.hpp"
+#include "profile/Trace.hpp"
+#include "refactor/RefactorEngine.hpp"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace clang;
+using namespace clang::tooling;
+
+namespace aicr {
+
+namespace {
+
+// Errors of one parse by file and diagnostic kind. Lines move with the
+// edits, and messages name the identifiers a rename changes, so neither
+// can tell an old error from a new one.
+using ErrorCounts = std::map<std::string, unsigned>;
+
+class ErrorCollector : public DiagnosticConsumer {
+  ErrorCounts& Errors;
+public:
+  explicit ErrorCollector(ErrorCounts& errors) : Errors(errors) {}
+
+  void HandleDiagnostic(DiagnosticsEngine::Level level, const Diagnostic& info) override {
+    DiagnosticConsumer::HandleDiagnostic(level, info);
+    if (level < DiagnosticsEngine::Error) return;
+    std::string key;
+    if (info.getLocation().isValid() && info.hasSourceManager()) {
+      const SourceManager& SM = info.getSourceManager();
+      key = SM.getFilename(SM.getFileLoc(info.getLocation())).str();
+    }
+    key += ": ";
+    key += std::to_string(info.getID());
+    ++Errors[key];
+  }
+};
+
+// Syntax-only parse of `tu` with the overlay's buffers in place of the disk's.
+// Diagnostics are only counted, never printed.
+void parseErrors(const CompilationDatabase& db, const std::string& tu,
+                 const std::vector<std::string>& args, const Overlay* overlay,
+                 ErrorCounts& out) {
+  TraceSpan span("verify", tu);
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS =
+    overlay ? overlay->fileSystem() : llvm::vfs::createPhysicalFileSystem();
+  ClangTool Tool(db, {tu}, std::make_shared<PCHContainerOperations>(), FS);
+  Tool.appendArgumentsAdjuster(getInsertArgumentAdjuster(args, ArgumentInsertPosition::BEGIN));
+  ErrorCollector diags(out);
+  Tool.setDiagnosticConsumer(&diags);
+  Tool.setPrintErrorMessage(false);
+  Tool.run(newFrontendActionFactory<SyntaxOnlyAction>().get());
+}
+
+template <class Fn>
+void parallelFor(size_t n, unsigned jobs, Fn fn) {
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i = next++; i < n; i = next++) fn(i);
+  };
+  jobs = std::max(1u, std::min<unsigned>(jobs, n));
+  if (jobs == 1) {
+    work();
+    return;
+  }
+  std::vector<std::thread> pool;
+  pool.reserve(jobs);
+  for (unsigned t = 0; t < jobs; ++t) pool.emplace_back(work);
+  for (auto& th : pool) th.join();
+}
+
+} // namespace
+
+void verifyFixes(const CompilationDatabase& db, std::vector<FixIt>& fixes,
+                 const VerifyOptions& opts, VerifyStats* stats) {
+  VerifyStats st;
+  if (fixes.empty()) {
+    if (stats) *stats = st;
+    return;
+  }
+  unsigned jobs = opts.jobs ? opts.jobs : std::thread::hardware_concurrency();
+
+  // A rename stands or falls as a whole
+  std::vector<size_t> setOf(fixes.size());
+  std::map<std::string, size_t> bySymbol;
+  size_t sets = 0;
+  for (size_t i = 0; i < fixes.size(); ++i) {
+    if (fixes[i].symbol.empty()) {
+      setOf[i] = sets++;
+      continue;
+    }
+    auto [it, inserted] = bySymbol.emplace(fixes[i].symbol, sets);
+    if (inserted) ++sets;
+    setOf[i] = it->second;
+  }
+
+  // Every TU reading an edited file, with the sets that edit what it reads.
+  // A file no TU reads is parsed on its own.
+  IncludeGraph graph(opts.graphFile);
+  graph.update(db, opts.tus, opts.args, jobs);
+  std::map<std::string, std::set<size_t>> setsByFile;
+  for (size_t i = 0; i < fixes.size(); ++i) setsByFile[realPath(fixes[i].file)].insert(setOf[i]);
+  std::map<std::string, std::set<size_t>> setsByTU;
+  for (const auto& [file, s] : setsByFile) {
+    auto readers = graph.affected({file});
+    if (readers.empty()) readers.push_back(file);
+    for (const auto& tu : readers) setsByTU[tu].insert(s.begin(), s.end());
+  }
+  std::vector<std::string> tus;
+  std::vector<const std::set<size_t>*> tuSets;
+  for (const auto& [tu, s] : setsByTU) {
+    tus.push_back(tu);
+    tuSets.push_back(&s);
+  }
+  st.tus = tus.size();
+
+  // Errors before the edits are only parsed for TUs with some after them
+  std::vector<ErrorCounts> before(tus.size());
+  std::vector<std::once_flag> beforeOnce(tus.size());
+
+  // Does TU `t` gain errors with the sets in `active` applied?
+  auto breaks = [&](size_t t, const std::vector<bool>& active) {
+    std::vector<FixIt> subset;
+    for (size_t i = 0; i < fixes.size(); ++i)
+      if (active[setOf[i]] && tuSets[t]->count(setOf[i])) subset.push_back(fixes[i]);
+    std::vector<FileEdits> files;
+    if (!RefactorEngine::planFixes(subset, opts.overlay, files, nullptr))
+      return true; // would fail to apply anyway
+    Overlay edited = opts.overlay ? *opts.overlay : Overlay();
+    for (const auto& fe : files) edited.set(fe.file, fe.apply());
+
+    ErrorCounts after;
+    parseErrors(db, tus[t], opts.args, &edited, after);
+    if (after.empty()) return false;
+    std::call_once(beforeOnce[t], [&] {
+      parseErrors(db, tus[t], opts.args, opts.overlay, before[t]);
+    });
+    for (const auto& [k, n] : after) {
+      auto it = before[t].find(k);
+      if (it == before[t].end() || it->second < n) return true;
+    }
+    return false;
+  };
+
+  std::vector<bool> keep(sets, true);
+  std::vector<const std::string*> blamed(sets, nullptr); // first TU a set broke
+
+  // The sets TU `t` reads that a failure with `keep` applied is down to:
+  // the shortest breaking prefix of its sets ends in one, found by
+  // bisection; it goes, and the search repeats on the rest until they
+  // parse. A set that only breaks next to another loses alone, and the
+  // cost is a few parses per culprit rather than one per set.
+  auto isolate = [&](size_t t) {
+    std::vector<size_t> live;
+    for (size_t s : *tuSets[t])
+      if (keep[s]) live.push_back(s);
+    auto prefixBreaks = [&](size_t n) {
+      std::vector<bool> active(sets, false);
+      for (size_t k = 0; k < n; ++k) active[live[k]] = true;
+      return breaks(t, active);
+    };
+    std::vector<size_t> culprits;
+    while (!live.empty()) {
+      size_t lo = 1, hi = live.size(); // prefixBreaks(hi) holds
+      while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (prefixBreaks(mid)) hi = mid;
+        else lo = mid + 1;
+      }
+      culprits.push_back(live[lo - 1]);
+      live.erase(live.begin() + (lo - 1));
+      if (live.empty() || !prefixBreaks(live.size())) break;
+    }
+    return culprits;
+  };
+
+  std::vector<size_t> failing(tus.size());
+  for (size_t t = 0; t < tus.size(); ++t) failing[t] = t;
+  while (!failing.empty()) {
+    std::vector<char> failed(failing.size());
+    parallelFor(failing.size(), jobs, [&](size_t k) { failed[k] = breaks(failing[k], keep); });
+    std::vector<size_t> broken;
+    for (size_t k = 0; k < failing.size(); ++k)
+      if (failed[k]) broken.push_back(failing[k]);
+    if (broken.empty()) break;
+
+    std::vector<std::vector<size_t>> culprits(broken.size());
+    parallelFor(broken.size(), jobs, [&](size_t k) { culprits[k] = isolate(broken[k]); });
+    std::set<size_t> dropped;
+    for (size_t k = 0; k < broken.size(); ++k) {
+      for (size_t s : culprits[k]) {
+        if (!keep[s]) continue;
+        keep[s] = false;
+        blamed[s] = &tus[broken[k]];
+        dropped.insert(s);
+      }
+    }
+
+    // Sets are dropped as a whole, so only TUs reading one may parse
+    // differently now: check those again
+    failing.clear();
+    for (size_t t = 0; t < tus.size(); ++t)
+      if (std::any_of(tuSets[t]->begin(), tuSets[t]->end(),
+                      [&](size_t s) { return dropped.count(s) != 0; }))
+        failing.push_back(t);
+  }
+
+  std::vector<FixIt> kept;
+  kept.reserve(fixes.size());
+  std::vector<bool> reported(sets, false);
+  for (size_t i = 0; i < fixes.size(); ++i) {
+    size_t s = setOf[i];
+    if (keep[s]) {
+      kept.push_back(std::move(fixes[i]));
+      continue;
+    }
+    ++st.rejectedFixes;
+    if (reported[s]) continue;
+    reported[s] = true;
+    ++st.rejectedSets;
+    llvm::errs() << "Rejected fix \"" << fixes[i].note << "\" in " << fixes[i].file
+                 << ": " << *blamed[s] << " no longer compiles with it\n";
+  }
+  fixes = std::move(kept);
+  if (stats) *stats = st;
+}
+
+} // namespace aicr
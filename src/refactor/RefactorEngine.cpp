@@ -1,62 +1,436 @@
 #include "refactor/RefactorEngine.hpp"
-#include <fstream>
-#include <sstream>
-#include <unordered_map>
+#include "analyzers/Overlay.hpp"
+#include "profile/Trace.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <map>
+#include <thread>
+#include <tuple>
 
 namespace fs = std::filesystem;
 namespace aicr {
 
-static bool readFile(const std::string& path, std::string& out) {
-  std::ifstream ifs(path, std::ios::binary);
-  if (!ifs) return false;
-  std::ostringstream ss; ss << ifs.rdbuf(); out = ss.str();
+namespace {
+
+struct FileResult {
+  bool ok = true;
+  std::string error;
+  ApplyStats stats;
+};
+
+// Sort by position with insertions before replacements at the same
+// offset, then by text: identical edits end up next to each other, where
+// the merge below sees them, and the order doesn't depend on which fix was
+// produced first
+void sortEdits(std::vector<const FixIt*>& edits) {
+  std::stable_sort(edits.begin(), edits.end(), [](const FixIt* a, const FixIt* b) {
+    return std::tie(a->offset, a->length, a->replacement) <
+           std::tie(b->offset, b->length, b->replacement);
+  });
+}
+
+bool writeAtomically(const std::string& path, const std::string& data, std::string& error) {
+  int fd = -1;
+  llvm::SmallString<256> tmp;
+  if (auto ec = llvm::sys::fs::createUniqueFile(path + ".%%%%%%.aicr-tmp", fd, tmp)) {
+    error = "Failed to create temp file for " + path + ": " + ec.message();
+    return false;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << data;
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tmp);
+      error = "Failed to write " + path;
+      return false;
+    }
+  }
+
+  // Keep the original's permission bits
+  std::error_code ec;
+  auto perms = fs::status(path, ec).permissions();
+  if (!ec) fs::permissions(std::string(tmp.str()), perms, ec);
+
+  if (auto rc = llvm::sys::fs::rename(tmp, path)) {
+    llvm::sys::fs::remove(tmp);
+    error = "Failed to replace " + path + ": " + rc.message();
+    return false;
+  }
   return true;
 }
 
-static bool writeFile(const std::string& path, const std::string& data) {
-  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
-  if (!ofs) return false;
-  ofs << data;
+// The overlay's buffer for `file` if it has one, else the file as mapped
+bool loadFile(const std::string& file, const Overlay* overlay,
+              std::unique_ptr<llvm::MemoryBuffer>& buf, llvm::StringRef& content,
+              std::string& error) {
+  if (overlay) {
+    if (const std::string* s = overlay->find(file)) {
+      content = *s;
+      return true;
+    }
+  }
+  auto b = llvm::MemoryBuffer::getFile(file, /*IsText=*/false,
+                                       /*RequiresNullTerminator=*/false);
+  if (!b) {
+    error = "Failed to read " + file;
+    return false;
+  }
+  buf = std::move(*b);
+  content = buf->getBuffer();
   return true;
 }
 
-bool RefactorEngine::applyFixes(const std::vector<FixIt>& fixes, bool backup, std::string* error) {
-  // group fixes by file
-  std::unordered_map<std::string, std::vector<FixIt>> byFile;
-  for (const auto& f : fixes) byFile[f.file].push_back(f);
+// Validate and pick the edits to keep before touching anything
+bool selectEdits(const std::string& file, llvm::StringRef content,
+                 std::vector<const FixIt*>& edits, std::vector<const FixIt*>& keep,
+                 FileResult& r) {
+  sortEdits(edits);
 
-  for (auto& [file, vec] : byFile) {
-    std::string content;
-    if (!readFile(file, content)) {
-      if (error) *error = "Failed to read " + file;
+  keep.reserve(edits.size());
+  size_t end = 0;          // end of the last kept edit in the original
+  for (const FixIt* f : edits) {
+    if ((size_t)f->offset + f->length > content.size()) {
+      r.ok = false;
+      r.error = "Out-of-range fix in " + file;
       return false;
     }
+    if (!keep.empty()) {
+      const FixIt* last = keep.back();
+      if (f->offset == last->offset && f->length == last->length &&
+          f->replacement == last->replacement) {
+        r.stats.merged++;
+        continue;
+      }
+      if (f->offset < end) {
+        r.stats.rejected++;
+        continue;
+      }
+    }
+    keep.push_back(f);
+    end = (size_t)f->offset + f->length;
+  }
+  return true;
+}
+
+// One linear splice: unchanged spans are copied straight from the original
+template <class Edits, class Deref>
+std::string splice(llvm::StringRef content, const Edits& keep, Deref edit) {
+  size_t outSize = content.size();
+  for (const auto& k : keep) outSize = outSize - edit(k).length + edit(k).replacement.size();
+  std::string out;
+  out.reserve(outSize);
+  size_t pos = 0;
+  for (const auto& k : keep) {
+    const FixIt& f = edit(k);
+    out.append(content.data() + pos, f.offset - pos);
+    out += f.replacement;
+    pos = (size_t)f.offset + f.length;
+  }
+  out.append(content.data() + pos, content.size() - pos);
+  return out;
+}
+
+FileResult applyToFile(const std::string& file, std::vector<const FixIt*>& edits,
+                       const ApplyOptions& opts) {
+  TraceSpan span("apply", "write", file);
+  FileResult r;
+  std::unique_ptr<llvm::MemoryBuffer> buf;
+  llvm::StringRef content;
+  if (!loadFile(file, opts.overlay, buf, content, r.error)) {
+    r.ok = false;
+    return r;
+  }
 
-    if (backup) {
-      std::error_code ec;
-      fs::copy_file(file, file + ".bak", fs::copy_options::overwrite_existing, ec);
+  std::vector<const FixIt*> keep;
+  if (!selectEdits(file, content, edits, keep, r)) return r;
+  std::string out = splice(content, keep, [](const FixIt* f) -> const FixIt& { return *f; });
+
+  if (opts.backup) {
+    std::error_code ec;
+    fs::copy_file(file, file + ".bak", fs::copy_options::overwrite_existing, ec);
+  }
+
+  if (!writeAtomically(file, out, r.error)) {
+    r.ok = false;
+    return r;
+  }
+  r.stats.files = 1;
+  r.stats.applied = keep.size();
+  return r;
+}
+
+// Where each line of a text starts, for offset <-> line/column lookups
+class LineTable {
+  llvm::StringRef Text;
+  std::vector<size_t> Starts;
+public:
+  explicit LineTable(llvm::StringRef text) : Text(text) {
+    if (text.empty()) return;
+    Starts.push_back(0);
+    for (size_t i = 0; i + 1 < text.size(); ++i)
+      if (text[i] == '\n') Starts.push_back(i + 1);
+  }
+  size_t lines() const { return Starts.size(); }
+  size_t begin(size_t line) const { return line < Starts.size() ? Starts[line] : Text.size(); }
+  size_t end(size_t line) const { return line + 1 < Starts.size() ? Starts[line + 1] : Text.size(); }
+  // 0-based line holding `offset`; the end of the text belongs to the last line
+  size_t lineOf(size_t offset) const {
+    if (Starts.empty()) return 0;
+    return std::upper_bound(Starts.begin(), Starts.end(), offset) - Starts.begin() - 1;
+  }
+};
+
+// Lines of `text`, each with its newline if it has one
+std::vector<llvm::StringRef> splitLines(llvm::StringRef text) {
+  std::vector<llvm::StringRef> out;
+  while (!text.empty()) {
+    size_t nl = text.find('\n');
+    size_t n = nl == llvm::StringRef::npos ? text.size() : nl + 1;
+    out.push_back(text.take_front(n));
+    text = text.drop_front(n);
+  }
+  return out;
+}
+
+bool under(llvm::StringRef file, llvm::StringRef dir) {
+  return file.consume_front(dir) && (dir.ends_with("/") || file.starts_with("/"));
+}
+
+// One directory every path in the diff is relative to: the current one when
+// all files are under it, otherwise the deepest one they and it share.
+// `patch -p1` can't follow `..`, so the diff must be applied from there.
+std::string diffBase(const std::vector<FileEdits>& files) {
+  llvm::SmallString<256> cwd;
+  if (llvm::sys::fs::current_path(cwd)) return {};
+  std::string base(cwd.str());
+  for (const auto& fe : files) {
+    if (!llvm::sys::path::is_absolute(fe.file)) continue;
+    while (base != "/" && !under(fe.file, base)) {
+      llvm::StringRef up = llvm::sys::path::parent_path(base);
+      base = up.empty() ? "/" : up.str();
     }
+  }
+  return base;
+}
 
-    // apply from highest offset → lowest to keep offsets valid
-    std::sort(vec.begin(), vec.end(), [](const FixIt& a, const FixIt& b) {
-      return a.offset > b.offset;
-    });
+std::string diffPath(const std::string& file, const std::string& base, const char* side) {
+  llvm::StringRef f(file);
+  if (!base.empty() && under(f, base)) {
+    f = f.drop_front(base.size());
+    f.consume_front("/");
+  }
+  return side + f.str();
+}
+
+void writeFileDiff(const FileEdits& fe, const std::string& base, llvm::raw_ostream& os) {
+  constexpr size_t kContext = 3;
+  llvm::StringRef text = fe.original;
+  LineTable lines(text);
 
-    for (const auto& f : vec) {
-      if (f.offset + f.length > content.size()) {
-        if (error) *error = "Out-of-range fix in " + file;
-        return false;
+  // Edits become changes to whole lines; edits sharing a line form one change
+  struct Change {
+    size_t first, last;   // old lines replaced, inclusive
+    size_t from, to;      // their edits, as indices into fe.edits
+  };
+  std::vector<Change> changes;
+  for (size_t i = 0; i < fe.edits.size(); ++i) {
+    const FixIt& f = fe.edits[i];
+    size_t first = lines.lineOf(f.offset);
+    size_t last = f.length ? lines.lineOf(f.offset + f.length - 1) : first;
+    if (!changes.empty() && first <= changes.back().last) {
+      changes.back().last = std::max(changes.back().last, last);
+      changes.back().to = i + 1;
+    } else {
+      changes.push_back({first, last, i, i + 1});
+    }
+  }
+
+  struct Line { char tag; llvm::StringRef text; };
+  std::vector<std::string> after(changes.size());
+  bool header = false;
+  long delta = 0; // new minus old lines before the current hunk
+  for (size_t c = 0; c < changes.size();) {
+    // Changes whose context would touch go into one hunk
+    size_t e = c + 1;
+    while (e < changes.size() && changes[e].first <= changes[e - 1].last + 1 + 2 * kContext) ++e;
+
+    size_t begin = changes[c].first > kContext ? changes[c].first - kContext : 0;
+    size_t end = std::min(lines.lines(), changes[e - 1].last + 1 + kContext);
+    std::vector<Line> hunk;
+    size_t oldCount = 0, newCount = 0;
+    bool changed = false;
+    size_t at = begin;
+    for (size_t k = c; k < e; ++k) {
+      const Change& ch = changes[k];
+      for (; at < ch.first; ++at, ++oldCount, ++newCount)
+        hunk.push_back({' ', text.slice(lines.begin(at), lines.end(at))});
+      size_t segBegin = lines.begin(ch.first), segEnd = lines.end(ch.last);
+      llvm::StringRef seg = text.slice(segBegin, segEnd);
+      std::vector<FixIt> local(fe.edits.begin() + ch.from, fe.edits.begin() + ch.to);
+      for (auto& f : local) f.offset -= segBegin;
+      after[k] = splice(seg, local, [](const FixIt& f) -> const FixIt& { return f; });
+      auto oldLines = splitLines(seg), newLines = splitLines(after[k]);
+      changed = changed || after[k] != seg;
+      for (auto l : oldLines) hunk.push_back({'-', l});
+      for (auto l : newLines) hunk.push_back({'+', l});
+      oldCount += oldLines.size();
+      newCount += newLines.size();
+      at = std::max(at, ch.last + 1);
+    }
+    for (; at < end; ++at, ++oldCount, ++newCount)
+      hunk.push_back({' ', text.slice(lines.begin(at), lines.end(at))});
+
+    if (changed) {
+      if (!header) {
+        os << "--- " << diffPath(fe.file, base, "a/") << "\n+++ " << diffPath(fe.file, base, "b/")
+           << "\n";
+        header = true;
+      }
+      // An empty side is numbered by the line before it
+      size_t oldStart = oldCount ? begin + 1 : begin;
+      size_t newStart = newCount ? begin + delta + 1 : begin + delta;
+      os << "@@ -" << oldStart << "," << oldCount << " +" << newStart << "," << newCount
+         << " @@\n";
+      for (const auto& l : hunk) {
+        os << l.tag << l.text;
+        if (!l.text.ends_with("\n")) os << "\n\\ No newline at end of file\n";
       }
-      content.replace(f.offset, f.length, f.replacement);
+      delta += (long)newCount - (long)oldCount;
     }
+    c = e;
+  }
+}
 
-    if (!writeFile(file, content)) {
-      if (error) *error = "Failed to write " + file;
+} // namespace
+
+std::string FileEdits::apply() const {
+  return splice(original, edits, [](const FixIt& f) -> const FixIt& { return f; });
+}
+
+bool RefactorEngine::planFixes(const std::vector<FixIt>& fixes, const Overlay* overlay,
+                               std::vector<FileEdits>& out, std::string* error,
+                               ApplyStats* stats) {
+  std::map<std::string, std::vector<const FixIt*>> byFile;
+  for (const auto& f : fixes) byFile[f.file].push_back(&f);
+
+  ApplyStats total;
+  for (auto& [file, edits] : byFile) {
+    FileResult r;
+    std::unique_ptr<llvm::MemoryBuffer> buf;
+    llvm::StringRef content;
+    std::vector<const FixIt*> keep;
+    if (!loadFile(file, overlay, buf, content, r.error) ||
+        !selectEdits(file, content, edits, keep, r)) {
+      if (error) *error = r.error;
       return false;
     }
+    total.merged += r.stats.merged;
+    total.rejected += r.stats.rejected;
+    if (keep.empty()) continue;
+
+    FileEdits fe;
+    fe.file = file;
+    fe.original = content.str();
+    fe.edits.reserve(keep.size());
+    for (const FixIt* f : keep) fe.edits.push_back(*f);
+    total.files++;
+    total.applied += keep.size();
+    out.push_back(std::move(fe));
   }
+  if (stats) *stats = total;
   return true;
 }
 
+std::string RefactorEngine::writeDiff(const std::vector<FileEdits>& files, llvm::raw_ostream& os) {
+  std::string base = diffBase(files);
+  for (const auto& fe : files) writeFileDiff(fe, base, os);
+  os.flush();
+  return base;
+}
+
+void RefactorEngine::writeEdits(const std::vector<FileEdits>& files, llvm::raw_ostream& os) {
+  for (const auto& fe : files) {
+    LineTable lines(fe.original);
+    auto position = [&](size_t offset, int64_t& line, int64_t& column) {
+      size_t l = lines.lineOf(offset);
+      line = (int64_t)l + 1;
+      column = (int64_t)(offset - lines.begin(l)) + 1;
+    };
+    for (const auto& f : fe.edits) {
+      int64_t line, column, endLine, endColumn;
+      position(f.offset, line, column);
+      position((size_t)f.offset + f.length, endLine, endColumn);
+      llvm::json::OStream J(os);
+      J.object([&] {
+        J.attribute("file", fe.file);
+        J.attribute("offset", (int64_t)f.offset);
+        J.attribute("length", (int64_t)f.length);
+        J.attribute("line", line);
+        J.attribute("column", column);
+        J.attribute("endLine", endLine);
+        J.attribute("endColumn", endColumn);
+        J.attribute("replacement", f.replacement);
+        J.attribute("note", f.note);
+      });
+      os << "\n";
+    }
+  }
+  os.flush();
+}
+
+bool RefactorEngine::applyFixes(const std::vector<FixIt>& fixes, const ApplyOptions& opts,
+                                std::string* error, ApplyStats* stats) {
+  // group fixes by file; ordered so errors are reported deterministically
+  std::map<std::string, std::vector<const FixIt*>> byFile;
+  for (const auto& f : fixes) byFile[f.file].push_back(&f);
+
+  std::vector<std::pair<const std::string*, std::vector<const FixIt*>*>> work;
+  work.reserve(byFile.size());
+  for (auto& [file, vec] : byFile) work.push_back({&file, &vec});
+
+  std::vector<FileResult> results(work.size());
+  std::atomic<size_t> next{0};
+  auto run = [&] {
+    for (size_t i = next++; i < work.size(); i = next++)
+      results[i] = applyToFile(*work[i].first, *work[i].second, opts);
+  };
+
+  unsigned jobs = opts.jobs ? opts.jobs : std::thread::hardware_concurrency();
+  jobs = std::max(1u, std::min<unsigned>(jobs, work.size()));
+  if (jobs == 1) {
+    run();
+  } else {
+    std::vector<std::thread> pool;
+    pool.reserve(jobs);
+    for (unsigned t = 0; t < jobs; ++t) pool.emplace_back(run);
+    for (auto& th : pool) th.join();
+  }
+
+  bool ok = true;
+  ApplyStats total;
+  for (const auto& r : results) {
+    total.files += r.stats.files;
+    total.applied += r.stats.applied;
+    total.merged += r.stats.merged;
+    total.rejected += r.stats.rejected;
+    if (!r.ok && ok) {
+      ok = false;
+      if (error) *error = r.error;
+    }
+  }
+  if (stats) *stats = total;
+  return ok;
+}
+
 } // namespace aicr
@@ -0,0 +1,179 @@
+#include "report/Reporter.hpp"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace aicr {
+
+namespace {
+
+const char* severityName(Severity s) {
+  switch (s) {
+  case Severity::Info: return "info";
+  case Severity::Warning: return "warning";
+  case Severity::Error: return "error";
+  }
+  return "warning";
+}
+
+class TextReporter final : public Reporter {
+  llvm::raw_ostream& OS;
+public:
+  explicit TextReporter(llvm::raw_ostream& os) : OS(os) {}
+  void report(const IssueStore& issues) override {
+    for (const auto& i : issues.entries()) {
+      OS << symbolName(i.file) << ":" << i.line << ":" << i.column
+         << " [" << symbolName(i.id) << "] " << i.message << "\n";
+      for (const auto& f : issues.fixesOf(i)) {
+        OS << "  fix: " << symbolName(f.note) << " (offset " << f.offset
+           << ", len " << f.length << ")\n";
+      }
+    }
+    OS.flush();
+  }
+};
+
+class JsonlReporter final : public Reporter {
+  llvm::raw_ostream& OS;
+public:
+  explicit JsonlReporter(llvm::raw_ostream& os) : OS(os) {}
+  void report(const IssueStore& issues) override {
+    for (const auto& i : issues.entries()) {
+      llvm::json::OStream J(OS);
+      J.object([&] {
+        J.attribute("id", symbolName(i.id));
+        J.attribute("severity", severityName(i.severity));
+        J.attribute("file", symbolName(i.file));
+        J.attribute("line", (int64_t)i.line);
+        J.attribute("column", (int64_t)i.column);
+        J.attribute("message", i.message);
+        if (i.fingerprint) J.attribute("fingerprint", llvm::utohexstr(i.fingerprint, true, 16));
+        J.attributeArray("fixes", [&] {
+          for (const auto& f : issues.fixesOf(i)) {
+            J.object([&] {
+              J.attribute("file", symbolName(f.file));
+              J.attribute("offset", (int64_t)f.offset);
+              J.attribute("length", (int64_t)f.length);
+              J.attribute("replacement", f.replacement);
+              J.attribute("note", symbolName(f.note));
+            });
+          }
+        });
+      });
+      OS << "\n";
+    }
+    OS.flush();
+  }
+};
+
+class SarifReporter final : public Reporter {
+  llvm::raw_ostream& OS;
+  llvm::json::OStream J;
+
+  static const char* level(Severity s) {
+    switch (s) {
+    case Severity::Info: return "note";
+    case Severity::Warning: return "warning";
+    case Severity::Error: return "error";
+    }
+    return "warning";
+  }
+
+public:
+  explicit SarifReporter(llvm::raw_ostream& os) : OS(os), J(os) {}
+
+  void begin() override {
+    J.objectBegin();
+    J.attribute("$schema", "https://json.schemastore.org/sarif-2.1.0.json");
+    J.attribute("version", "2.1.0");
+    J.attributeBegin("runs");
+    J.arrayBegin();
+    J.objectBegin();
+    J.attributeObject("tool", [&] {
+      J.attributeObject("driver", [&] {
+        J.attribute("name", "aicr");
+      });
+    });
+    J.attributeBegin("results");
+    J.arrayBegin();
+    OS.flush();
+  }
+
+  void report(const IssueStore& issues) override {
+    for (const auto& i : issues.entries()) {
+      J.object([&] {
+        J.attribute("ruleId", symbolName(i.id));
+        J.attribute("level", level(i.severity));
+        J.attributeObject("message", [&] { J.attribute("text", i.message); });
+        J.attributeArray("locations", [&] {
+          J.object([&] {
+            J.attributeObject("physicalLocation", [&] {
+              J.attributeObject("artifactLocation", [&] { J.attribute("uri", symbolName(i.file)); });
+              J.attributeObject("region", [&] {
+                J.attribute("startLine", (int64_t)i.line);
+                J.attribute("startColumn", (int64_t)i.column);
+              });
+            });
+          });
+        });
+        if (i.fingerprint)
+          J.attributeObject("partialFingerprints", [&] {
+            J.attribute("aicr/v1", llvm::utohexstr(i.fingerprint, true, 16));
+          });
+        if (!i.numFixes) return;
+        J.attributeArray("fixes", [&] {
+          for (const auto& f : issues.fixesOf(i)) {
+            J.object([&] {
+              J.attributeObject("description", [&] { J.attribute("text", symbolName(f.note)); });
+              J.attributeArray("artifactChanges", [&] {
+                J.object([&] {
+                  J.attributeObject("artifactLocation", [&] { J.attribute("uri", symbolName(f.file)); });
+                  J.attributeArray("replacements", [&] {
+                    J.object([&] {
+                      J.attributeObject("deletedRegion", [&] {
+                        J.attribute("byteOffset", (int64_t)f.offset);
+                        J.attribute("byteLength", (int64_t)f.length);
+                      });
+                      J.attributeObject("insertedContent", [&] {
+                        J.attribute("text", f.replacement);
+                      });
+                    });
+                  });
+                });
+              });
+            });
+          }
+        });
+      });
+    }
+    OS.flush();
+  }
+
+  void end() override {
+    J.arrayEnd();      // results
+    J.attributeEnd();
+    J.objectEnd();     // run
+    J.arrayEnd();      // runs
+    J.attributeEnd();
+    J.objectEnd();
+    OS << "\n";
+    OS.flush();
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Reporter> makeTextReporter(llvm::raw_ostream& os) {
+  return std::make_unique<TextReporter>(os);
+}
+
+std::unique_ptr<Reporter> makeJsonlReporter(llvm::raw_ostream& os) {
+  return std::make_unique<JsonlReporter>(os);
+}
+
+std::unique_ptr<Reporter> makeSarifReporter(llvm::raw_ostream& os) {
+  return std::make_unique<SarifReporter>(os);
+}
+
+} // namespace aicr
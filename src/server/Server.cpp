@@ -0,0 +1,240 @@
+#include "server/Server.hpp"
+#include "cache/BinaryIO.hpp"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace aicr {
+
+namespace {
+
+// Wire format, both directions: a 1-byte tag, a u32 little-endian length
+// and the payload. Requests are a single 'q' frame; responses are any
+// number of 'o' (stdout) and 'e' (stderr) frames followed by one 'x'
+// frame holding the exit code.
+enum Tag : char { Request = 'q', Out = 'o', Err = 'e', Exit = 'x' };
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL; // a vanished client must not kill the server
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+bool sendAll(int fd, const char* p, size_t n) {
+  while (n) {
+    ssize_t w = ::send(fd, p, n, kSendFlags);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    p += w;
+    n -= (size_t)w;
+  }
+  return true;
+}
+
+bool recvAll(int fd, char* p, size_t n) {
+  while (n) {
+    ssize_t r = ::recv(fd, p, n, 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    p += r;
+    n -= (size_t)r;
+  }
+  return true;
+}
+
+bool sendFrame(int fd, char tag, llvm::StringRef payload) {
+  Writer w;
+  w.u8((uint8_t)tag);
+  w.str(payload);
+  return sendAll(fd, w.buf.data(), w.buf.size());
+}
+
+bool recvFrame(int fd, char& tag, std::string& payload) {
+  char head[5];
+  if (!recvAll(fd, head, sizeof head)) return false;
+  tag = head[0];
+  uint32_t n = Reader(llvm::StringRef(head + 1, 4)).u32();
+  payload.resize(n);
+  return recvAll(fd, payload.data(), n);
+}
+
+// Forwards everything written to it as frames of one tag. After the peer
+// goes away writes are dropped, so an abandoned request still runs to
+// completion (and still warms the caches).
+class FrameStream : public llvm::raw_ostream {
+  int Fd;
+  char Tag;
+  bool Broken = false;
+  uint64_t Pos = 0;
+
+  void write_impl(const char* p, size_t n) override {
+    Pos += n;
+    if (!Broken && !sendFrame(Fd, Tag, llvm::StringRef(p, n))) Broken = true;
+  }
+  uint64_t current_pos() const override { return Pos; }
+
+public:
+  FrameStream(int fd, char tag) : Fd(fd), Tag(tag) {}
+  ~FrameStream() override { flush(); }
+};
+
+bool makeAddress(const std::string& path, sockaddr_un& addr, std::string* error) {
+  std::memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof addr.sun_path) {
+    if (error) *error = "socket path too long: " + path;
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+int connectTo(const std::string& path, std::string* error) {
+  sockaddr_un addr;
+  if (!makeAddress(path, addr, error)) return -1;
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    if (error) *error = std::strerror(errno);
+    return -1;
+  }
+  if (::connect(fd, (sockaddr*)&addr, sizeof addr) != 0) {
+    if (error) *error = "cannot connect to " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void handle(int fd, const ServeHandler& handler) {
+  char tag = 0;
+  std::string payload;
+  if (!recvFrame(fd, tag, payload) || tag != Request) return;
+
+  ServeRequest req;
+  Reader r(payload);
+  req.cwd = r.str();
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) req.args.push_back(r.str());
+  req.hasInput = r.u8() != 0;
+  if (req.hasInput) req.input = r.str();
+  if (!r.ok || req.args.empty()) return;
+
+  int rc;
+  {
+    FrameStream out(fd, Out), err(fd, Err);
+    rc = handler(req, out, err);
+  }
+  Writer w;
+  w.u32((uint32_t)rc);
+  sendFrame(fd, Exit, w.buf);
+}
+
+// Requests can write files as the server's user (--fix, --output), so
+// only that user may make them
+bool sameUser(int fd) {
+#if defined(__linux__)
+  ucred cred;
+  socklen_t len = sizeof cred;
+  return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == ::geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  return ::getpeereid(fd, &uid, &gid) == 0 && uid == ::geteuid();
+#endif
+}
+
+} // namespace
+
+int serve(const std::string& socketPath, const ServeHandler& handler) {
+  sockaddr_un addr;
+  std::string error;
+  if (!makeAddress(socketPath, addr, &error)) {
+    llvm::errs() << error << "\n";
+    return 1;
+  }
+  // A socket file nobody answers on is left over from a killed server
+  if (llvm::sys::fs::exists(socketPath)) {
+    int probe = connectTo(socketPath, nullptr);
+    if (probe >= 0) {
+      ::close(probe);
+      llvm::errs() << "A server is already listening on " << socketPath << "\n";
+      return 1;
+    }
+    ::unlink(socketPath.c_str());
+  }
+
+  // Owner-only from the moment it exists, whatever the umask
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask = ::umask(0177);
+  bool bound = fd >= 0 && ::bind(fd, (sockaddr*)&addr, sizeof addr) == 0;
+  ::umask(mask);
+  if (!bound || ::chmod(socketPath.c_str(), 0600) != 0 || ::listen(fd, 16) != 0) {
+    llvm::errs() << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+    if (fd >= 0) ::close(fd);
+    return 1;
+  }
+  llvm::errs() << "aicr: serving on " << socketPath << "\n";
+
+  for (;;) {
+    int c = ::accept(fd, nullptr, nullptr);
+    if (c < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      llvm::errs() << "accept: " << std::strerror(errno) << "\n";
+      break;
+    }
+    if (!sameUser(c)) {
+      llvm::errs() << "aicr: refused a request from another user\n";
+      ::close(c);
+      continue;
+    }
+    handle(c, handler);
+    ::close(c);
+  }
+  ::close(fd);
+  ::unlink(socketPath.c_str());
+  return 1;
+}
+
+int runClient(const std::string& socketPath, const ServeRequest& req, std::string* error) {
+  int fd = connectTo(socketPath, error);
+  if (fd < 0) return -1;
+
+  Writer w;
+  w.str(req.cwd);
+  w.u32((uint32_t)req.args.size());
+  for (const auto& a : req.args) w.str(a);
+  w.u8(req.hasInput);
+  if (req.hasInput) w.str(req.input);
+  if (!sendFrame(fd, Request, w.buf)) {
+    if (error) *error = "lost connection to " + socketPath;
+    ::close(fd);
+    return -1;
+  }
+
+  int rc = -1;
+  char tag = 0;
+  std::string payload;
+  while (recvFrame(fd, tag, payload)) {
+    if (tag == Out) {
+      llvm::outs() << payload;
+      llvm::outs().flush();
+    } else if (tag == Err) {
+      llvm::errs() << payload;
+    } else if (tag == Exit) {
+      rc = (int)Reader(payload).u32();
+      break;
+    }
+  }
+  ::close(fd);
+  if (rc < 0 && error) *error = "server closed the connection before finishing";
+  return rc;
+}
+
+} // namespace aicr
@@ -0,0 +1,280 @@
+#include "shard/Shard.hpp"
+#include "cache/BinaryIO.hpp"
+#include "compiledb/CompileDb.hpp"
+#include "discovery/FileDiscovery.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+
+namespace aicr {
+
+namespace {
+
+constexpr uint32_t kCostsMagic = 0x43434941;  // "AICC"
+constexpr uint32_t kShardMagic = 0x53534941;  // "AISS"
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kResultVersion = 4;
+
+void writeCosts(Writer& w, const std::map<std::string, double>& ms) {
+  w.u32((uint32_t)ms.size());
+  for (const auto& [file, v] : ms) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof bits);
+    w.str(file); w.u64(bits);
+  }
+}
+
+void readCosts(Reader& r, CostHistory& out) {
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    std::string file = r.str();
+    uint64_t bits = r.u64();
+    double v;
+    std::memcpy(&v, &bits, sizeof v);
+    if (r.ok) out.record(file, v);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer> readAll(const std::string& path, std::string* error) {
+  auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!buf) {
+    if (error) *error = "Cannot read " + path + ": " + buf.getError().message();
+    return nullptr;
+  }
+  return std::move(*buf);
+}
+
+// Issue and fix paths rewritten by `to`, fixes nested in issues included
+template <class Fn>
+void movePaths(Issue& is, Fn&& to) {
+  is.file = to(is.file);
+  for (auto& f : is.fixes) f.file = to(f.file);
+}
+
+} // namespace
+
+std::string shardRoot(const std::string& path, const std::string& explicitDb) {
+  std::string json = findCompileDb(path, explicitDb);
+  if (json.empty()) return realPath(".");
+  return realPath(llvm::sys::path::parent_path(realPath(json)));
+}
+
+std::string rootRelative(const std::string& root, const std::string& file) {
+  llvm::SmallString<256> abs(file);
+  llvm::sys::fs::make_absolute(abs);
+  std::string real = realPath(abs);
+  llvm::StringRef f(real);
+  if (!root.empty() && f.consume_front(root) && f.consume_front("/")) return f.str();
+  return real;
+}
+
+std::string fromRoot(const std::string& root, const std::string& file) {
+  if (root.empty() || llvm::sys::path::is_absolute(file)) return file;
+  llvm::SmallString<256> p(root);
+  llvm::sys::path::append(p, file);
+  return std::string(p.str());
+}
+
+void rebaseIssues(std::vector<Issue>& issues, const std::string& from, const std::string& to) {
+  if (from.empty() || to.empty() || from == to) return;
+  for (auto& is : issues)
+    movePaths(is, [&](const std::string& file) {
+      llvm::StringRef f(file);
+      if (f.consume_front(from) && f.consume_front("/")) return fromRoot(to, f.str());
+      return file;
+    });
+}
+
+bool parseShardSpec(llvm::StringRef text, ShardSpec& out, std::string* error) {
+  auto [i, n] = text.split('/');
+  unsigned index = 0, count = 0;
+  if (i.getAsInteger(10, index) || n.getAsInteger(10, count) || count == 0 || index >= count) {
+    if (error) *error = "Invalid shard '" + text.str() + "' (expected i/N with 0 <= i < N)";
+    return false;
+  }
+  out.index = index;
+  out.count = count;
+  return true;
+}
+
+void CostHistory::record(const std::string& file, double ms) {
+  std::lock_guard<std::mutex> lock(m_);
+  ms_[file] = ms;
+}
+
+std::optional<double> CostHistory::cost(const std::string& file) const {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = ms_.find(file);
+  if (it == ms_.end()) return std::nullopt;
+  return it->second;
+}
+
+void CostHistory::merge(const CostHistory& newer) {
+  auto add = newer.snapshot();
+  std::lock_guard<std::mutex> lock(m_);
+  for (const auto& [file, v] : add) {
+    auto [it, inserted] = ms_.emplace(file, v);
+    if (!inserted) it->second = (it->second + v) / 2;
+  }
+}
+
+void CostHistory::prune(const std::string& root) {
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto it = ms_.begin(); it != ms_.end();)
+    it = llvm::sys::fs::exists(fromRoot(root, it->first)) ? std::next(it) : ms_.erase(it);
+}
+
+std::map<std::string, double> CostHistory::snapshot() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return ms_;
+}
+
+bool CostHistory::load(const std::string& path, std::string* error) {
+  if (!llvm::sys::fs::exists(path)) return true;
+  auto buf = readAll(path, error);
+  if (!buf) return false;
+  Reader r(buf->getBuffer());
+  if (r.u32() != kCostsMagic || !r.ok) {
+    if (error) *error = path + " is not a cost history";
+    return false;
+  }
+  // Older histories keyed files differently; start over rather than
+  // mismatch them
+  if (r.u32() != kVersion) return true;
+  readCosts(r, *this);
+  if (!r.ok && error) *error = path + " is truncated";
+  return r.ok;
+}
+
+bool CostHistory::save(const std::string& path, std::string* error) const {
+  Writer w;
+  w.u32(kCostsMagic); w.u32(kVersion);
+  writeCosts(w, snapshot());
+  if (writeFileAtomic(path, w.buf)) return true;
+  if (error) *error = "Cannot write " + path;
+  return false;
+}
+
+std::vector<std::string> selectShard(const std::vector<std::string>& files, ShardSpec spec,
+                                     const CostHistory& history, const std::string& root) {
+  if (spec.count <= 1) return files;
+
+  std::vector<double> cost(files.size());
+  std::vector<uint64_t> size(files.size(), 0);
+  double knownMs = 0, knownBytes = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    llvm::sys::fs::file_size(files[i], size[i]);
+    if (auto ms = history.cost(rootRelative(root, files[i]))) {
+      cost[i] = *ms;
+      knownMs += *ms;
+      knownBytes += (double)size[i];
+    } else {
+      cost[i] = -1;
+    }
+  }
+  double perByte = knownBytes > 0 && knownMs > 0 ? knownMs / knownBytes : 1.0;
+  for (size_t i = 0; i < files.size(); ++i)
+    if (cost[i] < 0) cost[i] = (double)size[i] * perByte;
+
+  std::vector<size_t> order(files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (cost[a] != cost[b]) return cost[a] > cost[b];
+    return files[a] < files[b];
+  });
+
+  std::vector<double> load(spec.count, 0);
+  std::vector<bool> mine(files.size(), false);
+  for (size_t i : order) {
+    unsigned to = (unsigned)(std::min_element(load.begin(), load.end()) - load.begin());
+    load[to] += cost[i];
+    mine[i] = to == spec.index;
+  }
+
+  std::vector<std::string> out;
+  for (size_t i = 0; i < files.size(); ++i)
+    if (mine[i]) out.push_back(files[i]);
+  return out;
+}
+
+bool writeShardResult(const std::string& path, const std::string& root, ShardSpec spec,
+                      const IssueStore& issues, const std::vector<FixIt>& fixes,
+                      const CostHistory& costs, const RuleFacts& facts, std::string* error) {
+  auto relative = [&](const std::string& file) { return rootRelative(root, file); };
+  Writer w;
+  w.u32(kShardMagic); w.u32(kResultVersion);
+  w.u32(spec.index); w.u32(spec.count);
+  w.str(root);
+  w.u32((uint32_t)issues.size());
+  for (size_t i = 0; i < issues.size(); ++i) {
+    Issue is = issues.issue(i);
+    movePaths(is, relative);
+    writeIssue(w, is);
+  }
+  w.u32((uint32_t)fixes.size());
+  for (const auto& f : fixes) {
+    FixIt rel = f;
+    rel.file = relative(f.file);
+    writeFix(w, rel);
+  }
+  std::map<std::string, double> ms;
+  for (const auto& [file, v] : costs.snapshot()) ms[relative(file)] = v;
+  writeCosts(w, ms);
+  w.u32((uint32_t)facts.size());
+  for (const auto& [id, blobs] : facts) {
+    w.str(id);
+    w.u32((uint32_t)blobs.size());
+    for (const auto& b : blobs) w.str(b);
+  }
+  if (writeFileAtomic(path, w.buf)) return true;
+  if (error) *error = "Cannot write " + path;
+  return false;
+}
+
+bool readShardResult(const std::string& path, const std::string& root, ShardResult& out,
+                     std::string* error) {
+  auto here = [&](const std::string& file) { return fromRoot(root, file); };
+  auto buf = readAll(path, error);
+  if (!buf) return false;
+  Reader r(buf->getBuffer());
+  if (r.u32() != kShardMagic || r.u32() != kResultVersion || !r.ok) {
+    if (error) *error = path + " is not a shard result";
+    return false;
+  }
+  out.spec.index = r.u32();
+  out.spec.count = r.u32();
+  out.root = r.str();
+  uint32_t n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    Issue is = readIssue(r);
+    movePaths(is, here);
+    out.issues.add(is);
+  }
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    out.fixes.push_back(readFix(r));
+    out.fixes.back().file = here(out.fixes.back().file);
+  }
+  readCosts(r, out.costs);
+  n = r.u32();
+  for (uint32_t i = 0; i < n && r.ok; ++i) {
+    auto& blobs = out.facts[r.str()];
+    uint32_t m = r.u32();
+    for (uint32_t j = 0; j < m && r.ok; ++j) blobs.push_back(r.str());
+  }
+  if (!r.ok || out.spec.count == 0 || out.spec.index >= out.spec.count) {
+    if (error) *error = path + " is truncated or corrupt";
+    return false;
+  }
+  return true;
+}
+
+} // namespace aicr
@@ -0,0 +1,189 @@
+#include "vcs/GitDiff.hpp"
+#include "discovery/FileDiscovery.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+#include <algorithm>
+#include <optional>
+
+namespace aicr {
+
+namespace {
+
+// Runs git with `args` and captures its stdout; false with stderr's text
+// if it fails
+bool runGit(llvm::ArrayRef<llvm::StringRef> args, std::string& out, std::string* error) {
+  auto git = llvm::sys::findProgramByName("git");
+  if (!git) {
+    if (error) *error = "git not found in PATH";
+    return false;
+  }
+  llvm::SmallString<128> outFile, errFile;
+  if (llvm::sys::fs::createTemporaryFile("aicr-git", "out", outFile) ||
+      llvm::sys::fs::createTemporaryFile("aicr-git", "err", errFile)) {
+    if (error) *error = "Cannot create a temporary file for git output";
+    return false;
+  }
+  std::vector<llvm::StringRef> argv{"git"};
+  argv.insert(argv.end(), args.begin(), args.end());
+  std::optional<llvm::StringRef> redirects[] = {std::nullopt, llvm::StringRef(outFile),
+                                                llvm::StringRef(errFile)};
+  std::string msg;
+  int rc = llvm::sys::ExecuteAndWait(*git, argv, std::nullopt, redirects, 0, 0, &msg);
+
+  auto read = [](llvm::StringRef path) {
+    auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    return buf ? (*buf)->getBuffer().str() : std::string();
+  };
+  out = read(outFile);
+  std::string err = read(errFile);
+  llvm::sys::fs::remove(outFile);
+  llvm::sys::fs::remove(errFile);
+  if (rc == 0) return true;
+  if (error) {
+    *error = "git " + llvm::join(args.begin(), args.end(), " ") + " failed: " +
+             (!msg.empty() ? msg : llvm::StringRef(err).trim().str());
+  }
+  return false;
+}
+
+// A path from a diff header. Git puts names with special characters in C
+// quotes with octal escapes, and ends names holding a space with a tab.
+std::string unquotePath(llvm::StringRef s) {
+  if (!s.starts_with("\"")) return s.rtrim("\t").str();
+  std::string out;
+  for (size_t i = 1; i < s.size() && s[i] != '"'; ++i) {
+    char c = s[i];
+    if (c != '\\' || i + 1 == s.size()) {
+      out.push_back(c);
+      continue;
+    }
+    c = s[++i];
+    switch (c) {
+    case 'a': out.push_back('\a'); break;
+    case 'b': out.push_back('\b'); break;
+    case 'f': out.push_back('\f'); break;
+    case 'n': out.push_back('\n'); break;
+    case 'r': out.push_back('\r'); break;
+    case 't': out.push_back('\t'); break;
+    case 'v': out.push_back('\v'); break;
+    default:
+      if (c >= '0' && c <= '3' && i + 2 < s.size()) {
+        out.push_back((char)(((c - '0') << 6) | ((s[i + 1] - '0') << 3) | (s[i + 2] - '0')));
+        i += 2;
+      } else {
+        out.push_back(c); // \\ and \"
+      }
+    }
+  }
+  return out;
+}
+
+} // namespace
+
+bool ChangedLines::touches(const std::string& file, unsigned line) const {
+  auto it = files.find(file);
+  if (it == files.end()) return false;
+  // Ranges are sorted and disjoint: the last one starting at or before line
+  auto r = std::upper_bound(it->second.begin(), it->second.end(), line,
+                            [](unsigned l, const LineRange& x) { return l < x.first; });
+  return r != it->second.begin() && line <= std::prev(r)->last;
+}
+
+void parseUnifiedDiff(llvm::StringRef diff, llvm::StringRef root, ChangedLines& out) {
+  std::vector<LineRange>* current = nullptr;
+  bool afterOld = false;              // the last line was a "--- " header
+  unsigned oldLeft = 0, newLeft = 0;  // body lines still due in this hunk
+  while (!diff.empty()) {
+    auto [line, rest] = diff.split('\n');
+    diff = rest;
+    line = line.rtrim("\r");
+
+    // Hunk bodies first: an added "++ x" or removed "-- x" reads as a header
+    if (oldLeft || newLeft) {
+      char c = line.empty() ? ' ' : line[0];
+      if ((c == '-' || c == ' ') && oldLeft) --oldLeft;
+      if ((c == '+' || c == ' ') && newLeft) --newLeft;
+      continue;
+    }
+
+    bool wasAfterOld = afterOld;
+    afterOld = line.starts_with("--- ");
+    if (line.starts_with("diff ")) {
+      current = nullptr;
+      continue;
+    }
+    if (line.consume_front("+++ ")) {
+      if (!wasAfterOld) continue;
+      current = nullptr;
+      std::string name = unquotePath(line);
+      if (name == "/dev/null") continue; // deleted
+      llvm::StringRef rel(name);
+      if (!rel.consume_front("b/")) continue;
+      llvm::SmallString<256> path(root);
+      llvm::sys::path::append(path, rel);
+      current = &out.files[realPath(path)];
+      continue;
+    }
+    if (!line.consume_front("@@ ")) continue;
+    // @@ -a[,b] +c[,d] @@
+    auto count = [](llvm::StringRef spec, unsigned& first, unsigned& n) {
+      spec = spec.take_until([](char c) { return c == ' '; });
+      auto [start, len] = spec.split(',');
+      n = 1;
+      return !start.getAsInteger(10, first) && (len.empty() || !len.getAsInteger(10, n));
+    };
+    size_t minus = line.find('-'), plus = line.find('+');
+    unsigned oldFirst, first, n;
+    if (minus == llvm::StringRef::npos || plus == llvm::StringRef::npos ||
+        !count(line.substr(minus + 1), oldFirst, oldLeft) ||
+        !count(line.substr(plus + 1), first, n)) {
+      oldLeft = 0;
+      continue;
+    }
+    newLeft = n;
+    if (!current) continue;
+    if (n == 0) current->push_back({std::max(first, 1u), std::max(first, 1u)});
+    else current->push_back({first, first + n - 1});
+  }
+
+  for (auto& [file, ranges] : out.files) {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const LineRange& a, const LineRange& b) { return a.first < b.first; });
+    std::vector<LineRange> merged;
+    for (const auto& r : ranges) {
+      if (!merged.empty() && r.first <= merged.back().last + 1)
+        merged.back().last = std::max(merged.back().last, r.last);
+      else
+        merged.push_back(r);
+    }
+    ranges = std::move(merged);
+  }
+}
+
+bool gitChangedLines(const std::string& rev, ChangedLines& out, std::string* error) {
+  std::string root;
+  if (!runGit({"rev-parse", "--show-toplevel"}, root, error)) return false;
+  root = llvm::StringRef(root).trim().str();
+
+  std::string base;
+  if (runGit({"merge-base", rev, "HEAD"}, base, nullptr)) base = llvm::StringRef(base).trim().str();
+  else base = rev;
+
+  std::string diff;
+  // Explicit prefixes override diff.noprefix and diff.mnemonicPrefix
+  if (!runGit({"-C", root, "diff", "--no-color", "--no-ext-diff", "--unified=0", "-M",
+               "--src-prefix=a/", "--dst-prefix=b/", base, "--"},
+              diff, error))
+    return false;
+  parseUnifiedDiff(diff, root, out);
+  return true;
+}
+
+} // namespace aicr